@@ -0,0 +1,234 @@
+//
+// Created by zwz on 2024/10/18.
+//
+// Cost of one log call per sink, per pattern flag and with the level disabled.
+// Machine-readable results: bench_log --benchmark_format=json (or --benchmark_out=log.json).
+// Counters: items_per_second (throughput, summed over threads), allocs_per_call, and for the
+// latency runs p50_ns/p99_ns/p999_ns of single calls (steady_clock around each call, samples of
+// all threads merged before taking the percentiles).
+#include <benchmark/benchmark.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "log.h"
+#include "async_logger.h"
+#include "binary_log.h"
+
+// Heap allocations made by the calling thread.
+static thread_local uint64_t t_allocations = 0;
+
+void* operator new(std::size_t size)
+{
+    ++t_allocations;
+    if (void* ptr = std::malloc(size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+static const char* kBenchFile = "./logs/bench_log.log";
+
+// One call site per logger: LOG_*_TO caches the logger handle per site.
+static void logStdout(int i)
+{
+    LOG_INFO_TO("bench_stdout", "dma chn %d done, %s bytes %u", i, "rx", 4096u);
+}
+static void logStdoutAsync(int i)
+{
+    LOG_INFO_TO("bench_stdout_async", "dma chn %d done, %s bytes %u", i, "rx", 4096u);
+}
+static void logFile(int i)
+{
+    LOG_INFO_TO("bench_file", "dma chn %d done, %s bytes %u", i, "rx", 4096u);
+}
+static void logFileFmt(int i)
+{
+    LOGF_INFO_TO("bench_file", "dma chn {} done, {} bytes {}", i, "rx", 4096u);
+}
+static void logAsyncFile(int i)
+{
+    LOG_INFO_TO("bench_async", "dma chn %d done, %s bytes %u", i, "rx", 4096u);
+}
+static void logBinary(int i)
+{
+    LOG_BIN_INFO("dma chn %d done, %s bytes %u", i, "rx", 4096u);
+}
+static void logDisabled(int i)
+{
+    LOG_DEBUG_TO("bench_file", "dma chn %d done, %s bytes %u", i, "rx", 4096u);
+}
+
+static void setUp()
+{
+    Nazl::create_parent_dir(kBenchFile);
+    auto& manager = logger_manager::GetInstance();
+    auto format = std::make_shared<LogFormat>("%T %L [%f:%l] %N %m%E");
+    auto registerLogger = [&](const std::string& name, std::shared_ptr<Sink> sink, bool async)
+    {
+        sink->SetFormat(format);
+        sink->SetLevel(LogLevel(LogLevel::LevelEnum::Info));
+        std::vector<std::shared_ptr<Sink>> sinks{sink};
+        if (async)
+        {
+            manager.RegisterLogger(std::make_shared<AsyncLogger>(name, sinks.begin(), sinks.end()));
+        }
+        else
+        {
+            manager.RegisterLogger(std::make_shared<Logger>(name, sinks.begin(), sinks.end()));
+        }
+    };
+    int devnull = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+    registerLogger("bench_stdout", std::make_shared<StdoutSink>(false, StdoutSink::kDefaultMaxPending, devnull), false);
+    registerLogger("bench_stdout_async", std::make_shared<StdoutSink>(true, StdoutSink::kDefaultMaxPending, devnull), false);
+    registerLogger("bench_file", std::make_shared<FileSink>(kBenchFile, 256 * 1024 * 1024, 2), false);
+    registerLogger("bench_async", std::make_shared<FileSink>(std::string(kBenchFile) + ".async", 256 * 1024 * 1024, 2), true);
+    BinaryLog::binary_log_manager::GetInstance().Start(std::string(kBenchFile) + ".bin", LogLevel(LogLevel::LevelEnum::Info));
+}
+
+static void reportAllocations(benchmark::State& state, uint64_t allocations)
+{
+    state.counters["allocs_per_call"] = benchmark::Counter(static_cast<double>(allocations),
+                                                           benchmark::Counter::kAvgIterations);
+}
+
+static void BM_LogThroughput(benchmark::State& state, void (*log)(int))
+{
+    int i = 0;
+    uint64_t allocations = t_allocations;
+    for (auto _ : state)
+    {
+        log(i++);
+    }
+    reportAllocations(state, t_allocations - allocations);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK_CAPTURE(BM_LogThroughput, stdout, &logStdout)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_LogThroughput, stdout_async, &logStdoutAsync)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_LogThroughput, file, &logFile)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_LogThroughput, file_fmt, &logFileFmt)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_LogThroughput, async_file, &logAsyncFile)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_LogThroughput, binary, &logBinary)->ThreadRange(1, 8)->UseRealTime();
+BENCHMARK_CAPTURE(BM_LogThroughput, disabled, &logDisabled)->ThreadRange(1, 8)->UseRealTime();
+
+// The samples of every thread of one latency run; thread 0 takes the percentiles once all are in.
+struct LatencySamples
+{
+    std::mutex mutex_;
+    std::vector<uint32_t> samples_;
+    int threads_{0};
+};
+static LatencySamples g_latency;
+
+static void BM_LogLatency(benchmark::State& state, void (*log)(int))
+{
+    // a ring of the latest samples, enough for stable tails without growing during the run
+    std::vector<uint32_t> samples(1 << 20);
+    std::size_t count = 0;
+    int i = 0;
+    uint64_t allocations = t_allocations;
+    for (auto _ : state)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        log(i++);
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        samples[count++ & (samples.size() - 1)] = static_cast<uint32_t>(
+            std::min<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), UINT32_MAX));
+    }
+    reportAllocations(state, t_allocations - allocations);
+    samples.resize(std::min(count, samples.size()));
+    {
+        std::lock_guard<std::mutex> lock(g_latency.mutex_);
+        g_latency.samples_.insert(g_latency.samples_.end(), samples.begin(), samples.end());
+        ++g_latency.threads_;
+    }
+    // the counters of all threads are summed: only thread 0 reports, from the merged samples
+    double p50 = 0;
+    double p99 = 0;
+    double p999 = 0;
+    if (state.thread_index() == 0)
+    {
+        std::unique_lock<std::mutex> lock(g_latency.mutex_);
+        while (g_latency.threads_ < state.threads())
+        {
+            lock.unlock();
+            std::this_thread::yield();
+            lock.lock();
+        }
+        std::vector<uint32_t>& merged = g_latency.samples_;
+        std::sort(merged.begin(), merged.end());
+        auto percentile = [&](double pct)
+        {
+            return merged.empty() ? 0.0 : static_cast<double>(merged[static_cast<std::size_t>(pct * (merged.size() - 1))]);
+        };
+        p50 = percentile(0.50);
+        p99 = percentile(0.99);
+        p999 = percentile(0.999);
+        merged.clear();
+        g_latency.threads_ = 0;
+    }
+    state.counters["p50_ns"] = p50;
+    state.counters["p99_ns"] = p99;
+    state.counters["p999_ns"] = p999;
+}
+BENCHMARK_CAPTURE(BM_LogLatency, stdout, &logStdout)->Threads(1)->Threads(4)->UseRealTime();
+BENCHMARK_CAPTURE(BM_LogLatency, stdout_async, &logStdoutAsync)->Threads(1)->Threads(4)->UseRealTime();
+BENCHMARK_CAPTURE(BM_LogLatency, file, &logFile)->Threads(1)->Threads(4)->UseRealTime();
+BENCHMARK_CAPTURE(BM_LogLatency, async_file, &logAsyncFile)->Threads(1)->Threads(4)->UseRealTime();
+BENCHMARK_CAPTURE(BM_LogLatency, binary, &logBinary)->Threads(1)->Threads(4)->UseRealTime();
+BENCHMARK_CAPTURE(BM_LogLatency, disabled, &logDisabled)->Threads(1)->Threads(4)->UseRealTime();
+
+// Formatting cost of each pattern flag alone (and of the structured encodings) for one event.
+static const char* kPatterns[] = {"%T", "%e", "%u", "%L", "%f", "%l", "%N", "%t", "%m", "%E",
+                                  "%T %L [%f:%l] %N %m%E", "json", "binary"};
+
+static void BM_PatternFlag(benchmark::State& state)
+{
+    const char* pattern = kPatterns[state.range(0)];
+    state.SetLabel(pattern);
+    LogFormat format(pattern);
+    LogEvent event(__FILE__, __FUNCTION__, LogThreadContext::Current(), __LINE__, LogEvent::Now(),
+                   LogLevel(LogLevel::LevelEnum::Info), "dma chn 3 done, rx bytes 4096");
+    fmt::memory_buffer out;
+    uint64_t allocations = t_allocations;
+    for (auto _ : state)
+    {
+        out.clear();
+        format.Format(out, event);
+        benchmark::DoNotOptimize(out.data());
+    }
+    reportAllocations(state, t_allocations - allocations);
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_PatternFlag)->DenseRange(0, sizeof(kPatterns) / sizeof(kPatterns[0]) - 1);
+
+int main(int argc, char** argv)
+{
+    setUp();
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    ::unlink(kBenchFile);
+    ::unlink((std::string(kBenchFile) + ".async").c_str());
+    ::unlink((std::string(kBenchFile) + ".bin").c_str());
+    return 0;
+}
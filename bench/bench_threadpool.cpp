@@ -0,0 +1,65 @@
+//
+// Created by zwz on 2024/10/13.
+//
+#include <benchmark/benchmark.h>
+#include <future>
+#include <vector>
+#include "thread_pool.h"
+
+static void spin(int64_t work)
+{
+    for (int64_t i = 0; i < work; ++i)
+    {
+        benchmark::DoNotOptimize(i);
+    }
+}
+
+// caller-side cost of a single submit(), args: thread count, task size in spin iterations
+static void BM_ThreadPoolSubmit(benchmark::State& state)
+{
+    const auto threads = static_cast<std::size_t>(state.range(0));
+    const int64_t work = state.range(1);
+    Nazl::ThreadPool pool(threads);
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(pool.submit(spin, work));
+    }
+    state.SetItemsProcessed(state.iterations());
+    pool.shutdown();
+}
+BENCHMARK(BM_ThreadPoolSubmit)
+->ArgsProduct({{1, 2, 4, 8}, {0, 100, 10000}})
+->ArgNames({"threads", "work"})
+->UseRealTime();
+
+// submit a batch and wait for every future, args: thread count, task size in spin iterations
+static void BM_ThreadPoolThroughput(benchmark::State& state)
+{
+    constexpr std::size_t kBatch = 10000;
+    const auto threads = static_cast<std::size_t>(state.range(0));
+    const int64_t work = state.range(1);
+    Nazl::ThreadPool pool(threads);
+    std::vector<std::future<void>> futures;
+    futures.reserve(kBatch);
+    for (auto _ : state)
+    {
+        futures.clear();
+        for (std::size_t i = 0; i < kBatch; ++i)
+        {
+            futures.push_back(pool.submit(spin, work));
+        }
+        for (auto& future : futures)
+        {
+            future.wait();
+        }
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * kBatch));
+    pool.shutdown();
+}
+BENCHMARK(BM_ThreadPoolThroughput)
+->ArgsProduct({{1, 2, 4, 8}, {0, 100, 10000}})
+->ArgNames({"threads", "work"})
+->Unit(benchmark::kMillisecond)
+->UseRealTime();
+
+BENCHMARK_MAIN();
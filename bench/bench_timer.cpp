@@ -0,0 +1,77 @@
+//
+// Created by zwz on 2024/10/13.
+//
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+#include "timer.h"
+
+// start then stop N timers that never fire: heap push + map insert/erase cost
+static void BM_TimerStartStop(benchmark::State& state)
+{
+    const auto count = static_cast<std::size_t>(state.range(0));
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        auto timerMgr = std::make_unique<Nazl::TimerMgr>();
+        std::vector<Nazl::Timer> timers;
+        timers.reserve(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            timers.push_back(timerMgr->createTimer(std::chrono::seconds(60), [] {}));
+        }
+        state.ResumeTiming();
+
+        for (auto& timer : timers)
+        {
+            timerMgr->start(timer);
+        }
+        for (auto& timer : timers)
+        {
+            timerMgr->stop(timer);
+        }
+
+        state.PauseTiming();
+        timerMgr.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count * 2));
+}
+BENCHMARK(BM_TimerStartStop)->RangeMultiplier(32)->Range(1 << 10, 1 << 20)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// start N already-due timers and wait until the handler thread has fired all of them
+static void BM_TimerFire(benchmark::State& state)
+{
+    const auto count = static_cast<std::size_t>(state.range(0));
+    for (auto _ : state)
+    {
+        state.PauseTiming();
+        auto timerMgr = std::make_unique<Nazl::TimerMgr>();
+        std::atomic<std::size_t> fired{0};
+        std::vector<Nazl::Timer> timers;
+        timers.reserve(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            timers.push_back(timerMgr->createTimer(0, [&fired] { fired.fetch_add(1, std::memory_order_relaxed); }));
+        }
+        state.ResumeTiming();
+
+        for (auto& timer : timers)
+        {
+            timerMgr->start(timer);
+        }
+        while (fired.load(std::memory_order_relaxed) < count)
+        {
+            std::this_thread::yield();
+        }
+
+        state.PauseTiming();
+        timerMgr.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_TimerFire)->RangeMultiplier(32)->Range(1 << 10, 1 << 20)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -12,6 +12,22 @@ bool path_exists(const std::string& file_name)
     return (::stat(file_name.c_str(), &st) == 0);
 }
 
+bool create_parent_dir(const std::string& file_name)
+{
+    auto slash = file_name.find_last_of('/');
+    if (slash == std::string::npos)
+    {
+        return true;
+    }
+    std::string dir_path = file_name.substr(0, slash);
+    if (!path_exists(dir_path) && ::mkdir(dir_path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) != 0)
+    {
+        perror(("Failed to create directory " + dir_path).c_str());
+        return false;
+    }
+    return true;
+}
+
 FileOps::FileOps(FileOps&& other) noexcept
     : fd_(other.fd_), file_name_(std::move(other.file_name_))
 {
@@ -29,6 +29,8 @@ private:
     std::string file_name_;
 };
 bool path_exists(const std::string& file_name);
+// Creates the directory part of file_name if it is missing (one level, like FileOps::open).
+bool create_parent_dir(const std::string& file_name);
 
 }
 #endif //COMMON_FILE_OPS_H
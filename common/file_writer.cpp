@@ -0,0 +1,115 @@
+//
+// Created by zwz on 2024/10/16.
+//
+#include "file_writer.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include "file_ops.h"
+namespace Nazl
+{
+
+FileWriter::FileWriter(std::size_t buffer_size)
+    : buffer_(new char[buffer_size == 0 ? kDefaultBufferSize : buffer_size]),
+      capacity_(buffer_size == 0 ? kDefaultBufferSize : buffer_size)
+{
+}
+
+FileWriter::~FileWriter()
+{
+    close();
+}
+
+bool FileWriter::open(const std::string& file_name)
+{
+    close();
+    file_name_ = file_name;
+    if (!create_parent_dir(file_name))
+    {
+        return false;
+    }
+    fd_ = ::open(file_name_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+    {
+        perror(("Failed to open file " + file_name_).c_str());
+        return false;
+    }
+    struct stat st;
+    file_size_ = (::fstat(fd_, &st) == 0) ? static_cast<size_t>(st.st_size) : 0;
+    return true;
+}
+
+void FileWriter::close()
+{
+    if (fd_ >= 0)
+    {
+        flush();
+        ::close(fd_);
+        fd_ = -1;
+    }
+    used_ = 0;
+    file_size_ = 0;
+}
+
+void FileWriter::write(const char* data, size_t size)
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+    if (used_ + size <= capacity_)
+    {
+        memcpy(buffer_.get() + used_, data, size);
+        used_ += size;
+        return;
+    }
+    writeAll(buffer_.get(), used_, data, size);
+    used_ = 0;
+}
+
+void FileWriter::flush()
+{
+    if (fd_ >= 0 && used_ > 0)
+    {
+        writeAll(buffer_.get(), used_, nullptr, 0);
+        used_ = 0;
+    }
+}
+
+void FileWriter::writeAll(const char* first, size_t first_size, const char* second, size_t second_size)
+{
+    struct iovec iov[2] = {{const_cast<char*>(first), first_size}, {const_cast<char*>(second), second_size}};
+    struct iovec* cur = iov;
+    int count = second_size > 0 ? 2 : 1;
+    while (count > 0)
+    {
+        ssize_t written = ::writev(fd_, cur, count);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            // nothing sensible to do from inside a log sink, the data is lost
+            perror(("Failed to write file " + file_name_).c_str());
+            return;
+        }
+        file_size_ += static_cast<size_t>(written);
+        // partial write: skip what went out and retry the rest
+        while (count > 0 && static_cast<size_t>(written) >= cur->iov_len)
+        {
+            written -= static_cast<ssize_t>(cur->iov_len);
+            ++cur;
+            --count;
+        }
+        if (count > 0)
+        {
+            cur->iov_base = static_cast<char*>(cur->iov_base) + written;
+            cur->iov_len -= static_cast<size_t>(written);
+        }
+    }
+}
+
+} // namespace Nazl
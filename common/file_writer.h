@@ -0,0 +1,59 @@
+//
+// Created by zwz on 2024/10/16.
+//
+
+#ifndef COMMON_FILE_WRITER_H
+#define COMMON_FILE_WRITER_H
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "noncopyable.h"
+namespace Nazl {
+// Append-only writer on a raw fd with its own user-space buffer. Data is copied into the buffer
+// until it does not fit, then the buffered bytes and the new data go out in a single writev.
+class FileWriter : public Noncopyable {
+public:
+    static constexpr std::size_t kDefaultBufferSize = 1024 * 1024;
+
+    explicit FileWriter(std::size_t buffer_size = kDefaultBufferSize);
+    ~FileWriter();
+
+    bool open(const std::string& file_name);
+    void close();
+    void write(const char* data, size_t size);
+    // Hands the buffered bytes to the kernel; no fsync.
+    void flush();
+    bool isOpen() const
+    {
+        return fd_ >= 0;
+    }
+    // Bytes in the file, including what is still buffered.
+    size_t size() const
+    {
+        return file_size_ + used_;
+    }
+    size_t buffered() const
+    {
+        return used_;
+    }
+    size_t capacity() const
+    {
+        return capacity_;
+    }
+    std::string filename() const
+    {
+        return file_name_;
+    }
+private:
+    void writeAll(const char* first, size_t first_size, const char* second, size_t second_size);
+private:
+    int fd_{-1};
+    std::string file_name_;
+    std::unique_ptr<char[]> buffer_;
+    size_t capacity_;
+    size_t used_{0};
+    size_t file_size_{0};
+};
+}
+#endif //COMMON_FILE_WRITER_H
@@ -0,0 +1,114 @@
+//
+// Created by zwz on 2024/10/12.
+//
+
+#ifndef COMMON_HISTOGRAM_H
+#define COMMON_HISTOGRAM_H
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+namespace Nazl
+{
+// Lock-free log2 histogram of non-negative samples (typically microseconds).
+// Bucket 0 holds value 0, bucket i holds [2^(i-1), 2^i), the last bucket holds the rest.
+class Histogram
+{
+public:
+    static constexpr std::size_t kBucketCount = 32;
+
+    struct Snapshot
+    {
+        std::array<uint64_t, kBucketCount> buckets_{};
+        uint64_t count_{0};
+        uint64_t sum_{0};
+        uint64_t max_{0};
+
+        uint64_t mean() const
+        {
+            return count_ == 0 ? 0 : sum_ / count_;
+        }
+        // Upper bound of the bucket containing the requested percentile (0-100).
+        uint64_t percentile(double pct) const
+        {
+            if (count_ == 0)
+            {
+                return 0;
+            }
+            uint64_t rank = static_cast<uint64_t>(pct / 100.0 * static_cast<double>(count_));
+            uint64_t seen = 0;
+            for (std::size_t i = 0; i < kBucketCount; ++i)
+            {
+                seen += buckets_[i];
+                if (seen > rank)
+                {
+                    uint64_t upper = bucketUpperBound(i);
+                    return upper < max_ ? upper : max_;
+                }
+            }
+            return max_;
+        }
+    };
+
+    Histogram() = default;
+    Histogram(const Histogram&) = delete;
+    Histogram& operator=(const Histogram&) = delete;
+
+    void record(int64_t value)
+    {
+        uint64_t v = value < 0 ? 0 : static_cast<uint64_t>(value);
+        buckets_[bucketIndex(v)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(v, std::memory_order_relaxed);
+        uint64_t cur = max_.load(std::memory_order_relaxed);
+        while (v > cur && !max_.compare_exchange_weak(cur, v, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    Snapshot snapshot() const
+    {
+        Snapshot snap;
+        for (std::size_t i = 0; i < kBucketCount; ++i)
+        {
+            snap.buckets_[i] = buckets_[i].load(std::memory_order_relaxed);
+        }
+        snap.count_ = count_.load(std::memory_order_relaxed);
+        snap.sum_ = sum_.load(std::memory_order_relaxed);
+        snap.max_ = max_.load(std::memory_order_relaxed);
+        return snap;
+    }
+
+    void reset()
+    {
+        for (auto& bucket : buckets_)
+        {
+            bucket.store(0, std::memory_order_relaxed);
+        }
+        count_.store(0, std::memory_order_relaxed);
+        sum_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
+
+    static std::size_t bucketIndex(uint64_t value)
+    {
+        if (value == 0)
+        {
+            return 0;
+        }
+        std::size_t idx = 64 - static_cast<std::size_t>(__builtin_clzll(value));
+        return idx < kBucketCount ? idx : kBucketCount - 1;
+    }
+    static uint64_t bucketUpperBound(std::size_t idx)
+    {
+        return idx == 0 ? 0 : (uint64_t(1) << idx) - 1;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, kBucketCount> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+}
+#endif //COMMON_HISTOGRAM_H
@@ -0,0 +1,156 @@
+//
+// Created by zwz on 2024/10/14.
+//
+#include <algorithm>
+#include "async_logger.h"
+
+AsyncLogger::~AsyncLogger()
+{
+    running_ = false;
+    WakeWriter();
+    if (writer_)
+    {
+        writer_->join();
+    }
+}
+
+void AsyncLogger::Start()
+{
+    writer_ = std::make_unique<Nazl::Thread>([this] { WriterLoop(); }, "log-" + name_);
+}
+
+AsyncLogger::OverflowPolicy AsyncLogger::StringToPolicy(const std::string& policy)
+{
+    std::string lower = policy;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    if (lower == "drop")
+    {
+        return OverflowPolicy::Drop;
+    }
+    if (lower == "overwrite" || lower == "overwrite_oldest")
+    {
+        return OverflowPolicy::OverwriteOldest;
+    }
+    return OverflowPolicy::Block;
+}
+
+void AsyncLogger::WakeWriter()
+{
+    if (writer_waiting_.load())
+    {
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        writer_cond_.notify_one();
+    }
+}
+
+void AsyncLogger::SinkIt(LogEvent&& event)
+{
+    bool fatal = event.GetLevel().GetLevel() == LogLevel::LevelEnum::Fatal;
+    // tryPush only moves from event on success, so retrying with it is safe
+    while (!queue_.tryPush(std::move(event)))
+    {
+        if (policy_ == OverflowPolicy::Drop)
+        {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (policy_ == OverflowPolicy::OverwriteOldest)
+        {
+            LogEvent oldest;
+            if (queue_.tryPop(oldest))
+            {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                consumed_.fetch_add(1, std::memory_order_relaxed);
+            }
+            continue;
+        }
+        WakeWriter();
+        std::this_thread::yield();
+    }
+    enqueued_.fetch_add(1, std::memory_order_release);
+    WakeWriter();
+    if (fatal)
+    {
+        Flush();
+    }
+}
+
+void AsyncLogger::Flush()
+{
+    uint64_t target = enqueued_.load(std::memory_order_acquire);
+    std::unique_lock<std::mutex> lock(wait_mutex_);
+    while (consumed_.load(std::memory_order_acquire) < target && running_)
+    {
+        writer_cond_.notify_one();
+        flushed_cond_.wait_for(lock, std::chrono::milliseconds(1));
+    }
+    lock.unlock();
+    for (auto& sink : sinks_)
+    {
+        sink->Flush();
+    }
+}
+
+void AsyncLogger::ReportDropped()
+{
+    uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped == reported_dropped_)
+    {
+        return;
+    }
+    LogEvent event(__FILE__, __FUNCTION__, "log-" + name_, __LINE__, 0,
+                   LogEvent::Now(), LogLevel(LogLevel::LevelEnum::Warn));
+    fmt::format_to(std::back_inserter(event.GetMessageBuffer()), "AsyncLogger {} dropped {} events",
+                   name_, dropped - reported_dropped_);
+    reported_dropped_ = dropped;
+    for (auto& sink : sinks_)
+    {
+        sink->Log(event);
+    }
+}
+
+void AsyncLogger::WriterLoop()
+{
+    std::vector<LogEvent> batch;
+    batch.reserve(kBatchSize);
+    for (;;)
+    {
+        LogEvent event;
+        while (batch.size() < kBatchSize && queue_.tryPop(event))
+        {
+            batch.push_back(std::move(event));
+        }
+        if (batch.empty())
+        {
+            if (!running_)
+            {
+                for (auto& sink : sinks_)
+                {
+                    sink->Flush();
+                }
+                break;
+            }
+            std::unique_lock<std::mutex> lock(wait_mutex_);
+            writer_waiting_ = true;
+            writer_cond_.wait_for(lock, std::chrono::milliseconds(10), [this]
+            {
+                return !queue_.empty() || !running_;
+            });
+            writer_waiting_ = false;
+            continue;
+        }
+        for (auto& item : batch)
+        {
+            for (auto& sink : sinks_)
+            {
+                sink->Log(item);
+            }
+        }
+        // no flush here: the sinks' own policies decide when buffered output is written
+        ReportDropped();
+        consumed_.fetch_add(batch.size(), std::memory_order_release);
+        batch.clear();
+        std::lock_guard<std::mutex> lock(wait_mutex_);
+        flushed_cond_.notify_all();
+    }
+}
@@ -0,0 +1,71 @@
+//
+// Created by zwz on 2024/10/14.
+//
+
+#ifndef COMMON_ASYNC_LOGGER_H
+#define COMMON_ASYNC_LOGGER_H
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include "log.h"
+#include "ring_queue.h"
+#include "thread_pool.h"
+
+// Producers push events into a lock-free ring, a dedicated writer thread drains it
+// in batches; sinks are flushed only by Flush() (and so after every Fatal event).
+class AsyncLogger : public Logger
+{
+public:
+    enum class OverflowPolicy
+    {
+        Block,
+        Drop,
+        OverwriteOldest
+    };
+    static constexpr std::size_t kDefaultQueueSize = 8192;
+    static constexpr std::size_t kBatchSize = 256;
+
+    template<typename T>
+    AsyncLogger(const std::string &name, T begin, T end, std::size_t queue_size = kDefaultQueueSize,
+                OverflowPolicy policy = OverflowPolicy::Block)
+        : Logger(name, begin, end), queue_(queue_size), policy_(policy)
+    {
+        Start();
+    }
+    ~AsyncLogger() override;
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
+
+    void SinkIt(LogEvent&& event) override;
+    // Blocks until every event queued before the call has been written and flushed.
+    void Flush() override;
+    uint64_t GetDroppedCount() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+    OverflowPolicy GetOverflowPolicy() const
+    {
+        return policy_;
+    }
+    static OverflowPolicy StringToPolicy(const std::string& policy);
+private:
+    void Start();
+    void WriterLoop();
+    void WakeWriter();
+    void ReportDropped();
+private:
+    Nazl::RingQueue<LogEvent> queue_;
+    OverflowPolicy policy_;
+    std::atomic<bool> running_{true};
+    std::atomic<bool> writer_waiting_{false};
+    std::atomic<uint64_t> enqueued_{0};
+    std::atomic<uint64_t> consumed_{0};
+    std::atomic<uint64_t> dropped_{0};
+    uint64_t reported_dropped_{0};
+    std::mutex wait_mutex_;
+    std::condition_variable writer_cond_;
+    std::condition_variable flushed_cond_;
+    std::unique_ptr<Nazl::Thread> writer_;
+};
+#endif //COMMON_ASYNC_LOGGER_H
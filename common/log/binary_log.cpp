@@ -0,0 +1,624 @@
+//
+// Created by zwz on 2024/10/15.
+//
+#include <algorithm>
+#include <pthread.h>
+#include <fmt/args.h>
+#include "binary_log.h"
+
+namespace BinaryLog
+{
+namespace
+{
+constexpr char kFileMagic[4] = {'N', 'Z', 'B', 'L'};
+constexpr uint32_t kFileVersion = 1;
+constexpr char kSiteRecord = 'S';
+constexpr char kEventRecord = 'E';
+
+uint64_t WallNanos()
+{
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+template<typename T>
+void Append(std::string& out, const T& value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+void AppendString(std::string& out, const std::string& value)
+{
+    Append(out, static_cast<uint32_t>(value.size()));
+    out.append(value);
+}
+
+template<typename T>
+bool Read(std::FILE* fd, T& value)
+{
+    return ::fread(&value, sizeof(value), 1, fd) == 1;
+}
+bool ReadString(std::FILE* fd, std::string& value)
+{
+    uint32_t len = 0;
+    if (!Read(fd, len))
+    {
+        return false;
+    }
+    value.resize(len);
+    return len == 0 || ::fread(&value[0], 1, len, fd) == len;
+}
+
+// Keeps the staging buffer registered after its thread exits, until the worker has drained it.
+struct BufferRetirer
+{
+    StagingBuffer* buffer_{nullptr};
+    ~BufferRetirer()
+    {
+        if (buffer_)
+        {
+            buffer_->retired_.store(true, std::memory_order_release);
+        }
+    }
+};
+thread_local BufferRetirer t_retirer;
+
+struct PendingRecord
+{
+    uint64_t ticks_;
+    const StagingBuffer* buffer_;
+    uint32_t id_;
+    std::string args_;
+};
+}
+
+thread_local StagingBuffer* BinaryLogManager::t_buffer_ = nullptr;
+
+StagingBuffer::StagingBuffer(std::size_t capacity)
+{
+    std::size_t size = 4096;
+    while (size < capacity)
+    {
+        size <<= 1;
+    }
+    mask_ = size - 1;
+    data_.reset(new char[size]);
+}
+
+char* StagingBuffer::Reserve(std::size_t size)
+{
+    const std::size_t capacity = mask_ + 1;
+    uint64_t producer = producer_pos_.load(std::memory_order_relaxed);
+    std::size_t offset = producer & mask_;
+    std::size_t tail = capacity - offset;
+    std::size_t needed = size <= tail ? size : tail + size;
+    if (needed > capacity)
+    {
+        return nullptr;
+    }
+    if (producer + needed - consumer_cache_ > capacity)
+    {
+        consumer_cache_ = consumer_pos_.load(std::memory_order_acquire);
+        if (producer + needed - consumer_cache_ > capacity)
+        {
+            return nullptr;
+        }
+    }
+    if (size > tail)
+    {
+        // records never wrap: mark the tail as padding and start over at offset 0
+        memcpy(data_.get() + offset, &kPaddingId, sizeof(kPaddingId));
+        producer_pos_.store(producer + tail, std::memory_order_release);
+        return data_.get();
+    }
+    return data_.get() + offset;
+}
+
+const RecordHeader* StagingBuffer::Peek()
+{
+    const std::size_t capacity = mask_ + 1;
+    uint64_t consumer = consumer_pos_.load(std::memory_order_relaxed);
+    uint64_t producer = producer_pos_.load(std::memory_order_acquire);
+    while (consumer != producer)
+    {
+        std::size_t offset = consumer & mask_;
+        uint32_t id;
+        memcpy(&id, data_.get() + offset, sizeof(id));
+        if (id != kPaddingId)
+        {
+            return reinterpret_cast<const RecordHeader*>(data_.get() + offset);
+        }
+        consumer += capacity - offset;
+        consumer_pos_.store(consumer, std::memory_order_release);
+    }
+    return nullptr;
+}
+
+BinaryLogManager::BinaryLogManager() = default;
+
+BinaryLogManager::~BinaryLogManager()
+{
+    Stop();
+    for (auto& chunk : site_chunks_)
+    {
+        delete[] chunk.load(std::memory_order_relaxed);
+    }
+}
+
+void BinaryLogManager::Start(std::shared_ptr<Logger> target, std::size_t buffer_size)
+{
+    if (running_ || !target)
+    {
+        return;
+    }
+    target_ = std::move(target);
+    to_file_ = false;
+    level_source_ = target_.get();
+    StartWorker(buffer_size);
+}
+
+void BinaryLogManager::Start(const std::string& file_path, LogLevel level, std::size_t buffer_size)
+{
+    if (running_)
+    {
+        return;
+    }
+    file_.open(file_path, true);
+    file_.write(kFileMagic, sizeof(kFileMagic));
+    file_.write(reinterpret_cast<const char*>(&kFileVersion), sizeof(kFileVersion));
+    to_file_ = true;
+    sites_written_ = 0;
+    level_source_ = nullptr;
+    level_ = level.GetLevel();
+    StartWorker(buffer_size);
+}
+
+void BinaryLogManager::StartWorker(std::size_t buffer_size)
+{
+    buffer_size_ = buffer_size;
+    Calibrate(true);
+    running_ = true;
+    worker_ = std::make_unique<Nazl::Thread>([this] { WorkerLoop(); }, "log-binary");
+    accepting_ = true;
+}
+
+void BinaryLogManager::Stop()
+{
+    if (!accepting_.exchange(false))
+    {
+        return;
+    }
+    // producers that saw IsRunning() just before may still be committing: let the worker
+    // drain a couple more rounds before it goes away, then pick up the rest below
+    Flush();
+    running_ = false;
+    {
+        std::lock_guard<std::mutex> lock(worker_mutex_);
+        worker_cond_.notify_one();
+    }
+    worker_->join();
+    worker_.reset();
+    Drain();
+    if (to_file_)
+    {
+        file_.close();
+    }
+    else
+    {
+        target_->Flush();
+    }
+    level_source_ = nullptr;
+    target_.reset();
+}
+
+void BinaryLogManager::Flush()
+{
+    std::unique_lock<std::mutex> lock(worker_mutex_);
+    uint64_t target = drain_rounds_ + 2;
+    while (running_ && drain_rounds_ < target)
+    {
+        worker_cond_.notify_one();
+        drained_cond_.wait_for(lock, std::chrono::milliseconds(10));
+    }
+}
+
+uint32_t BinaryLogManager::RegisterSite(LogLevel::LevelEnum level, const char* file, const char* func, int32_t line,
+                                        const char* format, std::vector<ArgType> args)
+{
+    std::lock_guard<std::mutex> lock(sites_mutex_);
+    std::size_t count = site_count_.load(std::memory_order_relaxed);
+    if (count >= kSiteChunkSize * kMaxSiteChunks)
+    {
+        // out of ids: records of this site are skipped by the worker and the decoder
+        return UINT32_MAX;
+    }
+    uint32_t id = static_cast<uint32_t>(count);
+    auto& chunk = site_chunks_[count / kSiteChunkSize];
+    if (!chunk.load(std::memory_order_relaxed))
+    {
+        chunk.store(new Site[kSiteChunkSize], std::memory_order_relaxed);
+    }
+    chunk.load(std::memory_order_relaxed)[count % kSiteChunkSize] = Site{id, level, line, file, func, format, std::move(args)};
+    site_count_.store(count + 1, std::memory_order_release);
+    return id;
+}
+
+Site BinaryLogManager::GetSite(uint32_t id)
+{
+    return id < site_count_.load(std::memory_order_acquire) ? SiteAt(id) : Site{};
+}
+
+uint64_t BinaryLogManager::GetDroppedCount()
+{
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    uint64_t dropped = retired_dropped_;
+    for (auto& buffer : buffers_)
+    {
+        dropped += buffer->GetDroppedCount();
+    }
+    return dropped;
+}
+
+StagingBuffer* BinaryLogManager::CreateThreadBuffer()
+{
+    auto buffer = std::make_shared<StagingBuffer>(buffer_size_);
+    const LogThreadContext* thread = LogThreadContext::Current();
+    buffer->tid_ = thread->tid_;
+    buffer->thread_name_ = std::string(thread->GetName());
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        buffers_.push_back(buffer);
+    }
+    t_buffer_ = buffer.get();
+    t_retirer.buffer_ = buffer.get();
+    return t_buffer_;
+}
+
+void BinaryLogManager::Calibrate(bool initial)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (initial)
+    {
+        base_ticks_ = ReadTicks();
+        base_nanos_ = WallNanos();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    // the longer the baseline, the better the tsc rate estimate
+    uint64_t ticks = ReadTicks();
+    uint64_t nanos = WallNanos();
+    if (ticks > base_ticks_ && nanos > base_nanos_)
+    {
+        nanos_per_tick_ = static_cast<double>(nanos - base_nanos_) / static_cast<double>(ticks - base_ticks_);
+    }
+#elif defined(__aarch64__)
+    if (initial)
+    {
+        uint64_t freq;
+        asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+        nanos_per_tick_ = 1e9 / static_cast<double>(freq);
+        base_ticks_ = ReadTicks();
+        base_nanos_ = WallNanos();
+    }
+#else
+    if (initial)
+    {
+        nanos_per_tick_ = 1.0;
+        base_ticks_ = ReadTicks();
+        base_nanos_ = WallNanos();
+    }
+#endif
+    last_calibration_ = std::chrono::steady_clock::now();
+}
+
+uint64_t BinaryLogManager::TicksToNanos(uint64_t ticks) const
+{
+    int64_t delta = static_cast<int64_t>(ticks - base_ticks_);
+    return base_nanos_ + static_cast<int64_t>(static_cast<double>(delta) * nanos_per_tick_);
+}
+
+void BinaryLogManager::WorkerLoop()
+{
+    while (running_)
+    {
+        std::size_t drained = Drain();
+        if (std::chrono::steady_clock::now() - last_calibration_ > std::chrono::seconds(1))
+        {
+            Calibrate(false);
+        }
+        std::unique_lock<std::mutex> lock(worker_mutex_);
+        ++drain_rounds_;
+        drained_cond_.notify_all();
+        if (drained == 0 && running_)
+        {
+            worker_cond_.wait_for(lock, std::chrono::milliseconds(1));
+        }
+    }
+}
+
+void BinaryLogManager::WriteSites()
+{
+    std::size_t count = site_count_.load(std::memory_order_acquire);
+    std::string out;
+    for (; sites_written_ < count; ++sites_written_)
+    {
+        const Site& site = SiteAt(sites_written_);
+        out.push_back(kSiteRecord);
+        Append(out, site.id_);
+        Append(out, static_cast<uint8_t>(site.level_));
+        Append(out, site.line_);
+        Append(out, static_cast<uint16_t>(site.args_.size()));
+        for (auto arg : site.args_)
+        {
+            Append(out, static_cast<uint8_t>(arg));
+        }
+        AppendString(out, site.file_);
+        AppendString(out, site.func_);
+        AppendString(out, site.format_);
+    }
+    file_.write(out.data(), out.size());
+}
+
+std::size_t BinaryLogManager::Drain()
+{
+    std::vector<std::shared_ptr<StagingBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        buffers = buffers_;
+    }
+    std::vector<PendingRecord> pending;
+    std::vector<const StagingBuffer*> finished;
+    for (auto& buffer : buffers)
+    {
+        bool retired = buffer->retired_.load(std::memory_order_acquire);
+        while (const RecordHeader* header = buffer->Peek())
+        {
+            pending.push_back(PendingRecord{header->ticks_, buffer.get(), header->id_,
+                                            std::string(reinterpret_cast<const char*>(header + 1),
+                                                        header->size_ - sizeof(RecordHeader))});
+            buffer->Consume(header->size_);
+        }
+        if (retired)
+        {
+            finished.push_back(buffer.get());
+        }
+    }
+    if (!finished.empty())
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        for (auto it = buffers_.begin(); it != buffers_.end();)
+        {
+            if (std::find(finished.begin(), finished.end(), it->get()) != finished.end())
+            {
+                retired_dropped_ += (*it)->GetDroppedCount();
+                it = buffers_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+    if (pending.empty())
+    {
+        return 0;
+    }
+    // each buffer is ordered already, merge across threads by capture time
+    std::stable_sort(pending.begin(), pending.end(), [](const PendingRecord& lhs, const PendingRecord& rhs)
+    {
+        return lhs.ticks_ < rhs.ticks_;
+    });
+    std::size_t site_count = site_count_.load(std::memory_order_acquire);
+    if (to_file_)
+    {
+        WriteSites();
+        std::string out;
+        for (auto& record : pending)
+        {
+            out.push_back(kEventRecord);
+            Append(out, record.id_);
+            Append(out, record.buffer_->tid_);
+            Append(out, TicksToNanos(record.ticks_));
+            Append(out, static_cast<uint8_t>(record.buffer_->thread_name_.size()));
+            out.append(record.buffer_->thread_name_);
+            AppendString(out, record.args_);
+        }
+        file_.write(out.data(), out.size());
+        return pending.size();
+    }
+    for (auto& record : pending)
+    {
+        if (record.id_ >= site_count)
+        {
+            continue;
+        }
+        const Site& site = SiteAt(record.id_);
+        // site strings never move, so the event can point at them
+        LogEvent event(site.file_.c_str(), site.func_.c_str(), record.buffer_->thread_name_, site.line_,
+                       record.buffer_->tid_, TicksToNanos(record.ticks_), LogLevel(site.level_),
+                       FormatRecord(site, record.args_.data(), record.args_.size()));
+        target_->SinkIt(std::move(event));
+    }
+    return pending.size();
+}
+
+std::string FormatRecord(const Site& site, const char* args, std::size_t size)
+{
+    fmt::dynamic_format_arg_store<fmt::printf_context> store;
+    const char* pos = args;
+    const char* end = args + size;
+    for (auto type : site.args_)
+    {
+        std::size_t need = (type == ArgType::Int32 || type == ArgType::Uint32) ? 4 : (type == ArgType::String ? 4 : 8);
+        if (pos + need > end)
+        {
+            return site.format_ + " <truncated>";
+        }
+        switch (type)
+        {
+        case ArgType::Int32:
+        {
+            int32_t v;
+            memcpy(&v, pos, 4);
+            store.push_back(v);
+            pos += 4;
+            break;
+        }
+        case ArgType::Uint32:
+        {
+            uint32_t v;
+            memcpy(&v, pos, 4);
+            store.push_back(v);
+            pos += 4;
+            break;
+        }
+        case ArgType::Int64:
+        {
+            int64_t v;
+            memcpy(&v, pos, 8);
+            store.push_back(v);
+            pos += 8;
+            break;
+        }
+        case ArgType::Uint64:
+        {
+            uint64_t v;
+            memcpy(&v, pos, 8);
+            store.push_back(v);
+            pos += 8;
+            break;
+        }
+        case ArgType::Double:
+        {
+            double v;
+            memcpy(&v, pos, 8);
+            store.push_back(v);
+            pos += 8;
+            break;
+        }
+        case ArgType::Pointer:
+        {
+            uint64_t v;
+            memcpy(&v, pos, 8);
+            store.push_back(reinterpret_cast<const void*>(static_cast<uintptr_t>(v)));
+            pos += 8;
+            break;
+        }
+        case ArgType::String:
+        {
+            uint32_t len;
+            memcpy(&len, pos, 4);
+            pos += 4;
+            if (pos + len > end)
+            {
+                return site.format_ + " <truncated>";
+            }
+            store.push_back(std::string(pos, len));
+            pos += len;
+            break;
+        }
+        }
+    }
+    try
+    {
+        return fmt::vsprintf(fmt::string_view(site.format_), fmt::basic_format_args<fmt::printf_context>(store));
+    }
+    catch (const std::exception& e)
+    {
+        return site.format_ + " <format error: " + e.what() + ">";
+    }
+}
+
+FileReader::FileReader(const std::string& file_path)
+{
+    fd_ = ::fopen(file_path.c_str(), "rb");
+    if (!fd_)
+    {
+        return;
+    }
+    char magic[sizeof(kFileMagic)];
+    uint32_t version = 0;
+    if (::fread(magic, 1, sizeof(magic), fd_) != sizeof(magic) || memcmp(magic, kFileMagic, sizeof(magic)) != 0 ||
+            !Read(fd_, version) || version != kFileVersion)
+    {
+        ::fclose(fd_);
+        fd_ = nullptr;
+    }
+}
+
+FileReader::~FileReader()
+{
+    if (fd_)
+    {
+        ::fclose(fd_);
+    }
+}
+
+bool FileReader::Next(LogEvent& event)
+{
+    if (!fd_)
+    {
+        return false;
+    }
+    char type;
+    while (Read(fd_, type))
+    {
+        if (type == kSiteRecord)
+        {
+            Site site;
+            uint8_t level;
+            uint16_t nargs;
+            if (!Read(fd_, site.id_) || !Read(fd_, level) || !Read(fd_, site.line_) || !Read(fd_, nargs))
+            {
+                return false;
+            }
+            site.level_ = static_cast<LogLevel::LevelEnum>(level);
+            for (uint16_t i = 0; i < nargs; ++i)
+            {
+                uint8_t arg;
+                if (!Read(fd_, arg))
+                {
+                    return false;
+                }
+                site.args_.push_back(static_cast<ArgType>(arg));
+            }
+            if (!ReadString(fd_, site.file_) || !ReadString(fd_, site.func_) || !ReadString(fd_, site.format_))
+            {
+                return false;
+            }
+            if (sites_.size() <= site.id_)
+            {
+                sites_.resize(site.id_ + 1);
+            }
+            sites_[site.id_] = std::move(site);
+        }
+        else if (type == kEventRecord)
+        {
+            uint32_t id, tid;
+            uint64_t nanos;
+            uint8_t name_len;
+            std::string name, args;
+            if (!Read(fd_, id) || !Read(fd_, tid) || !Read(fd_, nanos) || !Read(fd_, name_len))
+            {
+                return false;
+            }
+            name.resize(name_len);
+            if ((name_len && ::fread(&name[0], 1, name_len, fd_) != name_len) || !ReadString(fd_, args))
+            {
+                return false;
+            }
+            if (id >= sites_.size())
+            {
+                continue;
+            }
+            const Site& site = sites_[id];
+            event = LogEvent(site.file_.c_str(), site.func_.c_str(), name, site.line_, tid, nanos,
+                             LogLevel(site.level_), FormatRecord(site, args.data(), args.size()));
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return false;
+}
+}
@@ -0,0 +1,408 @@
+//
+// Created by zwz on 2024/10/15.
+//
+
+#ifndef COMMON_BINARY_LOG_H
+#define COMMON_BINARY_LOG_H
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <condition_variable>
+#include "log.h"
+#include "file_ops.h"
+#include "singleton.h"
+#include "thread_pool.h"
+
+// Deferred (format-later) logging for hot paths. A call site registers its printf format
+// once and gets a static id; at runtime only the id, a tick count and the raw argument
+// bytes go into a per-thread buffer. A background thread renders the records through the
+// target logger's sinks, or writes them to a binary file for nazl_log_decode.
+namespace BinaryLog
+{
+enum class ArgType : uint8_t
+{
+    Int32,
+    Uint32,
+    Int64,
+    Uint64,
+    Double,
+    Pointer,
+    String
+};
+
+struct Site
+{
+    uint32_t id_;
+    LogLevel::LevelEnum level_;
+    int32_t line_;
+    std::string file_;
+    std::string func_;
+    std::string format_;
+    std::vector<ArgType> args_;
+};
+
+// Record layout in a staging buffer: RecordHeader, then the arguments back to back.
+// Strings are stored as a uint32 length followed by the bytes. Records are 8-byte aligned.
+struct RecordHeader
+{
+    uint32_t id_;
+    uint32_t size_;
+    uint64_t ticks_;
+};
+constexpr uint32_t kPaddingId = 0xFFFFFFFFu;
+
+template<typename T>
+constexpr ArgType ArgTypeOf()
+{
+    using U = std::decay_t<T>;
+    if constexpr (std::is_same_v<U, char*> || std::is_same_v<U, const char*> || std::is_same_v<U, std::string>)
+    {
+        return ArgType::String;
+    }
+    else if constexpr (std::is_pointer_v<U>)
+    {
+        return ArgType::Pointer;
+    }
+    else if constexpr (std::is_enum_v<U>)
+    {
+        return ArgTypeOf<std::underlying_type_t<U>>();
+    }
+    else if constexpr (std::is_floating_point_v<U>)
+    {
+        return ArgType::Double;
+    }
+    else if constexpr (std::is_integral_v<U> && sizeof(U) <= 4)
+    {
+        return std::is_signed_v<U> ? ArgType::Int32 : ArgType::Uint32;
+    }
+    else
+    {
+        static_assert(std::is_integral_v<U>, "unsupported binary log argument type");
+        return std::is_signed_v<U> ? ArgType::Int64 : ArgType::Uint64;
+    }
+}
+
+inline std::size_t StringLength(const char* value)
+{
+    return value ? strlen(value) : 0;
+}
+inline std::size_t StringLength(const std::string& value)
+{
+    return value.size();
+}
+inline const char* StringData(const char* value)
+{
+    return value ? value : "";
+}
+inline const char* StringData(const std::string& value)
+{
+    return value.data();
+}
+
+template<typename T>
+inline std::size_t ArgSize(const T& value)
+{
+    constexpr ArgType type = ArgTypeOf<T>();
+    if constexpr (type == ArgType::String)
+    {
+        return sizeof(uint32_t) + StringLength(value);
+    }
+    else if constexpr (type == ArgType::Int32 || type == ArgType::Uint32)
+    {
+        return 4;
+    }
+    else
+    {
+        return 8;
+    }
+}
+
+template<typename T>
+inline char* EncodeArg(char* out, const T& value)
+{
+    constexpr ArgType type = ArgTypeOf<T>();
+    if constexpr (type == ArgType::String)
+    {
+        uint32_t len = static_cast<uint32_t>(StringLength(value));
+        memcpy(out, &len, sizeof(len));
+        memcpy(out + sizeof(len), StringData(value), len);
+        return out + sizeof(len) + len;
+    }
+    else if constexpr (type == ArgType::Int32)
+    {
+        int32_t v = static_cast<int32_t>(value);
+        memcpy(out, &v, 4);
+        return out + 4;
+    }
+    else if constexpr (type == ArgType::Uint32)
+    {
+        uint32_t v = static_cast<uint32_t>(value);
+        memcpy(out, &v, 4);
+        return out + 4;
+    }
+    else if constexpr (type == ArgType::Int64)
+    {
+        int64_t v = static_cast<int64_t>(value);
+        memcpy(out, &v, 8);
+        return out + 8;
+    }
+    else if constexpr (type == ArgType::Uint64)
+    {
+        uint64_t v = static_cast<uint64_t>(value);
+        memcpy(out, &v, 8);
+        return out + 8;
+    }
+    else if constexpr (type == ArgType::Double)
+    {
+        double v = static_cast<double>(value);
+        memcpy(out, &v, 8);
+        return out + 8;
+    }
+    else
+    {
+        uint64_t v = reinterpret_cast<uintptr_t>(value);
+        memcpy(out, &v, 8);
+        return out + 8;
+    }
+}
+
+// Single-producer single-consumer byte ring owned by one logging thread.
+class StagingBuffer
+{
+public:
+    explicit StagingBuffer(std::size_t capacity);
+    // Returns space for a contiguous record of size bytes (8-byte aligned), nullptr when full.
+    char* Reserve(std::size_t size);
+    void Commit(std::size_t size)
+    {
+        producer_pos_.store(producer_pos_.load(std::memory_order_relaxed) + size, std::memory_order_release);
+    }
+    // Consumer side: pointer to the next record or nullptr when empty.
+    const RecordHeader* Peek();
+    void Consume(std::size_t size)
+    {
+        consumer_pos_.store(consumer_pos_.load(std::memory_order_relaxed) + size, std::memory_order_release);
+    }
+    uint64_t GetDroppedCount() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+    void CountDrop()
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+    uint32_t tid_{0};
+    std::string thread_name_;
+    std::atomic<bool> retired_{false};
+private:
+    std::unique_ptr<char[]> data_;
+    std::size_t mask_;
+    alignas(64) std::atomic<uint64_t> producer_pos_{0};
+    uint64_t consumer_cache_{0};
+    alignas(64) std::atomic<uint64_t> consumer_pos_{0};
+    std::atomic<uint64_t> dropped_{0};
+};
+
+inline uint64_t ReadTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+class BinaryLogManager
+{
+public:
+    static constexpr std::size_t kDefaultBufferSize = 1 << 20;
+
+    BinaryLogManager();
+    ~BinaryLogManager();
+    // Render records through target's sinks.
+    void Start(std::shared_ptr<Logger> target, std::size_t buffer_size = kDefaultBufferSize);
+    // Write records and the site dictionary to file_path for offline decoding.
+    void Start(const std::string& file_path, LogLevel level, std::size_t buffer_size = kDefaultBufferSize);
+    void Stop();
+    // Blocks until everything logged before the call has been handed to the output.
+    void Flush();
+
+    // Whether new records are taken; false already while Stop() drains the last ones.
+    bool IsRunning() const
+    {
+        return accepting_.load(std::memory_order_relaxed);
+    }
+    bool ShouldLog(LogLevel::LevelEnum level) const
+    {
+        const Logger* target = level_source_.load(std::memory_order_relaxed);
+        return target ? target->ShouldLog(level) : level >= level_.load(std::memory_order_relaxed);
+    }
+    uint32_t RegisterSite(LogLevel::LevelEnum level, const char* file, const char* func, int32_t line,
+                          const char* format, std::vector<ArgType> args);
+    Site GetSite(uint32_t id);
+    uint64_t GetDroppedCount();
+
+    StagingBuffer* ThreadBuffer()
+    {
+        StagingBuffer* buffer = t_buffer_;
+        return buffer ? buffer : CreateThreadBuffer();
+    }
+private:
+    StagingBuffer* CreateThreadBuffer();
+    void StartWorker(std::size_t buffer_size);
+    void WorkerLoop();
+    std::size_t Drain();
+    void Calibrate(bool initial);
+    uint64_t TicksToNanos(uint64_t ticks) const;
+    void WriteSites();
+private:
+    static thread_local StagingBuffer* t_buffer_;
+
+    std::atomic<bool> running_{false};
+    std::atomic<bool> accepting_{false};
+    std::atomic<LogLevel::LevelEnum> level_{LogLevel::LevelEnum::Fatal};
+    std::atomic<const Logger*> level_source_{nullptr};
+    std::size_t buffer_size_{kDefaultBufferSize};
+    std::shared_ptr<Logger> target_;
+    Nazl::FileOps file_;
+    bool to_file_{false};
+    std::size_t sites_written_{0};
+
+    // Sites live in fixed chunks that never move. A chunk is published before the count that
+    // covers it, so the worker reads the sites below site_count_ without the lock.
+    static constexpr std::size_t kSiteChunkSize = 256;
+    static constexpr std::size_t kMaxSiteChunks = 1024;
+    const Site& SiteAt(std::size_t id) const
+    {
+        return site_chunks_[id / kSiteChunkSize].load(std::memory_order_relaxed)[id % kSiteChunkSize];
+    }
+    std::mutex sites_mutex_;
+    std::array<std::atomic<Site*>, kMaxSiteChunks> site_chunks_{};
+    std::atomic<std::size_t> site_count_{0};
+    std::mutex buffers_mutex_;
+    std::vector<std::shared_ptr<StagingBuffer>> buffers_;
+    uint64_t retired_dropped_{0};
+
+    uint64_t base_ticks_{0};
+    uint64_t base_nanos_{0};
+    double nanos_per_tick_{1.0};
+
+    std::chrono::steady_clock::time_point last_calibration_;
+
+    std::mutex worker_mutex_;
+    std::condition_variable worker_cond_;
+    std::condition_variable drained_cond_;
+    uint64_t drain_rounds_{0};
+    std::unique_ptr<Nazl::Thread> worker_;
+};
+typedef Nazl::Singleton<BinaryLogManager> binary_log_manager;
+
+// Renders a printf format with arguments decoded from a record.
+std::string FormatRecord(const Site& site, const char* args, std::size_t size);
+
+// Reader for the file written by BinaryLogManager::Start(file_path, ...).
+class FileReader
+{
+public:
+    explicit FileReader(const std::string& file_path);
+    bool IsOpen() const
+    {
+        return fd_ != nullptr;
+    }
+    ~FileReader();
+    // Reads the next event into event, sites are picked up along the way. Returns false at end of file.
+    bool Next(LogEvent& event);
+private:
+    std::FILE* fd_{nullptr};
+    // deque: events point at the site strings, which must not move when the table grows
+    std::deque<Site> sites_;
+};
+
+template<typename... Args>
+inline void Write(uint32_t id, const Args&... args)
+{
+    auto& manager = binary_log_manager::GetInstance();
+    StagingBuffer* buffer = manager.ThreadBuffer();
+    std::size_t size = sizeof(RecordHeader) + (std::size_t(0) + ... + ArgSize(args));
+    size = (size + 7) & ~std::size_t(7);
+    char* out = buffer->Reserve(size);
+    if (!out)
+    {
+        buffer->CountDrop();
+        return;
+    }
+    RecordHeader header{id, static_cast<uint32_t>(size), ReadTicks()};
+    memcpy(out, &header, sizeof(header));
+    char* pos = out + sizeof(header);
+    ((pos = EncodeArg(pos, args)), ...);
+    (void)pos;
+    buffer->Commit(size);
+}
+}
+
+#define LOG_BIN_IMPL(level, format, ...)                                                                 \
+    do                                                                                                   \
+    {                                                                                                    \
+        auto& nazl_bin_manager_ = BinaryLog::binary_log_manager::GetInstance();                          \
+        if (nazl_bin_manager_.IsRunning())                                                               \
+        {                                                                                                \
+            if (nazl_bin_manager_.ShouldLog(level))                                                      \
+            {                                                                                            \
+                static const uint32_t nazl_bin_id_ = BinaryLog::RegisterSiteFor(level, __FILE__,         \
+                                                     __FUNCTION__, __LINE__, format, ##__VA_ARGS__);     \
+                BinaryLog::Write(nazl_bin_id_, ##__VA_ARGS__);                                           \
+            }                                                                                            \
+        }                                                                                                \
+        else                                                                                             \
+        {                                                                                                \
+            LOG_COMMON_IMPL(level, "", format, ##__VA_ARGS__);                                           \
+        }                                                                                                \
+    } while (0)
+
+namespace BinaryLog
+{
+template<typename... Args>
+uint32_t RegisterSiteFor(LogLevel::LevelEnum level, const char* file, const char* func, int32_t line,
+                         const char* format, const Args&...)
+{
+    return binary_log_manager::GetInstance().RegisterSite(level, file, func, line, format, {ArgTypeOf<Args>()...});
+}
+}
+
+#if NAZL_LOG_ACTIVE_LEVEL <= NAZL_LOG_LEVEL_DEBUG
+#define LOG_BIN_DEBUG(format, ...) LOG_BIN_IMPL(LogLevel::LevelEnum::Debug, format, ##__VA_ARGS__)
+#else
+#define LOG_BIN_DEBUG(format, ...) LOG_DISABLED_IMPL()
+#endif
+#if NAZL_LOG_ACTIVE_LEVEL <= NAZL_LOG_LEVEL_INFO
+#define LOG_BIN_INFO(format, ...) LOG_BIN_IMPL(LogLevel::LevelEnum::Info, format, ##__VA_ARGS__)
+#else
+#define LOG_BIN_INFO(format, ...) LOG_DISABLED_IMPL()
+#endif
+#if NAZL_LOG_ACTIVE_LEVEL <= NAZL_LOG_LEVEL_WARN
+#define LOG_BIN_WARN(format, ...) LOG_BIN_IMPL(LogLevel::LevelEnum::Warn, format, ##__VA_ARGS__)
+#else
+#define LOG_BIN_WARN(format, ...) LOG_DISABLED_IMPL()
+#endif
+#if NAZL_LOG_ACTIVE_LEVEL <= NAZL_LOG_LEVEL_ERROR
+#define LOG_BIN_ERROR(format, ...) LOG_BIN_IMPL(LogLevel::LevelEnum::Error, format, ##__VA_ARGS__)
+#else
+#define LOG_BIN_ERROR(format, ...) LOG_DISABLED_IMPL()
+#endif
+#if NAZL_LOG_ACTIVE_LEVEL <= NAZL_LOG_LEVEL_FATAL
+#define LOG_BIN_FATAL(format, ...) LOG_BIN_IMPL(LogLevel::LevelEnum::Fatal, format, ##__VA_ARGS__)
+#else
+#define LOG_BIN_FATAL(format, ...) LOG_DISABLED_IMPL()
+#endif
+#endif //COMMON_BINARY_LOG_H
@@ -0,0 +1,400 @@
+//
+// Created by zwz on 2024/10/17.
+//
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_set>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "file_ops.h"
+#include "flight_recorder.h"
+
+static_assert(sizeof(FlightRecorderSink::FileHeader) == 64, "file header layout");
+static_assert(sizeof(FlightRecorderSink::SlotHeader) == 64, "slot header layout");
+static_assert(sizeof(FlightRecorderSink::Record) == FlightRecorderSink::kRecordSize, "record layout");
+
+namespace
+{
+constexpr char kMagic[4] = {'N', 'Z', 'F', 'R'};
+std::atomic<uint64_t> g_next_id{1};
+
+std::atomic<FlightRecorderSink*> g_crash_recorder{nullptr};
+std::atomic<const char*> g_crash_base{nullptr};
+std::size_t g_crash_size = 0;
+int g_crash_fd = 2;
+
+// ids of the recorders whose mapping is still there, for threads releasing slots on exit
+std::mutex& LiveMutex()
+{
+    static auto* mutex = new std::mutex;
+    return *mutex;
+}
+std::unordered_set<uint64_t>& LiveRecorders()
+{
+    static auto* live = new std::unordered_set<uint64_t>;
+    return *live;
+}
+
+// the slot the calling thread writes to, per recorder; released when the thread exits
+struct ThreadSlots
+{
+    struct Entry
+    {
+        uint64_t owner_;
+        FlightRecorderSink::FileHeader* header_;
+        FlightRecorderSink::SlotHeader* slot_;   // nullptr: none was free
+        uint32_t releases_;                      // header_->releases_ when the claim failed
+    };
+    ~ThreadSlots()
+    {
+        std::lock_guard<std::mutex> lock(LiveMutex());
+        for (auto& entry : entries_)
+        {
+            if (entry.slot_ && LiveRecorders().count(entry.owner_))
+            {
+                entry.slot_->state_.store(FlightRecorderSink::SlotFree, std::memory_order_release);
+                entry.header_->releases_.fetch_add(1, std::memory_order_release);
+            }
+        }
+    }
+    std::vector<Entry> entries_;
+};
+thread_local ThreadSlots t_slots;
+thread_local fmt::memory_buffer t_buffer;
+
+std::size_t SlotsOffset()
+{
+    return sizeof(FlightRecorderSink::FileHeader);
+}
+std::size_t RecordsOffset(uint32_t slots)
+{
+    return SlotsOffset() + slots * sizeof(FlightRecorderSink::SlotHeader);
+}
+
+void WriteAll(int fd, const char* data, std::size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = ::write(fd, data, size);
+        if (n <= 0)
+        {
+            if (n < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+}
+
+void WriteNumber(int fd, uint64_t value)
+{
+    char digits[24];
+    int pos = sizeof(digits);
+    do
+    {
+        digits[--pos] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    WriteAll(fd, digits + pos, sizeof(digits) - pos);
+}
+}
+
+FlightRecorderSink::FlightRecorderSink(const std::string& file_path, uint32_t threads, uint32_t records_per_thread)
+    : file_path_(file_path), slots_(threads ? std::min(threads, kMaxThreads) : kDefaultThreads),
+      records_(records_per_thread ? records_per_thread : kDefaultRecords), id_(g_next_id.fetch_add(1)),
+      active_format_(format_.get()), active_level_(level_.GetLevel())
+{
+    formats_.push_back(format_);
+    if (!Nazl::create_parent_dir(file_path_))
+    {
+        return;
+    }
+    // whatever the last run left behind is exactly what someone may want to look at
+    if (Nazl::path_exists(file_path_))
+    {
+        ::rename(file_path_.c_str(), (file_path_ + ".prev").c_str());
+    }
+    int fd = ::open(file_path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        perror(("Failed to open flight recorder " + file_path_).c_str());
+        return;
+    }
+    map_size_ = RecordsOffset(slots_) + static_cast<std::size_t>(slots_) * records_ * kRecordSize;
+    if (::fallocate(fd, 0, 0, static_cast<off_t>(map_size_)) != 0 && ::ftruncate(fd, static_cast<off_t>(map_size_)) != 0)
+    {
+        perror(("Failed to size flight recorder " + file_path_).c_str());
+        ::close(fd);
+        return;
+    }
+    void* map = ::mmap(nullptr, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror(("Failed to map flight recorder " + file_path_).c_str());
+        return;
+    }
+    map_ = static_cast<char*>(map);
+    auto* header = reinterpret_cast<FileHeader*>(map_);
+    header->version_ = kVersion;
+    header->slots_ = slots_;
+    header->records_ = records_;
+    header->record_size_ = kRecordSize;
+    header->used_slots_.store(0, std::memory_order_relaxed);
+    header->releases_.store(0, std::memory_order_relaxed);
+    // the magic goes last so a half initialised file is never taken for a valid one
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic_, kMagic, sizeof(kMagic));
+    std::lock_guard<std::mutex> lock(LiveMutex());
+    LiveRecorders().insert(id_);
+}
+
+FlightRecorderSink::~FlightRecorderSink()
+{
+    FlightRecorderSink* self = this;
+    if (g_crash_recorder.compare_exchange_strong(self, nullptr))
+    {
+        g_crash_base.store(nullptr);
+    }
+    if (map_)
+    {
+        {
+            std::lock_guard<std::mutex> lock(LiveMutex());
+            LiveRecorders().erase(id_);
+        }
+        ::msync(map_, map_size_, MS_ASYNC);
+        ::munmap(map_, map_size_);
+    }
+}
+
+FlightRecorderSink::Record* FlightRecorderSink::RecordAt(uint32_t slot, uint64_t index)
+{
+    std::size_t offset = RecordsOffset(slots_) + (static_cast<std::size_t>(slot) * records_ + index % records_) * kRecordSize;
+    return reinterpret_cast<Record*>(map_ + offset);
+}
+
+FlightRecorderSink::SlotHeader* FlightRecorderSink::ThreadSlot()
+{
+    auto* header = reinterpret_cast<FileHeader*>(map_);
+    for (auto& entry : t_slots.entries_)
+    {
+        if (entry.owner_ != id_)
+        {
+            continue;
+        }
+        // out of slots: try again only once some thread has released one
+        if (!entry.slot_ && entry.releases_ != header->releases_.load(std::memory_order_acquire))
+        {
+            entry.releases_ = header->releases_.load(std::memory_order_acquire);
+            entry.slot_ = ClaimSlot();
+        }
+        return entry.slot_;
+    }
+    uint32_t releases = header->releases_.load(std::memory_order_acquire);
+    t_slots.entries_.push_back({id_, header, ClaimSlot(), releases});
+    return t_slots.entries_.back().slot_;
+}
+
+FlightRecorderSink::SlotHeader* FlightRecorderSink::ClaimSlot()
+{
+    auto* header = reinterpret_cast<FileHeader*>(map_);
+    auto slotAt = [this](uint32_t index)
+    {
+        return reinterpret_cast<SlotHeader*>(map_ + SlotsOffset() + index * sizeof(SlotHeader));
+    };
+    SlotHeader* slot = nullptr;
+    // unused slots first, so that the rings of exited threads are overwritten last
+    uint32_t used = header->used_slots_.load(std::memory_order_relaxed);
+    while (used < slots_)
+    {
+        if (header->used_slots_.compare_exchange_weak(used, used + 1, std::memory_order_acq_rel))
+        {
+            slot = slotAt(used);
+            break;
+        }
+    }
+    for (uint32_t i = 0; !slot && i < slots_; ++i)
+    {
+        uint32_t expected = SlotFree;
+        if (slotAt(i)->state_.compare_exchange_strong(expected, SlotInUse, std::memory_order_acq_rel))
+        {
+            slot = slotAt(i);
+        }
+    }
+    if (slot)
+    {
+        // a reused slot keeps its head: the new thread's records follow the old ones
+        slot->state_.store(SlotInUse, std::memory_order_relaxed);
+        slot->tid_ = static_cast<uint32_t>(::syscall(SYS_gettid));
+        pthread_getname_np(pthread_self(), slot->name_, sizeof(slot->name_));
+    }
+    return slot;
+}
+
+void FlightRecorderSink::Log(const LogEvent& event)
+{
+    if (!map_ || event.GetLevel().GetLevel() < active_level_.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    SlotHeader* slot = ThreadSlot();
+    if (!slot)
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    t_buffer.clear();
+    active_format_.load(std::memory_order_acquire)->Format(t_buffer, event);
+    uint32_t slot_index = static_cast<uint32_t>((reinterpret_cast<char*>(slot) - map_ - SlotsOffset()) / sizeof(SlotHeader));
+    uint64_t head = slot->head_.load(std::memory_order_relaxed);
+    Record* record = RecordAt(slot_index, head);
+    record->seq_.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    record->timestamp_ = event.GetTimestamp();
+    record->len_ = static_cast<uint16_t>(std::min(t_buffer.size(), sizeof(record->text_)));
+    memcpy(record->text_, t_buffer.data(), record->len_);
+    record->seq_.store(head + 1, std::memory_order_release);
+    slot->head_.store(head + 1, std::memory_order_release);
+}
+
+void FlightRecorderSink::Flush()
+{
+    // nothing to do: the mapping is the storage, the kernel writes it back on its own
+}
+
+void FlightRecorderSink::SetFormat(std::shared_ptr<LogFormat> format)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    format_ = format;
+    formats_.push_back(format);
+    active_format_.store(format.get(), std::memory_order_release);
+}
+
+void FlightRecorderSink::SetLevel(LogLevel log_level)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    level_ = log_level;
+    active_level_.store(log_level.GetLevel(), std::memory_order_relaxed);
+}
+
+LogLevel FlightRecorderSink::GetLevel()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return level_;
+}
+
+void FlightRecorderSink::InstallCrashHandler(int fd)
+{
+    if (!map_)
+    {
+        return;
+    }
+    g_crash_fd = fd;
+    g_crash_size = map_size_;
+    g_crash_base.store(map_);
+    g_crash_recorder.store(this);
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = &FlightRecorderSink::OnSignal;
+    action.sa_flags = SA_RESETHAND;
+    sigemptyset(&action.sa_mask);
+    for (int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT})
+    {
+        ::sigaction(sig, &action, nullptr);
+    }
+}
+
+void FlightRecorderSink::OnSignal(int sig)
+{
+    const char* base = g_crash_base.exchange(nullptr);
+    if (base)
+    {
+        static const char kBanner[] = "*** flight recorder dump on signal ";
+        WriteAll(g_crash_fd, kBanner, sizeof(kBanner) - 1);
+        WriteNumber(g_crash_fd, static_cast<uint64_t>(sig));
+        WriteAll(g_crash_fd, " ***\n", 5);
+        Dump(base, g_crash_size, g_crash_fd);
+    }
+    // SA_RESETHAND restored the default action
+    ::raise(sig);
+}
+
+int64_t FlightRecorderSink::Dump(const char* base, std::size_t size, int fd)
+{
+    if (size < sizeof(FileHeader))
+    {
+        return -1;
+    }
+    auto* header = reinterpret_cast<const FileHeader*>(base);
+    if (memcmp(header->magic_, kMagic, sizeof(kMagic)) != 0 || header->version_ != kVersion ||
+        header->record_size_ != kRecordSize || header->records_ == 0 || header->slots_ > kMaxThreads ||
+        size < RecordsOffset(header->slots_) + static_cast<std::size_t>(header->slots_) * header->records_ * kRecordSize)
+    {
+        return -1;
+    }
+    uint32_t slots = header->slots_;
+    uint32_t records = header->records_;
+    uint32_t used = std::min(header->used_slots_.load(std::memory_order_acquire), slots);
+    auto slotAt = [base](uint32_t i)
+    {
+        return reinterpret_cast<const SlotHeader*>(base + SlotsOffset() + i * sizeof(SlotHeader));
+    };
+    auto recordAt = [base, slots, records](uint32_t slot, uint64_t index)
+    {
+        std::size_t offset = RecordsOffset(slots) + (static_cast<std::size_t>(slot) * records + index % records) * kRecordSize;
+        return reinterpret_cast<const Record*>(base + offset);
+    };
+    // k-way merge by timestamp, fixed arrays only (kMaxThreads bounds the slot count)
+    uint64_t cursor[kMaxThreads];
+    uint64_t end[kMaxThreads];
+    for (uint32_t i = 0; i < used; ++i)
+    {
+        end[i] = slotAt(i)->head_.load(std::memory_order_acquire);
+        cursor[i] = end[i] > records ? end[i] - records : 0;
+    }
+    int64_t written = 0;
+    for (;;)
+    {
+        int best = -1;
+        uint64_t best_time = 0;
+        for (uint32_t i = 0; i < used; ++i)
+        {
+            // skip records that are torn or were overwritten after head was read
+            while (cursor[i] < end[i] && recordAt(i, cursor[i])->seq_.load(std::memory_order_acquire) != cursor[i] + 1)
+            {
+                ++cursor[i];
+            }
+            if (cursor[i] < end[i])
+            {
+                uint64_t time = recordAt(i, cursor[i])->timestamp_;
+                if (best < 0 || time < best_time)
+                {
+                    best = static_cast<int>(i);
+                    best_time = time;
+                }
+            }
+        }
+        if (best < 0)
+        {
+            break;
+        }
+        const Record* record = recordAt(static_cast<uint32_t>(best), cursor[best]++);
+        std::size_t len = std::min<std::size_t>(record->len_, sizeof(record->text_));
+        WriteAll(fd, record->text_, len);
+        if (len == 0 || record->text_[len - 1] != '\n')
+        {
+            WriteAll(fd, "\n", 1);
+        }
+        ++written;
+    }
+    return written;
+}
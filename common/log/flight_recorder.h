@@ -0,0 +1,111 @@
+//
+// Created by zwz on 2024/10/17.
+//
+
+#ifndef COMMON_FLIGHT_RECORDER_H
+#define COMMON_FLIGHT_RECORDER_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "log.h"
+
+// Always-on record of the most recent events, meant to run at DEBUG while the other sinks stay at
+// INFO. Every thread gets its own single-writer ring of fixed-size records inside a MAP_SHARED
+// file, so the rings survive the process: a crash handler can print them, and after a hard kill
+// nazl_flight_recorder reads the same file. The file from the previous run is kept as <path>.prev.
+// A slot is released when its thread exits and handed to a later thread once every slot has been
+// used, so the rings of exited threads stay readable for as long as there is room.
+//
+// File layout: FileHeader, slots_ x SlotHeader, slots_ x records_ x Record.
+class FlightRecorderSink : public Sink
+{
+public:
+    static constexpr uint32_t kDefaultThreads = 64;
+    static constexpr uint32_t kMaxThreads = 256;
+    static constexpr uint32_t kDefaultRecords = 1024;
+    static constexpr std::size_t kRecordSize = 256;
+    static constexpr uint32_t kVersion = 1;
+
+    struct FileHeader
+    {
+        char magic_[4];
+        uint32_t version_;
+        uint32_t slots_;
+        uint32_t records_;
+        uint32_t record_size_;
+        std::atomic<uint32_t> used_slots_;   // slots handed out at least once
+        std::atomic<uint32_t> releases_;     // bumped whenever a slot becomes free
+        char reserved_[36];
+    };
+    enum SlotState : uint32_t
+    {
+        SlotUnused = 0,
+        SlotInUse = 1,
+        SlotFree = 2    // its thread exited, the records stay until the slot is reused
+    };
+    struct SlotHeader
+    {
+        std::atomic<uint64_t> head_;
+        uint32_t tid_;
+        char name_[16];
+        std::atomic<uint32_t> state_;
+        char reserved_[32];
+    };
+    struct Record
+    {
+        // index + 1 once the record is complete, 0 while it is being written
+        std::atomic<uint64_t> seq_;
+        uint64_t timestamp_;
+        uint16_t len_;
+        char text_[kRecordSize - 18];
+    };
+
+    explicit FlightRecorderSink(const std::string& file_path, uint32_t threads = kDefaultThreads,
+                                uint32_t records_per_thread = kDefaultRecords);
+    ~FlightRecorderSink() override;
+    FlightRecorderSink(const FlightRecorderSink&) = delete;
+    FlightRecorderSink& operator=(const FlightRecorderSink&) = delete;
+    bool IsOpen() const
+    {
+        return map_ != nullptr;
+    }
+    void Log(const LogEvent& event) override;
+    void Flush() override;
+    void SetFormat(std::shared_ptr<LogFormat> format) override;
+    void SetLevel(LogLevel log_level) override;
+    LogLevel GetLevel() override;
+    // Events lost because more threads logged at the same time than there are slots.
+    uint64_t GetDroppedCount() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+    // Prints the recorded events to fd on SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT, then
+    // re-raises with the default action. One recorder at a time.
+    void InstallCrashHandler(int fd = 2);
+    // Writes every complete record, oldest first, to fd. Only uses write(2): callable from a
+    // signal handler and from the offline tool. Returns the number of records written, -1 if
+    // base does not hold a valid recorder file.
+    static int64_t Dump(const char* base, std::size_t size, int fd);
+private:
+    SlotHeader* ThreadSlot();
+    SlotHeader* ClaimSlot();
+    Record* RecordAt(uint32_t slot, uint64_t index);
+    static void OnSignal(int sig);
+private:
+    std::string file_path_;
+    uint32_t slots_;
+    uint32_t records_;
+    std::size_t map_size_{0};
+    char* map_{nullptr};
+    uint64_t id_;
+    std::atomic<uint64_t> dropped_{0};
+    // Log() takes no lock: the active format and level are read atomically, and formats
+    // replaced by SetFormat stay alive in formats_.
+    std::atomic<LogFormat*> active_format_;
+    std::atomic<LogLevel::LevelEnum> active_level_;
+    std::vector<std::shared_ptr<LogFormat>> formats_;
+    std::mutex mutex_;
+};
+#endif //COMMON_FLIGHT_RECORDER_H
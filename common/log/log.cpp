@@ -1,83 +1,483 @@
 //
 // Created by zwz on 2024/8/25.
 //
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <sys/stat.h>
 #include "log.h"
+#include "async_logger.h"
+#include "binary_log.h"
+#include "mmap_file_sink.h"
+#include "flight_recorder.h"
+#include "shm_log.h"
+#include "socket_sink.h"
+#include "log_config_watcher.h"
+#include "log_index.h"
 #include "config.h"
-LogFormat::LogFormat(std::string pattern) : pattern_(pattern)
+namespace
+{
+struct CachedTimePrefix
+{
+    int64_t second_{-1};
+    std::size_t len_{0};
+    char buf_[32];
+};
+thread_local CachedTimePrefix t_time_cache;
+
+// Appends value as exactly width zero-padded digits.
+void AppendDigits(fmt::memory_buffer& out, uint32_t value, int width)
 {
-    ParsePattern();
+    char digits[10];
+    for (int i = width - 1; i >= 0; --i)
+    {
+        digits[i] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    }
+    out.append(digits, digits + width);
+}
+
+// "%Y-%m-%d %H:%M:%S" is cached per thread and only re-rendered when the second changes,
+// precision appends .mmm (3) or .uuuuuu (6) from the event capture time.
+void AppendTime(fmt::memory_buffer& out, uint64_t nanos, int precision)
+{
+    int64_t second = static_cast<int64_t>(nanos / 1000000000ull);
+    CachedTimePrefix& cache = t_time_cache;
+    if (cache.second_ != second)
+    {
+        std::time_t t = static_cast<std::time_t>(second);
+        std::tm localTime;
+        localtime_r(&t, &localTime);
+        cache.len_ = strftime(cache.buf_, sizeof(cache.buf_), "%Y-%m-%d %H:%M:%S", &localTime);
+        cache.second_ = second;
+    }
+    out.append(cache.buf_, cache.buf_ + cache.len_);
+    uint32_t sub_second = static_cast<uint32_t>(nanos % 1000000000ull);
+    if (precision == 3)
+    {
+        out.push_back('.');
+        AppendDigits(out, sub_second / 1000000, 3);
+    }
+    else if (precision == 6)
+    {
+        out.push_back('.');
+        AppendDigits(out, sub_second / 1000, 6);
+    }
+}
+
+inline void AppendString(fmt::memory_buffer& out, std::string_view value)
+{
+    out.append(value.data(), value.data() + value.size());
+}
+
+template<typename T>
+inline void AppendRaw(fmt::memory_buffer& out, const T& value)
+{
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    out.append(bytes, bytes + sizeof(T));
+}
+
+void AppendJsonString(fmt::memory_buffer& out, std::string_view value)
+{
+    static const char kHex[] = "0123456789abcdef";
+    out.push_back('"');
+    for (char c : value)
+    {
+        switch (c)
+        {
+        case '"':
+            AppendString(out, "\\\"");
+            break;
+        case '\\':
+            AppendString(out, "\\\\");
+            break;
+        case '\n':
+            AppendString(out, "\\n");
+            break;
+        case '\r':
+            AppendString(out, "\\r");
+            break;
+        case '\t':
+            AppendString(out, "\\t");
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                char escaped[6] = {'\\', 'u', '0', '0', kHex[(c >> 4) & 0xf], kHex[c & 0xf]};
+                out.append(escaped, escaped + sizeof(escaped));
+            }
+            else
+            {
+                out.push_back(c);
+            }
+        }
+    }
+    out.push_back('"');
 }
 
-std::string LogFormat::Format(std::shared_ptr<LogEvent> event)
+// logfmt: a text value is quoted (with JSON escapes) when it is empty or would not read back as one
+// token, i.e. holds a space, '=', '"' or a control character.
+bool NeedsLogfmtQuotes(std::string_view value)
 {
-    std::stringstream ss;
-    for (auto &it : formate_flag_)
+    if (value.empty())
+    {
+        return true;
+    }
+    for (char c : value)
     {
-        it->Format(ss, event);
+        if (c == ' ' || c == '=' || c == '"' || static_cast<unsigned char>(c) < 0x20 || c == 0x7f)
+        {
+            return true;
+        }
     }
-    return ss.str();
+    return false;
 }
-void LogFormat::Format(std::ostream &os, std::shared_ptr<LogEvent> event)
+
+// Field value as text, strings quoted logfmt style; as JSON when json is set (NaN and infinities,
+// which JSON cannot express, become null).
+void AppendFieldValue(fmt::memory_buffer& out, const LogField& field, bool json)
 {
-    for (auto &it : formate_flag_)
+    switch (field.type_)
     {
-        it->Format(os, event);
+    case LogFieldType::Int:
+        fmt::format_to(std::back_inserter(out), "{}", field.int_);
+        break;
+    case LogFieldType::UInt:
+        fmt::format_to(std::back_inserter(out), "{}", field.uint_);
+        break;
+    case LogFieldType::Double:
+        if (json && !std::isfinite(field.double_))
+        {
+            AppendString(out, "null");
+            break;
+        }
+        fmt::format_to(std::back_inserter(out), "{}", field.double_);
+        break;
+    case LogFieldType::Bool:
+        AppendString(out, field.bool_ ? "true" : "false");
+        break;
+    case LogFieldType::String:
+        if (json || NeedsLogfmtQuotes(field.string_))
+        {
+            AppendJsonString(out, field.string_);
+        }
+        else
+        {
+            AppendString(out, field.string_);
+        }
+        break;
     }
 }
-void LogFormat::ParsePattern()
+}
+
+LogFormat::LogFormat(std::string pattern) : pattern_(pattern)
 {
+    if (pattern_ == "json")
+    {
+        output_ = Output::Json;
+        return;
+    }
+    if (pattern_ == "binary")
+    {
+        output_ = Output::Binary;
+        return;
+    }
     if (pattern_.empty())
     {
-        //Timestamp Level  Func Line  Thread_id Message EOL
-        pattern_ = "%T %L  %f %l %N %m %E";
+        pattern_ = kDefaultPattern;
     }
-    for (auto it = pattern_.begin(); it != pattern_.end(); ++it)
+    ParsePatternInto(pattern_, *this);
+}
+
+void LogFormat::Push(PatternInstr instr)
+{
+    if (instr.op_ == PatternOp::Literal && !instrs_.empty())
     {
-        if (*it == '%')
+        PatternInstr& last = instrs_.back();
+        if (last.op_ == PatternOp::Literal && last.offset_ + last.len_ == instr.offset_)
         {
-            ++it;
-            switch (*it)
+            last.len_ += instr.len_;
+            return;
+        }
+    }
+    instrs_.push_back(instr);
+}
+
+void LogFormat::Format(fmt::memory_buffer& out, const LogEvent& event) const
+{
+    if (output_ == Output::Json)
+    {
+        FormatJson(out, event);
+        return;
+    }
+    if (output_ == Output::Binary)
+    {
+        FormatBinary(out, event);
+        return;
+    }
+    for (const auto& instr : instrs_)
+    {
+        switch (instr.op_)
+        {
+        case PatternOp::Literal:
+            out.append(pattern_.data() + instr.offset_, pattern_.data() + instr.offset_ + instr.len_);
+            break;
+        case PatternOp::Time:
+            AppendTime(out, event.GetTimestamp(), 0);
+            break;
+        case PatternOp::TimeMillis:
+            AppendTime(out, event.GetTimestamp(), 3);
+            break;
+        case PatternOp::TimeMicros:
+            AppendTime(out, event.GetTimestamp(), 6);
+            break;
+        case PatternOp::Level:
+            AppendString(out, LogLevel::ToString(event.GetLevel().GetLevel()));
+            break;
+        case PatternOp::Func:
+            AppendString(out, event.GetFunc());
+            break;
+        case PatternOp::Line:
+        {
+            fmt::format_int line(event.GetLine());
+            out.append(line.data(), line.data() + line.size());
+            break;
+        }
+        case PatternOp::ThreadId:
+            AppendString(out, event.GetThreadIdText());
+            break;
+        case PatternOp::ThreadName:
+            AppendString(out, event.GetThreadName());
+            break;
+        case PatternOp::Message:
+        {
+            AppendString(out, event.GetMessage());
+            LogFieldReader reader(event.GetFields());
+            LogField field;
+            while (reader.Next(field))
             {
-            case 'T':
-                formate_flag_.push_back(std::make_unique<TimeFlagFormatter>());
-                break;
-            case 'L':
-                formate_flag_.push_back(std::make_unique<LevelFlagFormatter>());
-                break;
-            case 'E':
-                formate_flag_.push_back(std::make_unique<EOLFlagFormatter>());
-                break;
-            case 'f':
-                formate_flag_.push_back(std::make_unique<FuncFlagFormatter>());
-                break;
-            case 'l':
-                formate_flag_.push_back(std::make_unique<LineFlagFormatter>());
-                break;
-            case 'm':
-                formate_flag_.push_back(std::make_unique<StringFlagFormatter>());
-                break;
-            case 'N':
-                formate_flag_.push_back(std::make_unique<TidFlagFormatter>());
-                break;
-            default:
-                std::cout << "error pattern" << std::endl;
-                break;
+                out.push_back(' ');
+                AppendString(out, field.key_);
+                out.push_back('=');
+                AppendFieldValue(out, field, false);
             }
+            break;
+        }
+        case PatternOp::EndOfLine:
+            out.push_back('\n');
+            break;
         }
     }
 }
 
-void StdoutSink::Log(std::shared_ptr<LogEvent> event)
+void LogFormat::FormatJson(fmt::memory_buffer& out, const LogEvent& event) const
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    format_->Format(std::cout, event);
-    ::fflush(stdout);
+    AppendString(out, "{\"ts\":\"");
+    AppendTime(out, event.GetTimestamp(), 6);
+    AppendString(out, "\",\"level\":\"");
+    AppendString(out, LogLevel::ToString(event.GetLevel().GetLevel()));
+    AppendString(out, "\",\"file\":");
+    AppendJsonString(out, event.GetFile());
+    AppendString(out, ",\"line\":");
+    fmt::format_int line(event.GetLine());
+    out.append(line.data(), line.data() + line.size());
+    AppendString(out, ",\"func\":");
+    AppendJsonString(out, event.GetFunc());
+    AppendString(out, ",\"thread\":");
+    AppendJsonString(out, event.GetThreadName());
+    AppendString(out, ",\"msg\":");
+    AppendJsonString(out, event.GetMessage());
+    LogFieldReader reader(event.GetFields());
+    LogField field;
+    while (reader.Next(field))
+    {
+        out.push_back(',');
+        AppendJsonString(out, field.key_);
+        out.push_back(':');
+        AppendFieldValue(out, field, true);
+    }
+    AppendString(out, "}\n");
+}
+
+void LogFormat::FormatBinary(fmt::memory_buffer& out, const LogEvent& event) const
+{
+    std::size_t start = out.size();
+    AppendRaw(out, uint32_t(0));
+    AppendRaw(out, event.GetTimestamp());
+    AppendRaw(out, static_cast<uint8_t>(event.GetLevel().GetLevel()));
+    AppendRaw(out, event.GetLine());
+    AppendRaw(out, static_cast<uint16_t>(event.GetFile().size()));
+    AppendString(out, event.GetFile());
+    AppendRaw(out, static_cast<uint16_t>(event.GetFunc().size()));
+    AppendString(out, event.GetFunc());
+    AppendRaw(out, static_cast<uint8_t>(event.GetThreadName().size()));
+    AppendString(out, event.GetThreadName());
+    AppendRaw(out, static_cast<uint32_t>(event.GetMessage().size()));
+    AppendString(out, event.GetMessage());
+    AppendRaw(out, static_cast<uint32_t>(event.GetFields().size()));
+    AppendString(out, event.GetFields());
+    uint32_t size = static_cast<uint32_t>(out.size() - start);
+    memcpy(out.data() + start, &size, sizeof(size));
+}
+
+std::string LogFormat::Format(const LogEvent& event)
+{
+    fmt::memory_buffer out;
+    Format(out, event);
+    return fmt::to_string(out);
+}
+void LogFormat::Format(std::ostream &os, const LogEvent& event)
+{
+    fmt::memory_buffer out;
+    Format(out, event);
+    os.write(out.data(), static_cast<std::streamsize>(out.size()));
+}
+
+StdoutSink::StdoutSink(bool async, std::size_t max_pending, int fd)
+    : fd_(fd), max_pending_(max_pending)
+{
+    if (async)
+    {
+        writer_ = std::make_unique<Nazl::Thread>([this] { WriterLoop(); }, "log-stdout");
+    }
+}
+StdoutSink::~StdoutSink()
+{
+    if (writer_)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            running_ = false;
+        }
+        writer_cond_.notify_one();
+        writer_->join();
+    }
+}
+void StdoutSink::WriteAll(const char* data, std::size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = ::write(fd_, data, size);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+}
+std::atomic<uint32_t> LogThreadContext::forkGeneration_{0};
+namespace
+{
+// a context cached before fork() holds the parent's tid
+const int kLogAtForkRegistered = pthread_atfork(nullptr, nullptr, []
+{
+    LogThreadContext::forkGeneration_.fetch_add(1, std::memory_order_relaxed);
+});
+}
+void LogThreadContext::Set(uint32_t tid, std::string_view name)
+{
+    tid_ = tid;
+    nameLen_ = static_cast<uint8_t>(std::min(name.size(), kNameSize));
+    memcpy(name_, name.data(), nameLen_);
+    fmt::format_int text(tid);
+    tidTextLen_ = static_cast<uint8_t>(text.size());
+    memcpy(tidText_, text.data(), text.size());
+}
+void LogThreadContext::Capture()
+{
+    char name[kNameSize] = {0};
+    uint32_t tid;
+    if (const char* thread_name = Nazl::Thread::CurrentName())
+    {
+        tid = static_cast<uint32_t>(Nazl::Thread::CurrentTid());
+        strncpy(name, thread_name, sizeof(name) - 1);
+    }
+    else
+    {
+        tid = static_cast<uint32_t>(::syscall(SYS_gettid));
+        pthread_getname_np(pthread_self(), name, sizeof(name));
+    }
+    Set(tid, std::string_view(name, strnlen(name, sizeof(name))));
+}
+
+void StdoutSink::Log(const LogEvent& event)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (event.GetLevel().GetLevel() < level_.GetLevel())
+    {
+        return;
+    }
+    if (!writer_)
+    {
+        buffer_.clear();
+        format_->Format(buffer_, event);
+        // keep ordering with anything printed through stdio
+        ::fflush(stdout);
+        WriteAll(buffer_.data(), buffer_.size());
+        return;
+    }
+    if (buffer_.size() >= max_pending_)
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    bool wake = buffer_.size() == 0;
+    std::size_t before = buffer_.size();
+    format_->Format(buffer_, event);
+    appended_ += buffer_.size() - before;
+    lock.unlock();
+    if (wake)
+    {
+        writer_cond_.notify_one();
+    }
+}
+void StdoutSink::WriterLoop()
+{
+    fmt::memory_buffer batch;
+    uint64_t reported_dropped = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+        writer_cond_.wait(lock, [this] { return buffer_.size() > 0 || !running_; });
+        if (buffer_.size() == 0)
+        {
+            break;
+        }
+        std::swap(batch, buffer_);
+        lock.unlock();
+        uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+        if (dropped != reported_dropped)
+        {
+            fmt::format_to(std::back_inserter(batch), "StdoutSink dropped {} events, output too slow\n",
+                           dropped - reported_dropped);
+            reported_dropped = dropped;
+        }
+        ::fflush(stdout);
+        WriteAll(batch.data(), batch.size());
+        batch.clear();
+        lock.lock();
+        written_ = appended_ - buffer_.size();
+        flushed_cond_.notify_all();
+    }
 }
 void StdoutSink::Flush()
 {
-    std::lock_guard<std::mutex> lock(mutex_);
-    ::fflush(stdout);
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!writer_)
+    {
+        ::fflush(stdout);
+        return;
+    }
+    uint64_t target = appended_;
+    flushed_cond_.wait(lock, [this, target] { return written_ >= target; });
 }
 void StdoutSink::SetFormat(std::shared_ptr <LogFormat> format)
 {
@@ -94,8 +494,10 @@ LogLevel StdoutSink::GetLevel()
     std::lock_guard<std::mutex> lock(mutex_);
     return level_;
 }
-FileSink::FileSink(const std::string &file_name, std::size_t max_size, std::size_t max_files, Nazl::FileOps&& file_ops)
-    : file_name_(file_name), max_size_(max_size), max_files_(max_files), file_ops_(std::move(file_ops))
+FileSink::FileSink(const std::string &file_name, std::size_t max_size, std::size_t max_files,
+                   const FileSinkOptions& options)
+    : file_name_(file_name), max_size_(max_size), max_files_(max_files), options_(options),
+      writer_(options.buffer_size_), rotator_(log_rotator::GetInstance())
 {
     if (max_size == 0)
     {
@@ -105,37 +507,116 @@ FileSink::FileSink(const std::string &file_name, std::size_t max_size, std::size
     {
         max_files_ = 2000;
     }
-    if (max_files == 0)
+    // the cascade needs a bound, for indexed rotation 0 leaves the count unlimited
+    if (max_files == 0 && options_.rotation_ == FileSinkOptions::Rotation::Cascade)
     {
         max_files_ = 10;
     }
-    file_ops_.open(file_name_);
+    if (options_.rotation_ == FileSinkOptions::Rotation::Indexed)
+    {
+        next_index_ = LogRotator::NextIndex(file_name_);
+    }
+    else
+    {
+        // rotations a crashed process renamed away but never cascaded
+        rotator_->Recover(file_name_, max_files_, options_.compression_);
+    }
+    writer_.open(file_name_);
     std::cout << "open file " << file_name_ << std::endl;
-    current_size_ = file_ops_.size();
-    if (current_size_ > max_size_)
+    if (options_.index_lines_ > 0 || options_.index_bytes_ > 0)
+    {
+        index_ = std::make_unique<LogIndexWriter>(options_.index_lines_, options_.index_bytes_);
+        index_->Open(file_name_);
+    }
+    if (writer_.size() > max_size_)
+    {
+        // the content is older than this process, its last write is the closest start we know
+        struct stat st;
+        uint64_t start_ns = LogEvent::Now();
+        if (::stat(file_name_.c_str(), &st) == 0)
+        {
+            start_ns = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ull + static_cast<uint64_t>(st.st_mtim.tv_nsec);
+        }
+        StartSegment(start_ns);
+        Rotate(LogEvent::Now());
+    }
+    if ((options_.flush_policy_ & FileSinkOptions::FlushOnInterval) && options_.flush_interval_ms_ > 0)
+    {
+        flush_task_ = rotator_->AddPeriodic([this] { FlushIfDue(); }, options_.flush_interval_ms_ / 2);
+    }
+}
+FileSink::~FileSink()
+{
+    if (flush_task_)
+    {
+        rotator_->RemovePeriodic(flush_task_);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    writer_.flush();
+    if (index_)
+    {
+        index_->Close();
+    }
+}
+bool FileSink::ShouldFlush(const LogEvent& event) const
+{
+    uint32_t policy = options_.flush_policy_;
+    if ((policy & FileSinkOptions::FlushOnLevel) && event.GetLevel().GetLevel() >= options_.flush_level_)
+    {
+        return true;
+    }
+    if ((policy & FileSinkOptions::FlushOnSize) && writer_.buffered() >= options_.flush_size_)
     {
-        Rotate();
-        current_size_ = 0;
+        return true;
     }
+    return (policy & FileSinkOptions::FlushOnInterval) &&
+           event.GetTimestamp() >= first_buffered_ns_ + options_.flush_interval_ms_ * 1000000ull;
 }
-void FileSink::Log(std::shared_ptr<LogEvent> event)
+void FileSink::FlushIfDue()
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    std::string buffer = format_->Format(event);
-    size_t new_size = current_size_ + buffer.size();
-    if (new_size + buffer.size() > max_size_)
+    if (writer_.buffered() > 0 && LogEvent::Now() >= first_buffered_ns_ + options_.flush_interval_ms_ * 1000000ull)
     {
-        file_ops_.flush();
-        Rotate();
-        new_size = buffer.size();
+        writer_.flush();
+    }
+}
+void FileSink::Log(const LogEvent& event)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (event.GetLevel().GetLevel() < level_.GetLevel())
+    {
+        return;
+    }
+    buffer_.clear();
+    format_->Format(buffer_, event);
+    if (segment_start_ns_ == 0)
+    {
+        // the first event opens the period, so a reopened file keeps its content in the current segment
+        StartSegment(event.GetTimestamp());
+    }
+    if ((event.GetTimestamp() >= next_rotate_ns_ || writer_.size() + buffer_.size() > max_size_) &&
+        (rotate_backoff_.count() == 0 || std::chrono::steady_clock::now() >= rotate_retry_at_))
+    {
+        Rotate(event.GetTimestamp());
+    }
+    if (writer_.buffered() == 0)
+    {
+        first_buffered_ns_ = event.GetTimestamp();
+    }
+    if (index_)
+    {
+        index_->Add(event.GetTimestamp(), event.GetLevel().GetLevel(), writer_.size(), buffer_.size());
+    }
+    writer_.write(buffer_.data(), buffer_.size());
+    if (ShouldFlush(event))
+    {
+        writer_.flush();
     }
-    file_ops_.write(buffer.c_str(), buffer.size());
-    current_size_ = new_size;
 }
 void FileSink::Flush()
 {
     std::lock_guard<std::mutex> lock(mutex_);
-    file_ops_.flush();
+    writer_.flush();
 }
 void FileSink::SetFormat(std::shared_ptr <LogFormat> format)
 {
@@ -152,46 +633,65 @@ LogLevel FileSink::GetLevel()
     std::lock_guard<std::mutex> lock(mutex_);
     return level_;
 }
-void FileSink::Rotate()
+void FileSink::StartSegment(uint64_t now_ns)
 {
-    file_ops_.close();
-    std::string oldest_file = file_name_ + "." + std::to_string(max_files_);
-    if (Nazl::path_exists(oldest_file))
+    segment_start_ns_ = now_ns;
+    if (options_.rotate_interval_s_ > 0)
     {
-        std::remove(oldest_file.c_str());
+        uint64_t interval_ns = options_.rotate_interval_s_ * 1000000000ull;
+        next_rotate_ns_ = (now_ns / interval_ns + 1) * interval_ns;
     }
-    for (int i = max_files_ - 1; i >= 0; --i)
+}
+void FileSink::Rotate(uint64_t now_ns)
+{
+    // an interval boundary with nothing written just starts the next period
+    if (writer_.size() > 0)
     {
-        std::string src = (i == 0) ? file_name_ : file_name_ + "." + std::to_string(i);
-        std::string target = file_name_ + "." + std::to_string(i + 1);
-
-        if (Nazl::path_exists(src))
+        writer_.close();
+        if (index_)
         {
-            ::rename(src.c_str(), target.c_str());
+            index_->Close();
+        }
+        bool rotated;
+        if (options_.rotation_ == FileSinkOptions::Rotation::Indexed)
+        {
+            LogRotator::Retention retention{max_files_, options_.max_age_s_, options_.max_total_size_};
+            rotated = rotator_->RotateIndexed(file_name_, next_index_, segment_start_ns_ / 1000000000ull, retention,
+                                              options_.compression_);
+            next_index_ += rotated ? 1 : 0;
+        }
+        else
+        {
+            rotated = rotator_->Rotate(file_name_, max_files_, options_.compression_);
+        }
+        if (rotated)
+        {
+            rotate_backoff_ = std::chrono::milliseconds(0);
+        }
+        else
+        {
+            // keep appending to the live file rather than retrying the rename on every event
+            if (rotate_backoff_.count() == 0)
+            {
+                perror(("Failed to rotate " + file_name_).c_str());
+            }
+            rotate_backoff_ = std::min(std::max(rotate_backoff_ * 2, kRotateRetryMin), kRotateRetryMax);
+            rotate_retry_at_ = std::chrono::steady_clock::now() + rotate_backoff_;
+        }
+        writer_.open(file_name_);
+        if (index_)
+        {
+            index_->Open(file_name_);
         }
     }
-    file_ops_.open(file_name_);
+    StartSegment(now_ns);
 }
 
 std::string LogLevel::GetLevelString()
 {
-    switch (level_)
-    {
-    case LevelEnum::Debug:
-        return "DEBUG";
-    case LevelEnum::Info:
-        return "INFO";
-    case LevelEnum::Warn:
-        return "WARNING";
-    case LevelEnum::Error:
-        return "ERROR";
-    case LevelEnum::Fatal:
-        return "FATAL";
-    default:
-        return "UNKNOWN";
-    }
+    return std::string(ToString(level_));
 }
-static LogLevel::LevelEnum stringToLevel(const std::string& levelStr)
+LogLevel::LevelEnum LogLevel::FromString(const std::string& levelStr)
 {
     std::string levelUpper = levelStr;
     std::transform(levelUpper.begin(), levelUpper.end(), levelUpper.begin(), ::toupper);
@@ -204,7 +704,7 @@ static LogLevel::LevelEnum stringToLevel(const std::string& levelStr)
     {
         return LogLevel::LevelEnum::Info;
     }
-    if (levelUpper == "WARNING")
+    if (levelUpper == "WARNING" || levelUpper == "WARN")
     {
         return LogLevel::LevelEnum::Warn;
     }
@@ -222,16 +722,83 @@ void Logger::SetFormatter(std::shared_ptr <LogFormat> format)
 {
     for (auto it = sinks_.begin(); it != sinks_.end(); ++it)
     {
-        (*it)->SetFormat(std::move(format));
+        (*it)->SetFormat(format);
     }
 }
-void Logger::SinkIt(std::shared_ptr<LogEvent> event)
+void Logger::SinkIt(LogEvent&& event)
 {
+    if (parent_)
+    {
+        parent_->SinkIt(std::move(event));
+        return;
+    }
     for (auto it = sinks_.begin(); it != sinks_.end(); ++it)
     {
         (*it)->Log(event);
     }
 }
+void Logger::SetParent(std::shared_ptr<Logger> parent)
+{
+    sinks_ = parent->GetSinks();
+    parent_ = std::move(parent);
+    RefreshLevel();
+}
+void Logger::SetLevel(LogLevel level)
+{
+    if (parent_)
+    {
+        threshold_.store(level.GetLevel(), std::memory_order_relaxed);
+        RefreshLevel();
+        return;
+    }
+    for (auto it = sinks_.begin(); it != sinks_.end(); ++it)
+    {
+        (*it)->SetLevel(level);
+    }
+    level_.store(level.GetLevel(), std::memory_order_relaxed);
+}
+bool Logger::SetSinkLevel(const std::string& sink_name, LogLevel level)
+{
+    bool found = false;
+    for (auto it = sinks_.begin(); it != sinks_.end(); ++it)
+    {
+        if ((*it)->GetName() == sink_name)
+        {
+            (*it)->SetLevel(level);
+            found = true;
+        }
+    }
+    if (found)
+    {
+        RefreshLevel();
+    }
+    return found;
+}
+void Logger::RefreshLevel()
+{
+    auto level = LogLevel::LevelEnum::Fatal;
+    for (auto it = sinks_.begin(); it != sinks_.end(); ++it)
+    {
+        level = std::min(level, (*it)->GetLevel().GetLevel());
+    }
+    if (parent_)
+    {
+        level = std::max(level, threshold_.load(std::memory_order_relaxed));
+    }
+    level_.store(level, std::memory_order_relaxed);
+}
+void Logger::Flush()
+{
+    if (parent_)
+    {
+        parent_->Flush();
+        return;
+    }
+    for (auto it = sinks_.begin(); it != sinks_.end(); ++it)
+    {
+        (*it)->Flush();
+    }
+}
 std::shared_ptr<Logger> LogManager::GetLogger(const std::string &name)
 {
     std::lock_guard<std::mutex> lock(map_mutex_);
@@ -241,23 +808,112 @@ std::shared_ptr<Logger> LogManager::GetLogger(const std::string &name)
 std::shared_ptr<Logger> LogManager::GetDefaultLogger()
 {
     std::lock_guard<std::mutex> lock(map_mutex_);
-    if (loggers_.empty())
+    auto found = loggers_.find("default");
+    return (found == loggers_.end()) ? nullptr : found->second;
+}
+std::vector<std::string> LogManager::GetLoggerNames()
+{
+    std::lock_guard<std::mutex> lock(map_mutex_);
+    std::vector<std::string> names;
+    names.reserve(loggers_.size());
+    for (auto& entry : loggers_)
+    {
+        names.push_back(entry.first);
+    }
+    return names;
+}
+bool LogManager::SetLevel(const std::string& logger_name, LogLevel level)
+{
+    auto logger = GetLogger(logger_name);
+    if (!logger)
+    {
+        return false;
+    }
+    logger->SetLevel(level);
+    RefreshLevels();
+    return true;
+}
+bool LogManager::SetSinkLevel(const std::string& logger_name, const std::string& sink_name, LogLevel level)
+{
+    auto logger = GetLogger(logger_name);
+    if (!logger || !logger->SetSinkLevel(sink_name, level))
+    {
+        return false;
+    }
+    RefreshLevels();
+    return true;
+}
+void LogManager::RefreshLevels()
+{
+    std::lock_guard<std::mutex> lock(map_mutex_);
+    for (auto& entry : loggers_)
+    {
+        entry.second->RefreshLevel();
+    }
+}
+Logger* LogManager::ResolveModule(std::size_t id, const char* name)
+{
+    std::lock_guard<std::mutex> lock(map_mutex_);
+    ModuleSlot& slot = modules_[id];
+    if (slot.name_ && strcmp(slot.name_, name) != 0)
+    {
+        std::cerr << "log module id " << id << " is used by both " << slot.name_ << " and " << name << std::endl;
+    }
+    slot.name_ = name;
+    auto found = loggers_.find(name);
+    if (found == loggers_.end())
+    {
+        found = loggers_.find("default");
+    }
+    Logger* logger = found == loggers_.end() ? nullptr : found->second.get();
+    slot.logger_.store(logger, std::memory_order_release);
+    return logger;
+}
+Logger* LogManager::ResolveHandle(LoggerHandle& handle, const char* logger_name)
+{
+    std::lock_guard<std::mutex> lock(map_mutex_);
+    auto found = loggers_.find(logger_name[0] != '\0' ? logger_name : "default");
+    Logger* logger = found == loggers_.end() ? nullptr : found->second.get();
+    if (!logger)
     {
-        return nullptr;
+        std::cerr << "Logger not found!" << std::endl;
     }
-    return loggers_.begin()->second;
+    if (!handle.linked_)
+    {
+        handle.next_ = handles_;
+        handles_ = &handle;
+        handle.linked_ = true;
+    }
+    handle.missing_.store(logger == nullptr, std::memory_order_relaxed);
+    handle.logger_.store(logger, std::memory_order_release);
+    return logger;
 }
 
 void LogManager::RegisterLogger(std::shared_ptr <Logger> logger)
 {
     auto logger_name = logger->GetName();
-    loggers_[logger_name] = std::move(logger);
+    std::lock_guard<std::mutex> lock(map_mutex_);
+    auto& slot = loggers_[logger_name];
+    if (slot)
+    {
+        retired_.push_back(std::move(slot));
+    }
+    slot = std::move(logger);
+    for (LoggerHandle* handle = handles_; handle; handle = handle->next_)
+    {
+        handle->logger_.store(nullptr, std::memory_order_relaxed);
+        handle->missing_.store(false, std::memory_order_relaxed);
+    }
+    for (auto& module : modules_)
+    {
+        module.logger_.store(nullptr, std::memory_order_relaxed);
+    }
 }
 /*
 log:
 - name: test_log
 level: info
-pattern: "[%Y-%m-%d %H:%M:%S] [%l] %v"
+pattern: "%T %L [%f:%l] %m%E"
 file:
 enabled: true
 filename: "logs/app.log"
@@ -265,17 +921,146 @@ max_size: 1048576  # 1 MB
 max_files: 3
 console:
 enabled: true
+async:
+enabled: true
+queue_size: 8192
+overflow_policy: block   # block | drop | overwrite
+binary:
+enabled: true
+buffer_size: 1048576   # per thread
+file_path: "logs/app.bin"   # optional, decode with nazl_log_decode; without it records go to the sinks
+level: debug
 - name: test_log2
 level: debug
 */
 
+uint32_t FileSinkOptions::StringToFlushPolicy(const std::string& policy)
+{
+    uint32_t result = FlushExplicit;
+    std::stringstream ss(policy);
+    std::string item;
+    while (std::getline(ss, item, ','))
+    {
+        item.erase(std::remove_if(item.begin(), item.end(), ::isspace), item.end());
+        std::transform(item.begin(), item.end(), item.begin(), ::tolower);
+        if (item == "size")
+        {
+            result |= FlushOnSize;
+        }
+        else if (item == "interval")
+        {
+            result |= FlushOnInterval;
+        }
+        else if (item == "level" || item == "error")
+        {
+            result |= FlushOnLevel;
+        }
+    }
+    return result;
+}
+
+static const char* kLogConfigFile = "../conf/log_config.yml";
+
+// FileSinkOptions set in the config that MmapFileSink does not implement.
+static std::string mmapIgnoredOptions(const FileSinkOptions& options)
+{
+    FileSinkOptions defaults;
+    std::string ignored;
+    auto check = [&](bool set, const char* key)
+    {
+        if (set)
+        {
+            ignored += ignored.empty() ? key : std::string(", ") + key;
+        }
+    };
+    check(options.buffer_size_ != defaults.buffer_size_, "buffer_size");
+    check(options.flush_policy_ != defaults.flush_policy_, "flush_policy");
+    check(options.flush_size_ != defaults.flush_size_, "flush_size");
+    check(options.flush_interval_ms_ != defaults.flush_interval_ms_, "flush_interval_ms");
+    check(options.flush_level_ != defaults.flush_level_, "flush_level");
+    check(options.rotation_ != defaults.rotation_, "rotation");
+    check(options.rotate_interval_s_ != defaults.rotate_interval_s_, "rotate_interval_s");
+    check(options.max_age_s_ != defaults.max_age_s_, "max_age_s");
+    check(options.max_total_size_ != defaults.max_total_size_, "max_total_size");
+    check(options.index_lines_ != defaults.index_lines_ || options.index_bytes_ != defaults.index_bytes_, "index_lines/index_bytes");
+    return ignored;
+}
+
+// One logger per logger.<process>.modules.<module> section, registered under the module name for
+// NAZL_LOG_MODULE. A module with its own file_path or stdout gets its own sinks, otherwise it writes
+// to the process sinks and its level is a threshold on top of theirs.
+static std::vector<std::string> initModuleLoggers(Nazl::Config& config, const std::string& baseKey,
+                                                  const std::shared_ptr<Logger>& processLogger)
+{
+    std::vector<std::string> modules;
+    auto prefix = baseKey + ".modules.";
+    for (auto& item : config.getItems())
+    {
+        if (item.first.compare(0, prefix.size(), prefix) != 0)
+        {
+            continue;
+        }
+        auto module = item.first.substr(prefix.size(), item.first.find('.', prefix.size()) - prefix.size());
+        if (!module.empty() && std::find(modules.begin(), modules.end(), module) == modules.end())
+        {
+            modules.push_back(module);
+        }
+    }
+    for (auto& module : modules)
+    {
+        auto moduleKey = prefix + module;
+        auto level = LogLevel(LogLevel::FromString(config.hasItem(moduleKey + ".level") ?
+                                                   config.getItem<std::string>(moduleKey + ".level")->getValue() : "INFO"));
+        auto format = std::make_shared<LogFormat>(config.hasItem(moduleKey + ".format") ?
+                                                  config.getItem<std::string>(moduleKey + ".format")->getValue() : "");
+        std::vector<std::shared_ptr<Sink>> sinks;
+        auto stdoutItem = config.hasItem(moduleKey + ".stdout") ? config.getItem<std::string>(moduleKey + ".stdout") : nullptr;
+        if (stdoutItem && stdoutItem->getValue() == "true")
+        {
+            auto sink = std::make_shared<StdoutSink>();
+            sink->SetName("stdout_sink");
+            sinks.emplace_back(sink);
+        }
+        if (config.hasItem(moduleKey + ".file_path"))
+        {
+            int max_size = config.hasItem(moduleKey + ".max_file_size") ?
+                           config.getItem<int>(moduleKey + ".max_file_size")->getValue() : 5 * 1024 * 1024;
+            int max_files = config.hasItem(moduleKey + ".max_files") ?
+                            config.getItem<int>(moduleKey + ".max_files")->getValue() : 5;
+            auto sink = std::make_shared<FileSink>(config.getItem<std::string>(moduleKey + ".file_path")->getValue(),
+                                                   max_size, max_files);
+            sink->SetName("file_sink");
+            sinks.emplace_back(sink);
+        }
+        std::shared_ptr<Logger> logger;
+        if (sinks.empty())
+        {
+            logger = std::make_shared<Logger>(module);
+            logger->SetParent(processLogger);
+        }
+        else
+        {
+            for (auto& sink : sinks)
+            {
+                sink->SetFormat(format);
+            }
+            logger = std::make_shared<Logger>(module, sinks.begin(), sinks.end());
+        }
+        logger->SetLevel(level);
+        logger_manager::GetInstance().RegisterLogger(logger);
+        std::cout << "module logger " << module << (sinks.empty() ? " through the process logger" : " with its own sinks")
+                  << ", level: " << level.GetLevelString() << std::endl;
+    }
+    return modules;
+}
+
 int32_t log_init(const std::string &name)
 {
     std::string log_level, log_pattern, file_path;
     int max_size = 0, max_files = 0;
     std::vector<std::shared_ptr<Sink>> sinks;
-    bool stdoutEnabled, fileSinkEnabled;
-    Nazl::Config config("../conf/log_config.yml");
+    bool stdoutEnabled = false, fileSinkEnabled = false;
+    Nazl::Config config(kLogConfigFile);
     if (!config.loadItemsFromYaml())
     {
         std::cerr << "Error loading configuration file." << std::endl;
@@ -309,8 +1094,15 @@ int32_t log_init(const std::string &name)
         {
             log_level = config.getItem<std::string>(baseKey + ".stdout_sink.level")->getValue();
             log_pattern = config.getItem<std::string>(baseKey + ".stdout_sink.format")->getValue();
-            auto sink = std::make_shared<StdoutSink>();
-            sink->SetLevel(LogLevel(stringToLevel(log_level)));
+            auto asyncItem = config.hasItem(baseKey + ".stdout_sink.async") ? config.getItem<std::string>(baseKey + ".stdout_sink.async") : nullptr;
+            std::size_t max_pending = StdoutSink::kDefaultMaxPending;
+            if (config.hasItem(baseKey + ".stdout_sink.max_pending"))
+            {
+                max_pending = config.getItem<int>(baseKey + ".stdout_sink.max_pending")->getValue();
+            }
+            auto sink = std::make_shared<StdoutSink>(asyncItem && asyncItem->getValue() == "true", max_pending);
+            sink->SetName("stdout_sink");
+            sink->SetLevel(LogLevel(LogLevel::FromString(log_level)));
             sink->SetFormat(std::make_shared<LogFormat>(log_pattern));
             sinks.emplace_back(sink);
         }
@@ -342,16 +1134,229 @@ int32_t log_init(const std::string &name)
             max_files = config.getItem<int>(baseKey + ".file_sink.max_files")->getValue();
             log_level = config.getItem<std::string>(baseKey + ".file_sink.level")->getValue();
             log_pattern = config.getItem<std::string>(baseKey + ".file_sink.format")->getValue();
-            auto sink = std::make_shared<FileSink>(file_path, max_size, max_files);
-            sink->SetLevel(LogLevel(stringToLevel(log_level)));
+            FileSinkOptions options;
+            if (config.hasItem(baseKey + ".file_sink.buffer_size"))
+            {
+                options.buffer_size_ = config.getItem<int>(baseKey + ".file_sink.buffer_size")->getValue();
+            }
+            if (config.hasItem(baseKey + ".file_sink.flush_policy"))
+            {
+                options.flush_policy_ = FileSinkOptions::StringToFlushPolicy(
+                    config.getItem<std::string>(baseKey + ".file_sink.flush_policy")->getValue());
+            }
+            if (config.hasItem(baseKey + ".file_sink.flush_size"))
+            {
+                options.flush_size_ = config.getItem<int>(baseKey + ".file_sink.flush_size")->getValue();
+            }
+            if (config.hasItem(baseKey + ".file_sink.flush_interval_ms"))
+            {
+                options.flush_interval_ms_ = config.getItem<int>(baseKey + ".file_sink.flush_interval_ms")->getValue();
+            }
+            if (config.hasItem(baseKey + ".file_sink.flush_level"))
+            {
+                options.flush_level_ = LogLevel::FromString(config.getItem<std::string>(baseKey + ".file_sink.flush_level")->getValue());
+            }
+            if (config.hasItem(baseKey + ".file_sink.compression"))
+            {
+                options.compression_ = LogRotator::StringToCompression(
+                    config.getItem<std::string>(baseKey + ".file_sink.compression")->getValue());
+                if (!LogRotator::IsSupported(options.compression_))
+                {
+                    std::cerr << "log compression not built in, rotated files stay uncompressed." << std::endl;
+                }
+            }
+            if (config.hasItem(baseKey + ".file_sink.rotation"))
+            {
+                std::string rotation = config.getItem<std::string>(baseKey + ".file_sink.rotation")->getValue();
+                options.rotation_ = (rotation == "indexed") ? FileSinkOptions::Rotation::Indexed :
+                                                              FileSinkOptions::Rotation::Cascade;
+            }
+            if (config.hasItem(baseKey + ".file_sink.rotate_interval_s"))
+            {
+                options.rotate_interval_s_ = config.getItem<int>(baseKey + ".file_sink.rotate_interval_s")->getValue();
+            }
+            if (config.hasItem(baseKey + ".file_sink.max_age_s"))
+            {
+                options.max_age_s_ = config.getItem<int>(baseKey + ".file_sink.max_age_s")->getValue();
+            }
+            if (config.hasItem(baseKey + ".file_sink.index_lines"))
+            {
+                options.index_lines_ = config.getItem<int>(baseKey + ".file_sink.index_lines")->getValue();
+            }
+            if (config.hasItem(baseKey + ".file_sink.index_bytes"))
+            {
+                options.index_bytes_ = config.getItem<int>(baseKey + ".file_sink.index_bytes")->getValue();
+            }
+            if (config.hasItem(baseKey + ".file_sink.max_total_size"))
+            {
+                options.max_total_size_ = config.getItem<int>(baseKey + ".file_sink.max_total_size")->getValue();
+            }
+            std::shared_ptr<Sink> sink;
+            auto mmapItem = config.hasItem(baseKey + ".file_sink.mmap") ? config.getItem<std::string>(baseKey + ".file_sink.mmap") : nullptr;
+            if (mmapItem && mmapItem->getValue() == "true")
+            {
+                std::size_t segment_size = MmapFileSink::kDefaultSegmentSize;
+                if (config.hasItem(baseKey + ".file_sink.mmap_segment_size"))
+                {
+                    segment_size = config.getItem<int>(baseKey + ".file_sink.mmap_segment_size")->getValue();
+                }
+                auto ignored = mmapIgnoredOptions(options);
+                if (!ignored.empty())
+                {
+                    std::cerr << "file_sink.mmap: " << ignored << " not supported, ignored (cascade rotation on size, "
+                              << "msync on flush, no index)." << std::endl;
+                }
+                sink = std::make_shared<MmapFileSink>(file_path, max_size, max_files, segment_size, options.compression_);
+            }
+            else
+            {
+                sink = std::make_shared<FileSink>(file_path, max_size, max_files, options);
+            }
+            sink->SetLevel(LogLevel(LogLevel::FromString(log_level)));
             sink->SetFormat(std::make_shared<LogFormat>(log_pattern));
+            sink->SetName("file_sink");
             sinks.emplace_back(sink);
         }
     }
+    auto recorderItem = config.hasItem(baseKey + ".flight_recorder.enabled") ? config.getItem<std::string>(baseKey + ".flight_recorder.enabled") : nullptr;
+    if (recorderItem && recorderItem->getValue() == "true")
+    {
+        uint32_t threads = FlightRecorderSink::kDefaultThreads;
+        uint32_t records = FlightRecorderSink::kDefaultRecords;
+        if (config.hasItem(baseKey + ".flight_recorder.threads"))
+        {
+            threads = config.getItem<int>(baseKey + ".flight_recorder.threads")->getValue();
+        }
+        if (config.hasItem(baseKey + ".flight_recorder.records_per_thread"))
+        {
+            records = config.getItem<int>(baseKey + ".flight_recorder.records_per_thread")->getValue();
+        }
+        auto sink = std::make_shared<FlightRecorderSink>(
+            config.getItem<std::string>(baseKey + ".flight_recorder.file_path")->getValue(), threads, records);
+        sink->SetName("flight_recorder");
+        if (config.hasItem(baseKey + ".flight_recorder.level"))
+        {
+            sink->SetLevel(LogLevel(LogLevel::FromString(config.getItem<std::string>(baseKey + ".flight_recorder.level")->getValue())));
+        }
+        auto crashItem = config.hasItem(baseKey + ".flight_recorder.crash_handler") ? config.getItem<std::string>(baseKey + ".flight_recorder.crash_handler") : nullptr;
+        if (crashItem && crashItem->getValue() == "true")
+        {
+            sink->InstallCrashHandler();
+        }
+        std::cout << "flight recorder enabled." << std::endl;
+        sinks.emplace_back(sink);
+    }
+    auto shmItem = config.hasItem(baseKey + ".shm_sink.enabled") ? config.getItem<std::string>(baseKey + ".shm_sink.enabled") : nullptr;
+    if (shmItem && shmItem->getValue() == "true")
+    {
+        std::size_t capacity = ShmRing::kDefaultCapacity;
+        if (config.hasItem(baseKey + ".shm_sink.size"))
+        {
+            capacity = config.getItem<int>(baseKey + ".shm_sink.size")->getValue();
+        }
+        std::string ring = config.hasItem(baseKey + ".shm_sink.name") ?
+                           config.getItem<std::string>(baseKey + ".shm_sink.name")->getValue() : name;
+        auto sink = std::make_shared<SharedMemorySink>(ring, capacity);
+        sink->SetName("shm_sink");
+        if (config.hasItem(baseKey + ".shm_sink.level"))
+        {
+            sink->SetLevel(LogLevel(LogLevel::FromString(config.getItem<std::string>(baseKey + ".shm_sink.level")->getValue())));
+        }
+        if (config.hasItem(baseKey + ".shm_sink.format"))
+        {
+            sink->SetFormat(std::make_shared<LogFormat>(config.getItem<std::string>(baseKey + ".shm_sink.format")->getValue()));
+        }
+        std::cout << "shared memory sink enabled, ring: " << ring << std::endl;
+        sinks.emplace_back(sink);
+    }
+    auto socketItem = config.hasItem(baseKey + ".socket_sink.enabled") ? config.getItem<std::string>(baseKey + ".socket_sink.enabled") : nullptr;
+    if (socketItem && socketItem->getValue() == "true")
+    {
+        auto type = SocketSink::Type::Datagram;
+        std::size_t max_pending = SocketSink::kDefaultMaxPending;
+        if (config.hasItem(baseKey + ".socket_sink.type"))
+        {
+            type = SocketSink::StringToType(config.getItem<std::string>(baseKey + ".socket_sink.type")->getValue());
+        }
+        if (config.hasItem(baseKey + ".socket_sink.max_pending"))
+        {
+            max_pending = config.getItem<int>(baseKey + ".socket_sink.max_pending")->getValue();
+        }
+        auto path = config.getItem<std::string>(baseKey + ".socket_sink.path")->getValue();
+        auto sink = std::make_shared<SocketSink>(path, type, max_pending);
+        sink->SetName("socket_sink");
+        if (config.hasItem(baseKey + ".socket_sink.level"))
+        {
+            sink->SetLevel(LogLevel(LogLevel::FromString(config.getItem<std::string>(baseKey + ".socket_sink.level")->getValue())));
+        }
+        if (config.hasItem(baseKey + ".socket_sink.format"))
+        {
+            sink->SetFormat(std::make_shared<LogFormat>(config.getItem<std::string>(baseKey + ".socket_sink.format")->getValue()));
+        }
+        std::cout << "socket sink enabled, path: " << path << std::endl;
+        sinks.emplace_back(sink);
+    }
     std::cout << "sinks.size(): " << sinks.size() << std::endl;
-    std::shared_ptr<Logger> logger = std::make_shared<Logger>("default", sinks.begin(), sinks.end());
+    std::shared_ptr<Logger> logger;
+    auto asyncItem = config.hasItem(baseKey + ".async.enabled") ? config.getItem<std::string>(baseKey + ".async.enabled") : nullptr;
+    if (asyncItem && asyncItem->getValue() == "true")
+    {
+        std::size_t queue_size = AsyncLogger::kDefaultQueueSize;
+        auto policy = AsyncLogger::OverflowPolicy::Block;
+        if (config.hasItem(baseKey + ".async.queue_size"))
+        {
+            queue_size = config.getItem<int>(baseKey + ".async.queue_size")->getValue();
+        }
+        if (config.hasItem(baseKey + ".async.overflow_policy"))
+        {
+            policy = AsyncLogger::StringToPolicy(config.getItem<std::string>(baseKey + ".async.overflow_policy")->getValue());
+        }
+        std::cout << "async logger enabled, queue_size: " << queue_size << std::endl;
+        logger = std::make_shared<AsyncLogger>("default", sinks.begin(), sinks.end(), queue_size, policy);
+    }
+    else
+    {
+        logger = std::make_shared<Logger>("default", sinks.begin(), sinks.end());
+    }
     LogManager& logManager = logger_manager::GetInstance();
     logManager.RegisterLogger(logger);
+    auto modules = initModuleLoggers(config, baseKey, logger);
+    auto reloadItem = config.hasItem(baseKey + ".hot_reload") ? config.getItem<std::string>(baseKey + ".hot_reload") : nullptr;
+    if (reloadItem && reloadItem->getValue() == "true")
+    {
+        auto& watcher = log_config_watcher::GetInstance();
+        watcher.Bind(name, logger->GetName());
+        for (auto& module : modules)
+        {
+            watcher.Bind(name + ".modules." + module, module);
+        }
+        if (watcher.Start(kLogConfigFile))
+        {
+            std::cout << "watching " << kLogConfigFile << " for level changes." << std::endl;
+        }
+    }
+    auto binaryItem = config.hasItem(baseKey + ".binary.enabled") ? config.getItem<std::string>(baseKey + ".binary.enabled") : nullptr;
+    if (binaryItem && binaryItem->getValue() == "true")
+    {
+        std::size_t buffer_size = BinaryLog::BinaryLogManager::kDefaultBufferSize;
+        if (config.hasItem(baseKey + ".binary.buffer_size"))
+        {
+            buffer_size = config.getItem<int>(baseKey + ".binary.buffer_size")->getValue();
+        }
+        auto& binaryManager = BinaryLog::binary_log_manager::GetInstance();
+        if (config.hasItem(baseKey + ".binary.file_path"))
+        {
+            std::string level = config.hasItem(baseKey + ".binary.level") ?
+                                config.getItem<std::string>(baseKey + ".binary.level")->getValue() : "DEBUG";
+            binaryManager.Start(config.getItem<std::string>(baseKey + ".binary.file_path")->getValue(),
+                                LogLevel(LogLevel::FromString(level)), buffer_size);
+        }
+        else
+        {
+            binaryManager.Start(logger, buffer_size);
+        }
+        std::cout << "binary logging enabled." << std::endl;
+    }
     LOG_INFO("Logger %s initialized,file_sink:%s, stdout:%s", name.c_str(), fileSinkEnabled ? "true" : "false", stdoutEnabled ? "true" : "false");
     return 0;
 }
@@ -3,19 +3,44 @@
 
 #include <string.h>
 #include <stdint.h>
+#include <iostream>
 #include <sstream>
 #include <fstream>
 #include <vector>
+#include <chrono>
 #include <ctime>
 #include <iomanip>
+#include <array>
+#include <string_view>
+#include <algorithm>
+#include <type_traits>
 #include <fmt/core.h>
+#include <fmt/format.h>
 #include <fmt/printf.h>
+#include <fmt/compile.h>
 #include <mutex>
+#include <condition_variable>
 #include <thread>
+#include <atomic>
 #include <unordered_map>
+#include <unistd.h>
 #include "file_ops.h"
+#include "file_writer.h"
+#include "log_rotator.h"
 #include "singleton.h"
 //Timestamp Level EOL Func Line Thread_name Thread_id message
+
+// Compile-time threshold: calls below NAZL_LOG_ACTIVE_LEVEL compile to nothing.
+#define NAZL_LOG_LEVEL_DEBUG 0
+#define NAZL_LOG_LEVEL_INFO 1
+#define NAZL_LOG_LEVEL_WARN 2
+#define NAZL_LOG_LEVEL_ERROR 3
+#define NAZL_LOG_LEVEL_FATAL 4
+#define NAZL_LOG_LEVEL_OFF 5
+#ifndef NAZL_LOG_ACTIVE_LEVEL
+#define NAZL_LOG_ACTIVE_LEVEL NAZL_LOG_LEVEL_DEBUG
+#endif
+
 class LogLevel
 {
 public:
@@ -34,6 +59,26 @@ public:
     }
 
     std::string GetLevelString();
+    // "debug", "INFO", "warn"/"warning", ...; unknown names map to Debug.
+    static LevelEnum FromString(const std::string& level);
+    static constexpr std::string_view ToString(LevelEnum level)
+    {
+        switch (level)
+        {
+        case LevelEnum::Debug:
+            return "DEBUG";
+        case LevelEnum::Info:
+            return "INFO";
+        case LevelEnum::Warn:
+            return "WARNING";
+        case LevelEnum::Error:
+            return "ERROR";
+        case LevelEnum::Fatal:
+            return "FATAL";
+        default:
+            return "UNKNOWN";
+        }
+    }
 
     void SetLevel(LevelEnum level)
     {
@@ -44,25 +89,98 @@ private:
 };
 
 
+// Identity of a thread as the formatter prints it: kernel tid and name, both pre-rendered.
+// Captured on the thread's first log call (again in a forked child), from Nazl::Thread when the
+// thread is one, otherwise from gettid() and pthread_getname_np(). Each thread keeps one in
+// thread-local storage and events copy it, so nothing outlives the thread or needs freeing.
+struct LogThreadContext
+{
+    static constexpr std::size_t kNameSize = 16;
+    uint32_t tid_{0};
+    uint8_t nameLen_{0};
+    uint8_t tidTextLen_{0};
+    char name_[kNameSize]{};
+    char tidText_[12]{};
+
+    std::string_view GetName() const
+    {
+        return std::string_view(name_, nameLen_);
+    }
+    std::string_view GetTidText() const
+    {
+        return std::string_view(tidText_, tidTextLen_);
+    }
+    // Identity given by the caller, for events that were not captured on their thread.
+    void Set(uint32_t tid, std::string_view name);
+    static const LogThreadContext* Current()
+    {
+        static thread_local LogThreadContext context;
+        static thread_local uint32_t generation = 0;
+        uint32_t current = forkGeneration_.load(std::memory_order_relaxed);
+        if (context.tid_ == 0 || generation != current)
+        {
+            context.Capture();
+            generation = current;
+        }
+        return &context;
+    }
+    // Bumped in the child after every fork().
+    static std::atomic<uint32_t> forkGeneration_;
+private:
+    void Capture();
+};
+
+// Captured log record. Source location points at static strings (__FILE__, __FUNCTION__),
+// the thread identity and the formatted message live inline, so capturing a message shorter than
+// kInlineMessageSize does no heap allocation. Events are moved, never shared.
 class LogEvent
 {
 public:
-    LogEvent(const std::string& fileName, const std::string& funcName, const std::string& threadName,
-             int32_t line, uint32_t threadId, uint64_t timestamp, LogLevel level, const std::string& message)
-        : fileName_(fileName), funcName_(funcName), threadName_(threadName), line_(line), threadId_(threadId),
-          timestamp_(timestamp), level_(level), message_(message) {}
+    static constexpr std::size_t kInlineMessageSize = 256;
+    static constexpr std::size_t kThreadNameSize = LogThreadContext::kNameSize;
+    using MessageBuffer = fmt::basic_memory_buffer<char, kInlineMessageSize>;
+
+    LogEvent() = default;
+    LogEvent(const char* fileName, const char* funcName, std::string_view threadName,
+             int32_t line, uint32_t threadId, uint64_t timestamp, LogLevel level, std::string_view message = {})
+        : fileName_(fileName), funcName_(funcName), line_(line), timestamp_(timestamp), level_(level)
+    {
+        thread_.Set(threadId, threadName);
+        message_.append(message.data(), message.data() + message.size());
+    }
+    // Events captured on the calling thread: the pre-rendered identity is copied as is.
+    LogEvent(const char* fileName, const char* funcName, const LogThreadContext* thread,
+             int32_t line, uint64_t timestamp, LogLevel level, std::string_view message = {})
+        : fileName_(fileName), funcName_(funcName), thread_(*thread), line_(line),
+          timestamp_(timestamp), level_(level)
+    {
+        message_.append(message.data(), message.data() + message.size());
+    }
+    LogEvent(LogEvent&&) = default;
+    LogEvent& operator=(LogEvent&&) = default;
     ~LogEvent() = default;
-    const std::string GetFile() const
+    // Capture time: nanoseconds since the epoch (CLOCK_REALTIME).
+    static uint64_t Now()
+    {
+        struct timespec ts;
+        ::clock_gettime(CLOCK_REALTIME, &ts);
+        return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+    }
+    std::string_view GetFile() const
     {
         return fileName_;
     }
-    const std::string GetFunc() const
+    std::string_view GetFunc() const
     {
         return funcName_;
     }
-    const std::string GetThreadName() const
+    std::string_view GetThreadName() const
+    {
+        return thread_.GetName();
+    }
+    std::string_view GetThreadIdText() const
     {
-        return threadName_;
+        return thread_.GetTidText();
     }
     int32_t GetLine() const
     {
@@ -70,172 +188,494 @@ public:
     }
     uint32_t GetThreadId() const
     {
-        return threadId_;
+        return thread_.tid_;
     }
     uint64_t GetTimestamp() const
     {
         return timestamp_;
     }
-    std::string GetMessage() const
+    std::string_view GetMessage() const
+    {
+        return std::string_view(message_.data(), HasFields() ? message_len_ : message_.size());
+    }
+    // The message is formatted straight into this buffer, structured fields are appended after it.
+    MessageBuffer& GetMessageBuffer()
     {
         return message_;
     }
+    // Ends the message; whatever is appended to the buffer from now on is the encoded field list.
+    void BeginFields()
+    {
+        message_len_ = static_cast<uint32_t>(message_.size());
+    }
+    bool HasFields() const
+    {
+        return message_len_ != kNoFields;
+    }
+    // Encoded fields, read them with LogFieldReader.
+    std::string_view GetFields() const
+    {
+        return HasFields() ? std::string_view(message_.data() + message_len_, message_.size() - message_len_)
+                           : std::string_view();
+    }
     LogLevel GetLevel() const
     {
         return level_;
     }
 private:
-    std::string fileName_;
-    std::string funcName_;
-    std::string threadName_;
-    int32_t line_;
-    uint32_t threadId_;
-    uint64_t timestamp_;
+    const char* fileName_{""};
+    const char* funcName_{""};
+    LogThreadContext thread_;
+    int32_t line_{0};
+    uint64_t timestamp_{0};
     LogLevel level_;
-    std::string message_;
+    static constexpr uint32_t kNoFields = UINT32_MAX;
+    uint32_t message_len_{kNoFields};
+    MessageBuffer message_;
 };
-class FlagFormatter
+
+// Structured fields are stored in the event buffer as
+// [u8 key length][key][u8 LogFieldType][value], value being 8 bytes for Int/UInt/Double,
+// 1 byte for Bool and [u32 length][bytes] for String, all in host byte order.
+enum class LogFieldType : uint8_t
 {
-public:
-    FlagFormatter() = default;
-    virtual ~FlagFormatter() = default;
-    virtual void Format(std::ostream& os, std::shared_ptr<LogEvent> event) = 0;
+    Int,
+    UInt,
+    Double,
+    Bool,
+    String
 };
-class StringFlagFormatter : public FlagFormatter
+struct LogField
 {
-public:
-    StringFlagFormatter() = default;
-    void Format(std::ostream& os, std::shared_ptr<LogEvent> event)
+    std::string_view key_;
+    LogFieldType type_;
+    union
     {
-        os << event->GetMessage();
-    }
+        int64_t int_;
+        uint64_t uint_;
+        double double_;
+        bool bool_;
+    };
+    std::string_view string_;
 };
-class TimeFlagFormatter : public FlagFormatter
+class LogFieldReader
 {
 public:
-    TimeFlagFormatter(const std::string& format = "%Y-%m-%d %H:%M:%S")
-        : time_format_(format) {};
-    void Format(std::ostream& os, std::shared_ptr<LogEvent> event)
+    explicit LogFieldReader(std::string_view fields) : pos_(fields.data()), end_(fields.data() + fields.size()) {}
+    bool Next(LogField& field)
     {
-        std::time_t t = std::time(nullptr);
-        std::tm localTime;
-        localtime_r(&t, &localTime);
-        char buf[64];
-        strftime(buf, sizeof(buf), time_format_.c_str(), &localTime);
-        os << buf << " ";
+        if (end_ - pos_ < 2)
+        {
+            return false;
+        }
+        auto key_len = static_cast<uint8_t>(*pos_++);
+        if (end_ - pos_ < key_len + 1)
+        {
+            return false;
+        }
+        field.key_ = std::string_view(pos_, key_len);
+        pos_ += key_len;
+        field.type_ = static_cast<LogFieldType>(*pos_++);
+        std::size_t size = field.type_ == LogFieldType::Bool ? 1 : (field.type_ == LogFieldType::String ? 4 : 8);
+        if (static_cast<std::size_t>(end_ - pos_) < size)
+        {
+            return false;
+        }
+        switch (field.type_)
+        {
+        case LogFieldType::Bool:
+            field.bool_ = *pos_ != 0;
+            break;
+        case LogFieldType::String:
+        {
+            uint32_t len;
+            memcpy(&len, pos_, sizeof(len));
+            if (static_cast<std::size_t>(end_ - pos_) < size + len)
+            {
+                return false;
+            }
+            field.string_ = std::string_view(pos_ + size, len);
+            size += len;
+            break;
+        }
+        default:
+            memcpy(&field.uint_, pos_, 8);
+            break;
+        }
+        pos_ += size;
+        return true;
     }
 private:
-    std::string time_format_;
+    const char* pos_;
+    const char* end_;
 };
-class LevelFlagFormatter : public FlagFormatter
+
+template<typename T>
+inline void AppendLogFieldRaw(LogEvent::MessageBuffer& out, const T& value)
 {
-public:
-    LevelFlagFormatter() = default;
-    void Format(std::ostream& os, std::shared_ptr<LogEvent> event)
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    out.append(bytes, bytes + sizeof(T));
+}
+
+template<typename T>
+void AppendLogField(LogEvent::MessageBuffer& out, std::string_view key, const T& value)
+{
+    key = key.substr(0, 255);
+    out.push_back(static_cast<char>(key.size()));
+    out.append(key.data(), key.data() + key.size());
+    if constexpr (std::is_same_v<T, bool>)
     {
-        os << event->GetLevel().GetLevelString() << " ";
+        out.push_back(static_cast<char>(LogFieldType::Bool));
+        out.push_back(value ? 1 : 0);
     }
-};
-class EOLFlagFormatter : public FlagFormatter
-{
-public:
-    EOLFlagFormatter() = default;
-    void Format(std::ostream& os, std::shared_ptr<LogEvent> event)
+    else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>)
+    {
+        out.push_back(static_cast<char>(LogFieldType::Int));
+        AppendLogFieldRaw(out, static_cast<int64_t>(value));
+    }
+    else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>)
+    {
+        out.push_back(static_cast<char>(LogFieldType::UInt));
+        AppendLogFieldRaw(out, static_cast<uint64_t>(value));
+    }
+    else if constexpr (std::is_floating_point_v<T>)
     {
-        os << std::endl;
+        out.push_back(static_cast<char>(LogFieldType::Double));
+        AppendLogFieldRaw(out, static_cast<double>(value));
     }
+    else
+    {
+        static_assert(std::is_convertible_v<const T&, std::string_view>, "unsupported log field type");
+        std::string_view text(value);
+        out.push_back(static_cast<char>(LogFieldType::String));
+        AppendLogFieldRaw(out, static_cast<uint32_t>(text.size()));
+        out.append(text.data(), text.data() + text.size());
+    }
+}
+
+inline void AppendLogFields(LogEvent::MessageBuffer&) {}
+template<typename K, typename V, typename... Rest>
+void AppendLogFields(LogEvent::MessageBuffer& out, const K& key, const V& value, const Rest&... rest)
+{
+    AppendLogField(out, std::string_view(key), value);
+    AppendLogFields(out, rest...);
+}
+enum class PatternOp : uint8_t
+{
+    Literal,
+    Time,
+    TimeMillis,
+    TimeMicros,
+    Level,
+    Func,
+    Line,
+    ThreadId,
+    ThreadName,
+    Message,
+    EndOfLine
 };
-class FuncFlagFormatter : public FlagFormatter
+// One step of a compiled pattern, literals are slices [offset_, offset_ + len_) of the pattern text.
+struct PatternInstr
 {
-public:
-    FuncFlagFormatter() = default;
-    void Format(std::ostream& os, std::shared_ptr<LogEvent> event)
+    PatternOp op_{PatternOp::Literal};
+    uint32_t offset_{0};
+    uint32_t len_{0};
+};
+
+constexpr bool PatternFlagToOp(char flag, PatternOp& op)
+{
+    switch (flag)
     {
-        os << "[" << event->GetFunc() << ":";
+    case 'T':
+        op = PatternOp::Time;
+        return true;
+    case 'e':
+        op = PatternOp::TimeMillis;
+        return true;
+    case 'u':
+        op = PatternOp::TimeMicros;
+        return true;
+    case 'L':
+        op = PatternOp::Level;
+        return true;
+    case 'f':
+        op = PatternOp::Func;
+        return true;
+    case 'l':
+        op = PatternOp::Line;
+        return true;
+    case 'N':
+        op = PatternOp::ThreadId;
+        return true;
+    case 't':
+        op = PatternOp::ThreadName;
+        return true;
+    case 'm':
+        op = PatternOp::Message;
+        return true;
+    case 'E':
+        op = PatternOp::EndOfLine;
+        return true;
+    default:
+        return false;
     }
-};
-class LineFlagFormatter : public FlagFormatter
+}
+
+// Shared by the runtime and the constexpr parser. Adjacent literal characters are merged
+// into one instruction, "%%" is a literal percent and unknown flags are kept as text.
+template<typename Out>
+constexpr void ParsePatternInto(std::string_view pattern, Out& out)
 {
-public:
-    LineFlagFormatter() = default;
-    void Format(std::ostream& os, std::shared_ptr<LogEvent> event)
+    for (std::size_t i = 0; i < pattern.size(); ++i)
     {
-        os << event->GetLine() << "] ";
+        if (pattern[i] == '%' && i + 1 < pattern.size())
+        {
+            PatternOp op = PatternOp::Literal;
+            if (PatternFlagToOp(pattern[i + 1], op))
+            {
+                out.Push(PatternInstr{op, 0, 0});
+                ++i;
+                continue;
+            }
+            if (pattern[i + 1] == '%')
+            {
+                ++i;
+            }
+        }
+        out.Push(PatternInstr{PatternOp::Literal, static_cast<uint32_t>(i), 1});
     }
-};
-class TidFlagFormatter : public FlagFormatter
+}
+
+template<std::size_t N>
+struct CompiledPattern
 {
-public:
-    TidFlagFormatter() = default;
-    void Format(std::ostream& os, std::shared_ptr<LogEvent> event)
+    std::array<PatternInstr, N> instrs_{};
+    std::size_t count_{0};
+    std::string_view text_;
+
+    constexpr void Push(PatternInstr instr)
     {
-        os << std::this_thread::get_id() << " ";
+        if (instr.op_ == PatternOp::Literal && count_ > 0)
+        {
+            PatternInstr& last = instrs_[count_ - 1];
+            if (last.op_ == PatternOp::Literal && last.offset_ + last.len_ == instr.offset_)
+            {
+                last.len_ += instr.len_;
+                return;
+            }
+        }
+        instrs_[count_++] = instr;
     }
 };
 
+// Parse a pattern literal at compile time:
+//   static constexpr auto kPattern = CompilePattern("%T %L [%f:%l] %m%E");
+//   auto format = std::make_shared<LogFormat>(kPattern);
+template<std::size_t L>
+constexpr CompiledPattern<L> CompilePattern(const char (&pattern)[L])
+{
+    CompiledPattern<L> compiled;
+    compiled.text_ = std::string_view(pattern, L - 1);
+    ParsePatternInto(compiled.text_, compiled);
+    return compiled;
+}
+
+// Pattern flags: %T time, %e time with milliseconds, %u time with microseconds,
+// %L level, %f function, %l line, %N kernel thread id, %t thread name, %m message, %E end of line,
+// %% percent.
+// Everything else is copied literally.
+// Renders events as pattern text, or as one of two structured encodings chosen by passing
+// "json" or "binary" instead of a pattern:
+//   json   one object per line: ts, level, file, line, func, thread, msg, then the fields
+//   binary [u32 record size][u64 ts ns][u8 level][i32 line][u16 len][file][u16 len][func]
+//          [u8 len][thread][u32 len][msg][u32 len][encoded fields], host byte order
+// In pattern text %m is followed by " key=value" for each field, logfmt style: a string value with a
+// space, '=', '"' or control character (or an empty one) is quoted. In json a NaN or infinite
+// double is null.
 class LogFormat
 {
 public:
+    static constexpr const char* kDefaultPattern = "%T %L [%f:%l] %N %m%E";
+    enum class Output
+    {
+        Pattern,
+        Json,
+        Binary
+    };
+
     LogFormat(std::string pattern = "");
+    template<std::size_t N>
+    explicit LogFormat(const CompiledPattern<N>& compiled)
+        : pattern_(compiled.text_), instrs_(compiled.instrs_.begin(), compiled.instrs_.begin() + compiled.count_) {}
     ~LogFormat() = default;
-    std::string Format(std::shared_ptr<LogEvent> event);
-    void Format(std::ostream &os, std::shared_ptr<LogEvent> event);
+    // Appends the rendered line to out: no allocation beyond growing out, no virtual calls.
+    void Format(fmt::memory_buffer& out, const LogEvent& event) const;
+    std::string Format(const LogEvent& event);
+    void Format(std::ostream &os, const LogEvent& event);
+    const std::string& GetPattern() const
+    {
+        return pattern_;
+    }
+    Output GetOutput() const
+    {
+        return output_;
+    }
 private:
-    void ParsePattern();
+    void Push(PatternInstr instr);
+    void FormatJson(fmt::memory_buffer& out, const LogEvent& event) const;
+    void FormatBinary(fmt::memory_buffer& out, const LogEvent& event) const;
+    friend constexpr void ParsePatternInto<LogFormat>(std::string_view pattern, LogFormat& out);
 private:
     std::string pattern_;
-    std::vector<std::unique_ptr<FlagFormatter>> formate_flag_;
+    std::vector<PatternInstr> instrs_;
+    Output output_{Output::Pattern};
 };
 
 class Sink
 {
 public:
-    Sink() = default;
+    Sink() : format_(std::make_shared<LogFormat>()) {}
     virtual ~Sink() = default;
     virtual void Flush() = 0;
-    virtual void Log(std::shared_ptr<LogEvent> event) = 0;
+    virtual void Log(const LogEvent& event) = 0;
     virtual void SetFormat(std::shared_ptr<LogFormat> format) = 0;
+    // Only the sink's own filter: the loggers using it keep their cached minimum level, so lowering
+    // it lets nothing more through until they refresh (Logger::RefreshLevel, LogManager::RefreshLevels).
+    // LogManager::SetSinkLevel does both.
     virtual void SetLevel(LogLevel log_level) = 0;
     virtual LogLevel GetLevel() = 0;
+    // The sink's key in log_config.yml ("stdout_sink", "file_sink", ...), how runtime level
+    // changes address it. Set before the sink is shared.
+    const std::string& GetName() const
+    {
+        return name_;
+    }
+    void SetName(const std::string& name)
+    {
+        name_ = name;
+    }
 protected:
     LogLevel level_;
     std::shared_ptr<LogFormat> format_;
+    std::string name_;
 };
+// Synchronous by default: every event is written to fd before Log() returns.
+// In async mode Log() only appends the formatted event to a pending buffer and a "log-stdout"
+// thread writes each batch with one write(2), so a slow console stalls that thread rather than
+// the callers. While max_pending bytes are waiting, new events are dropped and summarized.
 class StdoutSink : public Sink
 {
 public:
-    StdoutSink() = default;
-    ~StdoutSink() = default;
+    static constexpr std::size_t kDefaultMaxPending = 1024 * 1024;
+
+    explicit StdoutSink(bool async = false, std::size_t max_pending = kDefaultMaxPending, int fd = STDOUT_FILENO);
+    ~StdoutSink() override;
     StdoutSink(const StdoutSink&) = delete;
     StdoutSink& operator=(const StdoutSink&) = delete;
-    void Log(std::shared_ptr<LogEvent> event) override;
+    void Log(const LogEvent& event) override;
+    // Async mode: blocks until everything logged before the call has been written.
     void Flush() override;
     void SetFormat(std::shared_ptr<LogFormat> format) override;
     void SetLevel(LogLevel log_level) override;
     LogLevel GetLevel() override;
+    bool IsAsync() const
+    {
+        return writer_ != nullptr;
+    }
+    uint64_t GetDroppedCount() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+private:
+    void WriterLoop();
+    void WriteAll(const char* data, std::size_t size);
 private:
     std::mutex mutex_;
+    fmt::memory_buffer buffer_;   // sync: scratch for one event, async: bytes waiting for the writer
+    int fd_;
+    std::size_t max_pending_;
+    bool running_{true};
+    uint64_t appended_{0};
+    uint64_t written_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::condition_variable writer_cond_;
+    std::condition_variable flushed_cond_;
+    std::unique_ptr<Nazl::Thread> writer_;
+};
+class LogIndexWriter;
+struct FileSinkOptions
+{
+    // Bit mask. The writer always writes out when its buffer is full, and on Flush().
+    enum FlushPolicy : uint32_t
+    {
+        FlushExplicit = 0,
+        FlushOnSize = 1 << 0,      // once flush_size_ bytes are buffered
+        FlushOnInterval = 1 << 1,  // once the oldest buffered event is flush_interval_ms_ old
+        FlushOnLevel = 1 << 2      // after an event at flush_level_ or above
+    };
+    std::size_t buffer_size_{Nazl::FileWriter::kDefaultBufferSize};
+    std::size_t flush_size_{64 * 1024};
+    uint32_t flush_policy_{FlushOnInterval | FlushOnLevel};
+    uint32_t flush_interval_ms_{1000};
+    LogLevel::LevelEnum flush_level_{LogLevel::LevelEnum::Error};
+    // applied to rotated segments by the background rotator
+    LogRotator::Compression compression_{LogRotator::Compression::None};
+    enum class Rotation
+    {
+        Cascade,    // app.log.1 .. app.log.<max_files>
+        Indexed     // app.log.YYYYMMDD-HH.NNNN plus app.log.manifest, no renames of old segments
+    };
+    Rotation rotation_{Rotation::Cascade};
+    // also rotate at every multiple of this many seconds since the epoch, 0: size only
+    uint32_t rotate_interval_s_{0};
+    // indexed rotation only, max_files is the third limit (0: unlimited; cascade rotation keeps 10)
+    uint64_t max_age_s_{0};
+    uint64_t max_total_size_{0};
+    // sparse time index (<file>.idx): one entry per index_lines_ events or index_bytes_ bytes,
+    // whichever comes first, 0 for no limit; both 0: no index
+    std::size_t index_lines_{0};
+    std::size_t index_bytes_{0};
+    // "size,interval,error" style list, "explicit" or "" for none.
+    static uint32_t StringToFlushPolicy(const std::string& policy);
 };
 class FileSink : public Sink
 {
 public:
-    explicit FileSink(const std::string &file_name, std::size_t max_size, std::size_t max_files, Nazl::FileOps&& file_ops = Nazl::FileOps());
-    ~FileSink() = default;
-    void Log(std::shared_ptr<LogEvent> event) override;
+    // After a failed rotation (rename refused) the next attempt waits, doubling up to the max.
+    static constexpr std::chrono::milliseconds kRotateRetryMin{1000};
+    static constexpr std::chrono::milliseconds kRotateRetryMax{60000};
+    explicit FileSink(const std::string &file_name, std::size_t max_size, std::size_t max_files,
+                      const FileSinkOptions& options = FileSinkOptions());
+    ~FileSink() override;
+    void Log(const LogEvent& event) override;
     void Flush() override;
     void SetFormat(std::shared_ptr<LogFormat> format) override;
     void SetLevel(LogLevel log_level) override;
     LogLevel GetLevel() override;
 private:
-    void Rotate();
-    bool RenameFile(const std::string& src, const std::string& dst);
+    void Rotate(uint64_t now_ns);
+    void StartSegment(uint64_t now_ns);
+    bool ShouldFlush(const LogEvent& event) const;
+    // FlushOnInterval without a next event: runs on the rotator thread every half interval.
+    void FlushIfDue();
 private:
     std::string file_name_;
     std::size_t max_size_;
     std::size_t max_files_;
-    std::size_t current_size_;
-    Nazl::FileOps file_ops_;
+    FileSinkOptions options_;
+    Nazl::FileWriter writer_;
+    std::shared_ptr<LogRotator> rotator_;
+    uint64_t segment_start_ns_{0};
+    uint64_t next_rotate_ns_{UINT64_MAX};
+    uint64_t next_index_{1};
+    // timestamp of the oldest event still in the writer's buffer
+    uint64_t first_buffered_ns_{0};
+    std::unique_ptr<LogIndexWriter> index_;
+    uint64_t flush_task_{0};
+    std::chrono::milliseconds rotate_backoff_{0};
+    std::chrono::steady_clock::time_point rotate_retry_at_;
     std::mutex mutex_;
+    fmt::memory_buffer buffer_;
 };
 class Logger
 {
@@ -245,62 +685,469 @@ public:
 
     template<typename T>
     Logger(const std::string &name, T begin, T end)
-        : name_(std::move(name)), sinks_(begin, end)  {}
+        : name_(std::move(name)), sinks_(begin, end)
+    {
+        RefreshLevel();
+    }
 
     virtual ~Logger() = default;
-    void SinkIt(std::shared_ptr<LogEvent> event);
+    // The event may be moved from (AsyncLogger queues it).
+    virtual void SinkIt(LogEvent&& event);
+    virtual void Flush();
     std::string GetName() const
     {
         return name_;
     }
     void SetFormatter(std::shared_ptr<LogFormat> format);
-private:
+    // Cheap pre-check done by the LOG_* macros before any formatting.
+    bool ShouldLog(LogLevel::LevelEnum level) const
+    {
+        return level >= level_.load(std::memory_order_relaxed);
+    }
+    // Sets every sink to level.
+    void SetLevel(LogLevel level);
+    // Sets the sinks named sink_name, false if there is none.
+    bool SetSinkLevel(const std::string& sink_name, LogLevel level);
+    // Recompute the cached minimum after a sink level changed.
+    void RefreshLevel();
+    // Makes this logger a child of parent (a module logger without sinks of its own): its events go
+    // through parent's SinkIt, so an AsyncLogger parent queues them like its own. The level becomes a
+    // threshold on top of the parent's sink levels and SetLevel leaves those sinks alone.
+    void SetParent(std::shared_ptr<Logger> parent);
+    const std::vector<std::shared_ptr<Sink>>& GetSinks() const
+    {
+        return sinks_;
+    }
+protected:
     std::string name_;
     std::vector<std::shared_ptr<Sink>> sinks_;
+    std::atomic<LogLevel::LevelEnum> level_{LogLevel::LevelEnum::Debug};
+    std::shared_ptr<Logger> parent_;
+    std::atomic<LogLevel::LevelEnum> threshold_{LogLevel::LevelEnum::Debug};
 };
+class LoggerHandle;
 class LogManager
 {
 public:
+    static constexpr std::size_t kMaxModules = 64;
+
     LogManager() = default;
+    // Resets the cached call-site handles and module slots so they look the logger up again.
     void RegisterLogger(std::shared_ptr<Logger> logger);
+    // The logger registered as "default", nullptr if there is none.
     std::shared_ptr<Logger> GetDefaultLogger();
     std::shared_ptr<Logger> GetLogger(const std::string &name);
+    std::vector<std::string> GetLoggerNames();
+    // Runtime level changes, safe while other threads log: call sites only see the logger's
+    // cached minimum level change (one relaxed store). False if the logger or sink is unknown.
+    bool SetLevel(const std::string& logger_name, LogLevel level);
+    bool SetSinkLevel(const std::string& logger_name, const std::string& sink_name, LogLevel level);
+    // Recomputes every logger's cached level, for loggers that share sinks with the one changed.
+    void RefreshLevels();
+    // Logger of the module declared with NAZL_LOG_MODULE(Tag, id, name): the logger registered as
+    // name, or the one registered as "default" while there is none (nullptr without either).
+    // Resolved once, until the next RegisterLogger;
+    // after that a call is an array index and one load.
+    Logger* GetModuleLogger(std::size_t id, const char* name)
+    {
+        Logger* logger = modules_[id].logger_.load(std::memory_order_acquire);
+        return logger ? logger : ResolveModule(id, name);
+    }
 private:
+    friend class LoggerHandle;
+    struct ModuleSlot
+    {
+        std::atomic<Logger*> logger_{nullptr};
+        const char* name_{nullptr};
+    };
+    Logger* ResolveModule(std::size_t id, const char* name);
+    // Looks logger_name ("default" when empty) up and stores the result in handle, under map_mutex_ so that a concurrent
+    // RegisterLogger either resets the stored logger or is seen by the lookup.
+    Logger* ResolveHandle(LoggerHandle& handle, const char* logger_name);
+private:
+    std::array<ModuleSlot, kMaxModules> modules_;
     std::unordered_map<std::string, std::shared_ptr<Logger>> loggers_;
+    // Replaced loggers are kept alive: call sites may still hold raw pointers to them.
+    std::vector<std::shared_ptr<Logger>> retired_;
+    // every handle resolved so far, linked through LoggerHandle::next_
+    LoggerHandle* handles_{nullptr};
     std::mutex map_mutex_;
 };
 typedef Nazl::Singleton<LogManager> logger_manager;
 
-template<typename... Args>
-void LOG_COMMON(LogLevel level, const std::string& logger_name, const std::string& file, const std::string& func,
-                int32_t line, const std::string& format, Args&&... args)
+// Per-call-site cache of the logger pointer, lives in a function-local static inside the LOG_* macros.
+// Steady state is one load of the cached pointer, no lock and no refcount; RegisterLogger resets
+// the pointer of every handle, the next call looks the logger up again.
+class LoggerHandle
 {
-    std::shared_ptr<Logger> logger;
-    if (!logger_name.empty())
-    {
-        logger = logger_manager::GetInstance().GetLogger(logger_name);
-    }
-    else
-    {
-        logger = logger_manager::GetInstance().GetDefaultLogger();
-    }
-    if (!logger)
+public:
+    Logger* Get(const char* logger_name)
     {
-        std::cerr << "Logger not found!" << std::endl;
-        return;
+        Logger* logger = logger_.load(std::memory_order_acquire);
+        if (logger)
+        {
+            return logger;
+        }
+        // a miss is cached too, so "Logger not found!" is printed once per registration instead of per call
+        return missing_.load(std::memory_order_relaxed) ? nullptr : logger_manager::GetInstance().ResolveHandle(*this, logger_name);
     }
-    std::string message = fmt::sprintf(format, std::forward<Args>(args)...);
-    auto event = std::make_shared<LogEvent>(file, func, "ThreadName", line, 1234, std::time(nullptr), level, message);
-    logger->SinkIt(event);
+private:
+    friend class LogManager;
+    std::atomic<Logger*> logger_{nullptr};
+    std::atomic<bool> missing_{false};
+    // guarded by LogManager::map_mutex_
+    LoggerHandle* next_{nullptr};
+    bool linked_{false};
+};
+
+// printf-style formatting appended to out. fmt's public printf API only produces a std::string, so
+// for the fmt versions this was checked against it calls the internal routine fmt::sprintf is built
+// on and writes straight into out; any other version goes through the public fmt::vsprintf.
+template<typename Buffer>
+void FormatPrintf(Buffer& out, fmt::string_view format, fmt::printf_args args)
+{
+#if FMT_VERSION >= 90000 && FMT_VERSION < 110000
+    fmt::detail::vprintf(out, format, args);
+#else
+    std::string text = fmt::vsprintf(format, args);
+    out.append(text.data(), text.data() + text.size());
+#endif
 }
 
+template<typename... Args>
+void LOG_COMMON(LogLevel level, Logger* logger, const char* file, const char* func,
+                int32_t line, fmt::string_view format, Args&&... args)
+{
+    LogEvent event(file, func, LogThreadContext::Current(), line, LogEvent::Now(), level);
+    FormatPrintf(event.GetMessageBuffer(), format, fmt::make_printf_args(args...));
+    logger->SinkIt(std::move(event));
+}
 
-#define LOG_COMMON_IMPL(level, logger, format, ...) LOG_COMMON(level, logger, __FILE__, __FUNCTION__, __LINE__, format, ##__VA_ARGS__)
+// fmt-style counterpart of LOG_COMMON: format is a FMT_COMPILE string, parsed and type checked at build time.
+template<typename CompiledFormat, typename... Args>
+void LOGF_COMMON(LogLevel level, Logger* logger, const char* file, const char* func,
+                 int32_t line, const CompiledFormat& format, const Args&... args)
+{
+    LogEvent event(file, func, LogThreadContext::Current(), line, LogEvent::Now(), level);
+    fmt::format_to(std::back_inserter(event.GetMessageBuffer()), format, args...);
+    logger->SinkIt(std::move(event));
+}
 
-#define LOG_INFO(format, ...) LOG_COMMON_IMPL(LogLevel::LevelEnum::Info, "", format, ##__VA_ARGS__)
+// Structured event: message is plain text, kv are key/value pairs encoded into the event buffer.
+template<typename... KV>
+void LOG_COMMON_KV(LogLevel level, Logger* logger, const char* file, const char* func,
+                   int32_t line, std::string_view message, const KV&... kv)
+{
+    static_assert(sizeof...(KV) % 2 == 0, "LOG_*_KV takes key/value pairs");
+    LogEvent event(file, func, LogThreadContext::Current(), line, LogEvent::Now(), level, message);
+    event.BeginFields();
+    AppendLogFields(event.GetMessageBuffer(), kv...);
+    logger->SinkIt(std::move(event));
+}
+
+// The level check runs before the arguments are evaluated or formatted.
+// logger_name is resolved once per RegisterLogger, so it must be the same at every pass of a call site.
+#define LOG_COMMON_IMPL(level, logger_name, format, ...)                                            \
+    do                                                                                          \
+    {                                                                                           \
+        static LoggerHandle nazl_handle_;                                                       \
+        Logger* nazl_logger_ = nazl_handle_.Get(logger_name);                                   \
+        if (nazl_logger_ && nazl_logger_->ShouldLog(level))                                     \
+        {                                                                                       \
+            LOG_COMMON(level, nazl_logger_, __FILE__, __FUNCTION__, __LINE__, format, ##__VA_ARGS__); \
+        }                                                                                       \
+    } while (0)
+
+// Same as LOG_COMMON_IMPL with a "{}" format; a mismatched argument list fails to compile.
+#define LOGF_COMMON_IMPL(level, logger_name, format, ...)                                           \
+    do                                                                                          \
+    {                                                                                           \
+        static LoggerHandle nazl_handle_;                                                       \
+        Logger* nazl_logger_ = nazl_handle_.Get(logger_name);                                   \
+        if (nazl_logger_ && nazl_logger_->ShouldLog(level))                                     \
+        {                                                                                       \
+            LOGF_COMMON(level, nazl_logger_, __FILE__, __FUNCTION__, __LINE__, FMT_COMPILE(format), ##__VA_ARGS__); \
+        }                                                                                       \
+    } while (0)
+
+#define LOG_KV_IMPL(level, logger_name, message, ...)                                               \
+    do                                                                                          \
+    {                                                                                           \
+        static LoggerHandle nazl_handle_;                                                       \
+        Logger* nazl_logger_ = nazl_handle_.Get(logger_name);                                   \
+        if (nazl_logger_ && nazl_logger_->ShouldLog(level))                                     \
+        {                                                                                       \
+            LOG_COMMON_KV(level, nazl_logger_, __FILE__, __FUNCTION__, __LINE__, message, ##__VA_ARGS__); \
+        }                                                                                       \
+    } while (0)
+
+// Module loggers. Declare each module once, with an id unique in the program (see log_modules.h):
+//   NAZL_LOG_MODULE(PcieLog, 1, "pcie");
+// then log with LOG_MODULE_INFO(PcieLog, "dma chn %d", chn) or LOGF_MODULE_INFO(PcieLog, "dma chn {}", chn).
+// The module's logger is the one registered under its name (logger.<process>.modules.<name> in
+// log_config.yml), so its level and sinks are set independently of the other modules.
+#define NAZL_LOG_MODULE(Tag, id, name)                                                          \
+    struct Tag                                                                                  \
+    {                                                                                           \
+        static constexpr std::size_t kId = id;                                                  \
+        static constexpr const char* kName = name;                                              \
+    };                                                                                          \
+    static_assert((id) < LogManager::kMaxModules, "log module id out of range")
+
+#define LOG_MODULE_IMPL(level, Module, format, ...)                                                 \
+    do                                                                                          \
+    {                                                                                           \
+        Logger* nazl_logger_ = logger_manager::GetInstance().GetModuleLogger(Module::kId, Module::kName); \
+        if (nazl_logger_ && nazl_logger_->ShouldLog(level))                                     \
+        {                                                                                       \
+            LOG_COMMON(level, nazl_logger_, __FILE__, __FUNCTION__, __LINE__, format, ##__VA_ARGS__); \
+        }                                                                                       \
+    } while (0)
+
+#define LOGF_MODULE_IMPL(level, Module, format, ...)                                                \
+    do                                                                                          \
+    {                                                                                           \
+        Logger* nazl_logger_ = logger_manager::GetInstance().GetModuleLogger(Module::kId, Module::kName); \
+        if (nazl_logger_ && nazl_logger_->ShouldLog(level))                                     \
+        {                                                                                       \
+            LOGF_COMMON(level, nazl_logger_, __FILE__, __FUNCTION__, __LINE__, FMT_COMPILE(format), ##__VA_ARGS__); \
+        }                                                                                       \
+    } while (0)
+
+#define LOG_DISABLED_IMPL() do {} while (0)
+
+#if NAZL_LOG_ACTIVE_LEVEL <= NAZL_LOG_LEVEL_DEBUG
 #define LOG_DEBUG(format, ...) LOG_COMMON_IMPL(LogLevel::LevelEnum::Debug, "", format, ##__VA_ARGS__)
+#define LOG_DEBUG_TO(name, format, ...) LOG_COMMON_IMPL(LogLevel::LevelEnum::Debug, name, format, ##__VA_ARGS__)
+#define LOGF_DEBUG(format, ...) LOGF_COMMON_IMPL(LogLevel::LevelEnum::Debug, "", format, ##__VA_ARGS__)
+#define LOGF_DEBUG_TO(name, format, ...) LOGF_COMMON_IMPL(LogLevel::LevelEnum::Debug, name, format, ##__VA_ARGS__)
+#define LOG_DEBUG_KV(message, ...) LOG_KV_IMPL(LogLevel::LevelEnum::Debug, "", message, ##__VA_ARGS__)
+#define LOG_DEBUG_KV_TO(name, message, ...) LOG_KV_IMPL(LogLevel::LevelEnum::Debug, name, message, ##__VA_ARGS__)
+#define LOG_MODULE_DEBUG(module, format, ...) LOG_MODULE_IMPL(LogLevel::LevelEnum::Debug, module, format, ##__VA_ARGS__)
+#define LOGF_MODULE_DEBUG(module, format, ...) LOGF_MODULE_IMPL(LogLevel::LevelEnum::Debug, module, format, ##__VA_ARGS__)
+#else
+#define LOG_MODULE_DEBUG(module, format, ...) LOG_DISABLED_IMPL()
+#define LOGF_MODULE_DEBUG(module, format, ...) LOG_DISABLED_IMPL()
+#define LOG_DEBUG_KV(message, ...) LOG_DISABLED_IMPL()
+#define LOG_DEBUG_KV_TO(name, message, ...) LOG_DISABLED_IMPL()
+#define LOG_DEBUG(format, ...) LOG_DISABLED_IMPL()
+#define LOG_DEBUG_TO(name, format, ...) LOG_DISABLED_IMPL()
+#define LOGF_DEBUG(format, ...) LOG_DISABLED_IMPL()
+#define LOGF_DEBUG_TO(name, format, ...) LOG_DISABLED_IMPL()
+#endif
+#if NAZL_LOG_ACTIVE_LEVEL <= NAZL_LOG_LEVEL_INFO
+#define LOG_INFO(format, ...) LOG_COMMON_IMPL(LogLevel::LevelEnum::Info, "", format, ##__VA_ARGS__)
+#define LOG_INFO_TO(name, format, ...) LOG_COMMON_IMPL(LogLevel::LevelEnum::Info, name, format, ##__VA_ARGS__)
+#define LOGF_INFO(format, ...) LOGF_COMMON_IMPL(LogLevel::LevelEnum::Info, "", format, ##__VA_ARGS__)
+#define LOGF_INFO_TO(name, format, ...) LOGF_COMMON_IMPL(LogLevel::LevelEnum::Info, name, format, ##__VA_ARGS__)
+#define LOG_INFO_KV(message, ...) LOG_KV_IMPL(LogLevel::LevelEnum::Info, "", message, ##__VA_ARGS__)
+#define LOG_INFO_KV_TO(name, message, ...) LOG_KV_IMPL(LogLevel::LevelEnum::Info, name, message, ##__VA_ARGS__)
+#define LOG_MODULE_INFO(module, format, ...) LOG_MODULE_IMPL(LogLevel::LevelEnum::Info, module, format, ##__VA_ARGS__)
+#define LOGF_MODULE_INFO(module, format, ...) LOGF_MODULE_IMPL(LogLevel::LevelEnum::Info, module, format, ##__VA_ARGS__)
+#else
+#define LOG_MODULE_INFO(module, format, ...) LOG_DISABLED_IMPL()
+#define LOGF_MODULE_INFO(module, format, ...) LOG_DISABLED_IMPL()
+#define LOG_INFO_KV(message, ...) LOG_DISABLED_IMPL()
+#define LOG_INFO_KV_TO(name, message, ...) LOG_DISABLED_IMPL()
+#define LOG_INFO(format, ...) LOG_DISABLED_IMPL()
+#define LOG_INFO_TO(name, format, ...) LOG_DISABLED_IMPL()
+#define LOGF_INFO(format, ...) LOG_DISABLED_IMPL()
+#define LOGF_INFO_TO(name, format, ...) LOG_DISABLED_IMPL()
+#endif
+#if NAZL_LOG_ACTIVE_LEVEL <= NAZL_LOG_LEVEL_WARN
 #define LOG_WARN(format, ...) LOG_COMMON_IMPL(LogLevel::LevelEnum::Warn, "", format, ##__VA_ARGS__)
+#define LOG_WARN_TO(name, format, ...) LOG_COMMON_IMPL(LogLevel::LevelEnum::Warn, name, format, ##__VA_ARGS__)
+#define LOGF_WARN(format, ...) LOGF_COMMON_IMPL(LogLevel::LevelEnum::Warn, "", format, ##__VA_ARGS__)
+#define LOGF_WARN_TO(name, format, ...) LOGF_COMMON_IMPL(LogLevel::LevelEnum::Warn, name, format, ##__VA_ARGS__)
+#define LOG_WARN_KV(message, ...) LOG_KV_IMPL(LogLevel::LevelEnum::Warn, "", message, ##__VA_ARGS__)
+#define LOG_WARN_KV_TO(name, message, ...) LOG_KV_IMPL(LogLevel::LevelEnum::Warn, name, message, ##__VA_ARGS__)
+#define LOG_MODULE_WARN(module, format, ...) LOG_MODULE_IMPL(LogLevel::LevelEnum::Warn, module, format, ##__VA_ARGS__)
+#define LOGF_MODULE_WARN(module, format, ...) LOGF_MODULE_IMPL(LogLevel::LevelEnum::Warn, module, format, ##__VA_ARGS__)
+#else
+#define LOG_MODULE_WARN(module, format, ...) LOG_DISABLED_IMPL()
+#define LOGF_MODULE_WARN(module, format, ...) LOG_DISABLED_IMPL()
+#define LOG_WARN_KV(message, ...) LOG_DISABLED_IMPL()
+#define LOG_WARN_KV_TO(name, message, ...) LOG_DISABLED_IMPL()
+#define LOG_WARN(format, ...) LOG_DISABLED_IMPL()
+#define LOG_WARN_TO(name, format, ...) LOG_DISABLED_IMPL()
+#define LOGF_WARN(format, ...) LOG_DISABLED_IMPL()
+#define LOGF_WARN_TO(name, format, ...) LOG_DISABLED_IMPL()
+#endif
+#if NAZL_LOG_ACTIVE_LEVEL <= NAZL_LOG_LEVEL_ERROR
 #define LOG_ERROR(format, ...) LOG_COMMON_IMPL(LogLevel::LevelEnum::Error, "", format, ##__VA_ARGS__)
+#define LOG_ERROR_TO(name, format, ...) LOG_COMMON_IMPL(LogLevel::LevelEnum::Error, name, format, ##__VA_ARGS__)
+#define LOGF_ERROR(format, ...) LOGF_COMMON_IMPL(LogLevel::LevelEnum::Error, "", format, ##__VA_ARGS__)
+#define LOGF_ERROR_TO(name, format, ...) LOGF_COMMON_IMPL(LogLevel::LevelEnum::Error, name, format, ##__VA_ARGS__)
+#define LOG_ERROR_KV(message, ...) LOG_KV_IMPL(LogLevel::LevelEnum::Error, "", message, ##__VA_ARGS__)
+#define LOG_ERROR_KV_TO(name, message, ...) LOG_KV_IMPL(LogLevel::LevelEnum::Error, name, message, ##__VA_ARGS__)
+#define LOG_MODULE_ERROR(module, format, ...) LOG_MODULE_IMPL(LogLevel::LevelEnum::Error, module, format, ##__VA_ARGS__)
+#define LOGF_MODULE_ERROR(module, format, ...) LOGF_MODULE_IMPL(LogLevel::LevelEnum::Error, module, format, ##__VA_ARGS__)
+#else
+#define LOG_MODULE_ERROR(module, format, ...) LOG_DISABLED_IMPL()
+#define LOGF_MODULE_ERROR(module, format, ...) LOG_DISABLED_IMPL()
+#define LOG_ERROR_KV(message, ...) LOG_DISABLED_IMPL()
+#define LOG_ERROR_KV_TO(name, message, ...) LOG_DISABLED_IMPL()
+#define LOG_ERROR(format, ...) LOG_DISABLED_IMPL()
+#define LOG_ERROR_TO(name, format, ...) LOG_DISABLED_IMPL()
+#define LOGF_ERROR(format, ...) LOG_DISABLED_IMPL()
+#define LOGF_ERROR_TO(name, format, ...) LOG_DISABLED_IMPL()
+#endif
+#if NAZL_LOG_ACTIVE_LEVEL <= NAZL_LOG_LEVEL_FATAL
 #define LOG_FATAL(format, ...) LOG_COMMON_IMPL(LogLevel::LevelEnum::Fatal, "", format, ##__VA_ARGS__)
+#define LOG_FATAL_TO(name, format, ...) LOG_COMMON_IMPL(LogLevel::LevelEnum::Fatal, name, format, ##__VA_ARGS__)
+#define LOGF_FATAL(format, ...) LOGF_COMMON_IMPL(LogLevel::LevelEnum::Fatal, "", format, ##__VA_ARGS__)
+#define LOGF_FATAL_TO(name, format, ...) LOGF_COMMON_IMPL(LogLevel::LevelEnum::Fatal, name, format, ##__VA_ARGS__)
+#define LOG_FATAL_KV(message, ...) LOG_KV_IMPL(LogLevel::LevelEnum::Fatal, "", message, ##__VA_ARGS__)
+#define LOG_FATAL_KV_TO(name, message, ...) LOG_KV_IMPL(LogLevel::LevelEnum::Fatal, name, message, ##__VA_ARGS__)
+#define LOG_MODULE_FATAL(module, format, ...) LOG_MODULE_IMPL(LogLevel::LevelEnum::Fatal, module, format, ##__VA_ARGS__)
+#define LOGF_MODULE_FATAL(module, format, ...) LOGF_MODULE_IMPL(LogLevel::LevelEnum::Fatal, module, format, ##__VA_ARGS__)
+#else
+#define LOG_MODULE_FATAL(module, format, ...) LOG_DISABLED_IMPL()
+#define LOGF_MODULE_FATAL(module, format, ...) LOG_DISABLED_IMPL()
+#define LOG_FATAL_KV(message, ...) LOG_DISABLED_IMPL()
+#define LOG_FATAL_KV_TO(name, message, ...) LOG_DISABLED_IMPL()
+#define LOG_FATAL(format, ...) LOG_DISABLED_IMPL()
+#define LOG_FATAL_TO(name, format, ...) LOG_DISABLED_IMPL()
+#define LOGF_FATAL(format, ...) LOG_DISABLED_IMPL()
+#define LOGF_FATAL_TO(name, format, ...) LOG_DISABLED_IMPL()
+#endif
+// Per-call-site limiters for the LOG_EVERY_N family. Each lives in a function-local static,
+// is lock-free, and Allow() reports through suppressed how many calls were skipped since the
+// last one that got through.
+inline uint64_t LogLimiterNow()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+class LogEveryN
+{
+public:
+    bool Allow(uint64_t n, uint64_t& suppressed)
+    {
+        uint64_t count = count_.fetch_add(1, std::memory_order_relaxed);
+        if (n <= 1 || count % n == 0)
+        {
+            suppressed = (count == 0 || n <= 1) ? 0 : n - 1;
+            return true;
+        }
+        return false;
+    }
+private:
+    std::atomic<uint64_t> count_{0};
+};
+class LogFirstN
+{
+public:
+    // Once the first n are out, a throttled call is a single relaxed load and is not counted.
+    bool Allow(uint64_t n, uint64_t& suppressed)
+    {
+        suppressed = 0;
+        if (count_.load(std::memory_order_relaxed) >= n)
+        {
+            return false;
+        }
+        return count_.fetch_add(1, std::memory_order_relaxed) < n;
+    }
+private:
+    std::atomic<uint64_t> count_{0};
+};
+class LogEveryMs
+{
+public:
+    bool Allow(uint64_t interval_ms, uint64_t& suppressed)
+    {
+        uint64_t now = LogLimiterNow();
+        uint64_t next = next_ns_.load(std::memory_order_relaxed);
+        if (now < next || !next_ns_.compare_exchange_strong(next, now + interval_ms * 1000000ull,
+                                                            std::memory_order_relaxed))
+        {
+            suppressed_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+private:
+    std::atomic<uint64_t> next_ns_{0};
+    std::atomic<uint64_t> suppressed_{0};
+};
+// Token bucket of burst tokens refilled at rate_per_sec, kept as a single theoretical arrival
+// time (GCRA) so that taking a token is one CAS.
+class LogTokenBucket
+{
+public:
+    bool Allow(double rate_per_sec, uint64_t burst, uint64_t& suppressed)
+    {
+        if (rate_per_sec <= 0)
+        {
+            return false;
+        }
+        uint64_t interval = static_cast<uint64_t>(1e9 / rate_per_sec);
+        uint64_t tolerance = interval * (burst > 0 ? burst - 1 : 0);
+        uint64_t now = LogLimiterNow();
+        uint64_t tat = tat_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            uint64_t start = tat > now ? tat : now;
+            if (start - now > tolerance)
+            {
+                suppressed_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (tat_.compare_exchange_weak(tat, start + interval, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+        suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+private:
+    std::atomic<uint64_t> tat_{0};
+    std::atomic<uint64_t> suppressed_{0};
+};
+
+// level is a LevelEnum name: LOG_EVERY_N(Error, 1000, "dma timeout chn %d", chn).
+// A call that gets through after skipped ones is followed by a "suppressed N" summary line.
+// Only calls the logger would write reach the limiter: one at a disabled level counts for nothing.
+#define LOG_LIMITED_IMPL(level, logger_name, limiter_type, allow, format, ...)                      \
+    do                                                                                          \
+    {                                                                                           \
+        if (static_cast<int>(LogLevel::LevelEnum::level) >= NAZL_LOG_ACTIVE_LEVEL)              \
+        {                                                                                       \
+            static LoggerHandle nazl_handle_;                                                   \
+            static limiter_type nazl_limiter_;                                                  \
+            Logger* nazl_logger_ = nazl_handle_.Get(logger_name);                               \
+            uint64_t nazl_suppressed_ = 0;                                                      \
+            if (nazl_logger_ && nazl_logger_->ShouldLog(LogLevel::LevelEnum::level) && nazl_limiter_.allow) \
+            {                                                                                   \
+                LOG_COMMON(LogLevel::LevelEnum::level, nazl_logger_, __FILE__, __FUNCTION__, __LINE__, \
+                           format, ##__VA_ARGS__);                                              \
+                if (nazl_suppressed_ > 0)                                                       \
+                {                                                                               \
+                    LOG_COMMON(LogLevel::LevelEnum::level, nazl_logger_, __FILE__, __FUNCTION__, __LINE__, \
+                               "suppressed %llu messages at %s:%d",                             \
+                               static_cast<unsigned long long>(nazl_suppressed_), __FILE__, __LINE__); \
+                }                                                                               \
+            }                                                                                   \
+        }                                                                                       \
+    } while (0)
+
+#define LOG_EVERY_N(level, n, format, ...) LOG_EVERY_N_TO("", level, n, format, ##__VA_ARGS__)
+#define LOG_FIRST_N(level, n, format, ...) LOG_FIRST_N_TO("", level, n, format, ##__VA_ARGS__)
+#define LOG_EVERY_MS(level, interval_ms, format, ...) LOG_EVERY_MS_TO("", level, interval_ms, format, ##__VA_ARGS__)
+#define LOG_RATE_LIMITED(level, rate_per_sec, burst, format, ...) \
+    LOG_RATE_LIMITED_TO("", level, rate_per_sec, burst, format, ##__VA_ARGS__)
+// Same on the logger registered as name: LOG_EVERY_N_TO("pcie", Error, 1000, "dma timeout chn %d", chn).
+#define LOG_EVERY_N_TO(name, level, n, format, ...) \
+    LOG_LIMITED_IMPL(level, name, LogEveryN, Allow(n, nazl_suppressed_), format, ##__VA_ARGS__)
+#define LOG_FIRST_N_TO(name, level, n, format, ...) \
+    LOG_LIMITED_IMPL(level, name, LogFirstN, Allow(n, nazl_suppressed_), format, ##__VA_ARGS__)
+#define LOG_EVERY_MS_TO(name, level, interval_ms, format, ...) \
+    LOG_LIMITED_IMPL(level, name, LogEveryMs, Allow(interval_ms, nazl_suppressed_), format, ##__VA_ARGS__)
+#define LOG_RATE_LIMITED_TO(name, level, rate_per_sec, burst, format, ...) \
+    LOG_LIMITED_IMPL(level, name, LogTokenBucket, Allow(rate_per_sec, burst, nazl_suppressed_), format, ##__VA_ARGS__)
+
 int32_t log_init(const std::string& name);
 #endif
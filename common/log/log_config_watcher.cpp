@@ -0,0 +1,153 @@
+//
+// Created by zwz on 2024/10/18.
+//
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include "log_config_watcher.h"
+
+LogConfigWatcher::~LogConfigWatcher()
+{
+    Stop();
+}
+
+void LogConfigWatcher::Bind(const std::string& section, const std::string& logger_name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& binding : bindings_)
+    {
+        if (binding.section_ == section)
+        {
+            binding.logger_name_ = logger_name;
+            return;
+        }
+    }
+    bindings_.push_back(Binding{section, logger_name});
+}
+
+bool LogConfigWatcher::Start(const std::string& file_name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (running_)
+    {
+        return file_name == file_name_;
+    }
+    auto slash = file_name.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : file_name.substr(0, slash + 1);
+    base_name_ = slash == std::string::npos ? file_name : file_name.substr(slash + 1);
+    inotify_fd_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ < 0)
+    {
+        perror("inotify_init1");
+        return false;
+    }
+    if (::inotify_add_watch(inotify_fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+    {
+        perror(("Failed to watch " + dir).c_str());
+        ::close(inotify_fd_);
+        inotify_fd_ = -1;
+        return false;
+    }
+    file_name_ = file_name;
+    running_ = true;
+    watcher_ = std::make_unique<Nazl::Thread>([this] { WatchLoop(); }, "log-config");
+    return true;
+}
+
+void LogConfigWatcher::Stop()
+{
+    if (!running_.exchange(false))
+    {
+        return;
+    }
+    watcher_->join();
+    watcher_.reset();
+    ::close(inotify_fd_);
+    inotify_fd_ = -1;
+}
+
+void LogConfigWatcher::WatchLoop()
+{
+    alignas(struct inotify_event) char events[4096];
+    struct pollfd pfd{inotify_fd_, POLLIN, 0};
+    while (running_)
+    {
+        if (::poll(&pfd, 1, 100) <= 0)
+        {
+            continue;
+        }
+        bool changed = false;
+        ssize_t n;
+        while ((n = ::read(inotify_fd_, events, sizeof(events))) > 0)
+        {
+            for (char* p = events; p < events + n;)
+            {
+                auto* event = reinterpret_cast<struct inotify_event*>(p);
+                if (event->len > 0 && base_name_ == event->name)
+                {
+                    changed = true;
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        if (changed)
+        {
+            Reload();
+        }
+    }
+}
+
+bool LogConfigWatcher::Reload()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Nazl::Config config(file_name_);
+    try
+    {
+        if (!config.loadItemsFromYaml())
+        {
+            return false;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Keeping log levels, failed to reload " << file_name_ << ": " << e.what() << std::endl;
+        return false;
+    }
+    std::size_t applied = 0;
+    for (auto& binding : bindings_)
+    {
+        applied += ApplyLevels(config, binding.section_, binding.logger_name_);
+    }
+    // module loggers on the process sinks follow the sink levels just applied
+    logger_manager::GetInstance().RefreshLevels();
+    reloads_.fetch_add(1, std::memory_order_relaxed);
+    LOG_INFO("log levels reloaded from %s, %zu levels applied", file_name_.c_str(), applied);
+    return true;
+}
+
+std::size_t LogConfigWatcher::ApplyLevels(Nazl::Config& config, const std::string& section, const std::string& logger_name)
+{
+    auto logger = logger_manager::GetInstance().GetLogger(logger_name);
+    if (!logger)
+    {
+        return 0;
+    }
+    auto baseKey = "logger." + section;
+    if (config.hasItem(baseKey + ".level"))
+    {
+        logger->SetLevel(LogLevel(LogLevel::FromString(config.getItem<std::string>(baseKey + ".level")->getValue())));
+        return 1;
+    }
+    std::size_t applied = 0;
+    for (auto& sink : logger->GetSinks())
+    {
+        if (!sink->GetName().empty() && config.hasItem(baseKey + "." + sink->GetName() + ".level"))
+        {
+            auto level = config.getItem<std::string>(baseKey + "." + sink->GetName() + ".level")->getValue();
+            sink->SetLevel(LogLevel(LogLevel::FromString(level)));
+            ++applied;
+        }
+    }
+    logger->RefreshLevel();
+    return applied;
+}
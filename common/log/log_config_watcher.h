@@ -0,0 +1,60 @@
+//
+// Created by zwz on 2024/10/18.
+//
+
+#ifndef COMMON_LOG_CONFIG_WATCHER_H
+#define COMMON_LOG_CONFIG_WATCHER_H
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "config.h"
+#include "log.h"
+
+// Re-reads log_config.yml whenever it is rewritten (inotify on its directory, so editors that
+// save through a rename are seen too) and re-applies the levels of the bound loggers:
+//   logger.<section>.level          if present, every sink of the logger
+//   logger.<section>.<sink>.level   otherwise, per sink, matched by Sink::GetName()
+// Nothing else is reloaded; sinks, paths and formats still need a restart. A file that fails
+// to parse keeps the current levels.
+class LogConfigWatcher
+{
+public:
+    LogConfigWatcher() = default;
+    ~LogConfigWatcher();
+    LogConfigWatcher(const LogConfigWatcher&) = delete;
+    LogConfigWatcher& operator=(const LogConfigWatcher&) = delete;
+
+    // Maps the config section logger.<section> to the registered logger logger_name.
+    void Bind(const std::string& section, const std::string& logger_name);
+    // Starts the "log-config" thread, true if it is watching file_name on return.
+    bool Start(const std::string& file_name);
+    void Stop();
+    // Re-applies the levels from the file now, the thread calls it after every change.
+    bool Reload();
+    uint64_t GetReloadCount() const
+    {
+        return reloads_.load(std::memory_order_relaxed);
+    }
+    // Applies the levels of logger.<section> to logger_name, returns how many levels were set.
+    static std::size_t ApplyLevels(Nazl::Config& config, const std::string& section, const std::string& logger_name);
+private:
+    void WatchLoop();
+private:
+    struct Binding
+    {
+        std::string section_;
+        std::string logger_name_;
+    };
+    std::string file_name_;
+    std::string base_name_;
+    int inotify_fd_{-1};
+    std::atomic<bool> running_{false};
+    std::atomic<uint64_t> reloads_{0};
+    std::mutex mutex_;
+    std::vector<Binding> bindings_;
+    std::unique_ptr<Nazl::Thread> watcher_;
+};
+typedef Nazl::Singleton<LogConfigWatcher> log_config_watcher;
+#endif //COMMON_LOG_CONFIG_WATCHER_H
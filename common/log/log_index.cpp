@@ -0,0 +1,108 @@
+//
+// Created by zwz on 2024/10/18.
+//
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "log_index.h"
+
+LogIndexWriter::LogIndexWriter(std::size_t block_lines, std::size_t block_bytes)
+    : block_lines_(block_lines == 0 ? UINT16_MAX : std::min<std::size_t>(block_lines, UINT16_MAX)),
+      block_bytes_(block_bytes == 0 ? UINT32_MAX : std::min<std::size_t>(block_bytes, UINT32_MAX))
+{
+}
+
+LogIndexWriter::~LogIndexWriter()
+{
+    Close();
+}
+
+bool LogIndexWriter::Open(const std::string& segment_name)
+{
+    Close();
+    fd_ = ::open(IndexName(segment_name).c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+    {
+        perror(("Failed to open log index " + IndexName(segment_name)).c_str());
+        return false;
+    }
+    return true;
+}
+
+void LogIndexWriter::Close()
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+    WriteBlock();
+    ::close(fd_);
+    fd_ = -1;
+}
+
+void LogIndexWriter::Add(uint64_t timestamp, LogLevel::LevelEnum level, uint64_t offset, std::size_t size)
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+    if (block_.lines_ > 0 && (block_.lines_ >= block_lines_ || block_.size_ + size > block_bytes_ ||
+                              block_.offset_ + block_.size_ != offset))
+    {
+        WriteBlock();
+    }
+    if (block_.lines_ == 0)
+    {
+        block_.first_ns_ = timestamp;
+        block_.last_ns_ = timestamp;
+        block_.offset_ = offset;
+    }
+    // threads stamp events before they take the sink lock, so times are only nearly sorted
+    block_.first_ns_ = std::min(block_.first_ns_, timestamp);
+    block_.last_ns_ = std::max(block_.last_ns_, timestamp);
+    block_.size_ += static_cast<uint32_t>(size);
+    block_.lines_++;
+    block_.levels_ |= static_cast<uint8_t>(1u << static_cast<int>(level));
+}
+
+void LogIndexWriter::WriteBlock()
+{
+    if (block_.lines_ == 0)
+    {
+        return;
+    }
+    if (::write(fd_, &block_, sizeof(block_)) != static_cast<ssize_t>(sizeof(block_)))
+    {
+        perror("Failed to write log index");
+    }
+    block_ = LogIndexEntry{};
+}
+
+std::vector<LogIndexEntry> LogIndexWriter::Load(const std::string& segment_name)
+{
+    std::vector<LogIndexEntry> entries;
+    int fd = ::open(IndexName(segment_name).c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return entries;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) == 0)
+    {
+        // a torn last entry is ignored
+        entries.resize(static_cast<std::size_t>(st.st_size) / sizeof(LogIndexEntry));
+        ssize_t want = static_cast<ssize_t>(entries.size() * sizeof(LogIndexEntry));
+        if (::pread(fd, entries.data(), static_cast<std::size_t>(want), 0) != want)
+        {
+            entries.clear();
+        }
+    }
+    ::close(fd);
+    std::sort(entries.begin(), entries.end(), [](const LogIndexEntry& a, const LogIndexEntry& b)
+    {
+        return a.offset_ < b.offset_;
+    });
+    return entries;
+}
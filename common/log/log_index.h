@@ -0,0 +1,67 @@
+//
+// Created by zwz on 2024/10/18.
+//
+
+#ifndef COMMON_LOG_INDEX_H
+#define COMMON_LOG_INDEX_H
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "log.h"
+
+// Sparse time index of a log segment, kept next to it as <segment>.idx and renamed along with it
+// by LogRotator. Events are grouped into blocks of at most block_lines events / block_bytes bytes;
+// each block gets one fixed-size entry: time span, byte range and the levels it contains. A reader
+// looks up the blocks of a time range and touches only their pages. Bytes no entry covers (the
+// open block after a crash, a file written without index) are simply not indexed.
+struct LogIndexEntry
+{
+    uint64_t first_ns_;
+    uint64_t last_ns_;
+    uint64_t offset_;
+    uint32_t size_;
+    uint16_t lines_;
+    uint8_t levels_;    // bit (1 << LevelEnum) for every level in the block
+    uint8_t reserved_;
+
+    bool HasLevelAtLeast(LogLevel::LevelEnum level) const
+    {
+        return (levels_ >> static_cast<int>(level)) != 0;
+    }
+};
+static_assert(sizeof(LogIndexEntry) == 32, "index entries are written as they are");
+
+class LogIndexWriter
+{
+public:
+    LogIndexWriter(std::size_t block_lines, std::size_t block_bytes);
+    ~LogIndexWriter();
+    LogIndexWriter(const LogIndexWriter&) = delete;
+    LogIndexWriter& operator=(const LogIndexWriter&) = delete;
+
+    // Appends to the index of segment_name.
+    bool Open(const std::string& segment_name);
+    // Writes the entry of the open block.
+    void Close();
+    bool IsOpen() const
+    {
+        return fd_ >= 0;
+    }
+    // One event written at offset; events of a block must be contiguous.
+    void Add(uint64_t timestamp, LogLevel::LevelEnum level, uint64_t offset, std::size_t size);
+
+    static std::string IndexName(const std::string& segment_name)
+    {
+        return segment_name + LogRotator::kIndexSuffix;
+    }
+    // Entries ordered by offset, empty if there is no index.
+    static std::vector<LogIndexEntry> Load(const std::string& segment_name);
+private:
+    void WriteBlock();
+private:
+    std::size_t block_lines_;
+    std::size_t block_bytes_;
+    int fd_{-1};
+    LogIndexEntry block_{};
+};
+#endif //COMMON_LOG_INDEX_H
@@ -0,0 +1,15 @@
+//
+// Created by zwz on 2024/10/18.
+//
+
+#ifndef COMMON_LOG_MODULES_H
+#define COMMON_LOG_MODULES_H
+#include "log.h"
+
+// Log modules of this tree. Ids are slots in LogManager's module table: keep them unique and below
+// LogManager::kMaxModules, and never reuse one for a different name.
+NAZL_LOG_MODULE(PcieLog, 1, "pcie");
+NAZL_LOG_MODULE(TimerLog, 2, "timer");
+NAZL_LOG_MODULE(AppLog, 3, "app");
+
+#endif //COMMON_LOG_MODULES_H
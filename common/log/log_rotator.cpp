@@ -0,0 +1,401 @@
+//
+// Created by zwz on 2024/10/16.
+//
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef NAZL_LOG_HAS_ZLIB
+#include <zlib.h>
+#endif
+#include "log_rotator.h"
+
+LogRotator::LogRotator()
+{
+    worker_ = std::make_unique<Nazl::Thread>([this] { WorkerLoop(); }, "log-rotate");
+}
+
+LogRotator::~LogRotator()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    cond_.notify_one();
+    worker_->join();
+}
+
+LogRotator::Compression LogRotator::StringToCompression(const std::string& compression)
+{
+    std::string lower = compression;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    if (lower == "gzip" || lower == "gz" || lower == "zlib")
+    {
+        return Compression::Gzip;
+    }
+    return Compression::None;
+}
+
+bool LogRotator::IsSupported(Compression compression)
+{
+#ifdef NAZL_LOG_HAS_ZLIB
+    (void)compression;
+    return true;
+#else
+    return compression == Compression::None;
+#endif
+}
+
+bool LogRotator::Rotate(const std::string& file_name, std::size_t max_files, Compression compression)
+{
+    std::string pending = file_name + kPendingSuffix + std::to_string(::getpid()) + "." + std::to_string(sequence_.fetch_add(1));
+    if (::rename(file_name.c_str(), pending.c_str()) != 0)
+    {
+        return false;
+    }
+    ::rename((file_name + kIndexSuffix).c_str(), (pending + kIndexSuffix).c_str());
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(Job{file_name, std::move(pending), max_files, compression, false, 0, 0, Retention{}});
+    }
+    cond_.notify_one();
+    return true;
+}
+
+std::size_t LogRotator::Recover(const std::string& file_name, std::size_t max_files, Compression compression)
+{
+    std::string::size_type slash = file_name.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : file_name.substr(0, slash + 1);
+    std::string prefix = (slash == std::string::npos ? file_name : file_name.substr(slash + 1)) + kPendingSuffix;
+    DIR* entries = ::opendir(dir.c_str());
+    if (!entries)
+    {
+        return 0;
+    }
+    std::vector<std::pair<int64_t, std::string>> pending;
+    while (struct dirent* entry = ::readdir(entries))
+    {
+        std::string name = entry->d_name;
+        std::size_t index_len = strlen(kIndexSuffix);
+        bool is_index = name.size() > index_len && name.compare(name.size() - index_len, index_len, kIndexSuffix) == 0;
+        if (name.compare(0, prefix.size(), prefix) != 0 || is_index)
+        {
+            continue;
+        }
+        std::string path = slash == std::string::npos ? name : dir + name;
+        struct stat st;
+        if (::stat(path.c_str(), &st) == 0)
+        {
+            pending.emplace_back(static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec, std::move(path));
+        }
+    }
+    ::closedir(entries);
+    std::sort(pending.begin(), pending.end());
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (auto& file : pending)
+        {
+            jobs_.push_back(Job{file_name, std::move(file.second), max_files, compression, false, 0, 0, Retention{}});
+        }
+    }
+    cond_.notify_one();
+    return pending.size();
+}
+
+bool LogRotator::RotateIndexed(const std::string& file_name, uint64_t index, uint64_t start_s,
+                               const Retention& retention, Compression compression)
+{
+    std::string segment = SegmentName(file_name, start_s, index);
+    if (::rename(file_name.c_str(), segment.c_str()) != 0)
+    {
+        return false;
+    }
+    ::rename((file_name + kIndexSuffix).c_str(), (segment + kIndexSuffix).c_str());
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        jobs_.push_back(Job{file_name, std::move(segment), retention.max_files_, compression, true, index, start_s, retention});
+    }
+    cond_.notify_one();
+    return true;
+}
+
+std::string LogRotator::SegmentName(const std::string& file_name, uint64_t start_s, uint64_t index)
+{
+    time_t seconds = static_cast<time_t>(start_s);
+    struct tm tm_time;
+    ::localtime_r(&seconds, &tm_time);
+    char stamp[32];
+    ::strftime(stamp, sizeof(stamp), "%Y%m%d-%H", &tm_time);
+    char number[24];
+    ::snprintf(number, sizeof(number), "%04llu", static_cast<unsigned long long>(index));
+    return file_name + "." + stamp + "." + number;
+}
+
+uint64_t LogRotator::NextIndex(const std::string& file_name)
+{
+    auto segments = LoadManifest(file_name);
+    uint64_t next = 1;
+    for (auto& segment : segments)
+    {
+        next = std::max(next, segment.index_ + 1);
+    }
+    return next;
+}
+
+std::vector<LogRotator::Segment> LogRotator::LoadManifest(const std::string& file_name)
+{
+    std::vector<Segment> segments;
+    std::ifstream in(ManifestName(file_name));
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        Segment segment;
+        if (fields >> segment.index_ >> segment.start_s_ >> segment.size_ >> segment.name_)
+        {
+            segments.push_back(std::move(segment));
+        }
+    }
+    return segments;
+}
+
+bool LogRotator::StoreManifest(const std::string& file_name, const std::vector<Segment>& segments)
+{
+    // rewrite + rename so readers never see a half written manifest
+    std::string manifest = ManifestName(file_name);
+    std::string tmp = manifest + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        for (auto& segment : segments)
+        {
+            out << segment.index_ << ' ' << segment.start_s_ << ' ' << segment.size_ << ' ' << segment.name_ << '\n';
+        }
+        if (!out)
+        {
+            return false;
+        }
+    }
+    return ::rename(tmp.c_str(), manifest.c_str()) == 0;
+}
+
+void LogRotator::WaitIdle()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cond_.wait(lock, [this] { return jobs_.empty() && !busy_; });
+}
+
+uint64_t LogRotator::AddPeriodic(std::function<void()> fn, uint32_t period_ms)
+{
+    std::chrono::milliseconds period(std::max<uint32_t>(period_ms, 1));
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        id = next_periodic_id_++;
+        periodic_.push_back(Periodic{id, period, std::chrono::steady_clock::now() + period, std::move(fn)});
+    }
+    cond_.notify_one();
+    return id;
+}
+
+void LogRotator::RemovePeriodic(uint64_t id)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    periodic_.erase(std::remove_if(periodic_.begin(), periodic_.end(), [id](const Periodic& periodic)
+    {
+        return periodic.id_ == id;
+    }), periodic_.end());
+    idle_cond_.wait(lock, [this, id] { return running_periodic_ != id; });
+}
+
+void LogRotator::WorkerLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto ready = [this] { return !jobs_.empty() || !running_; };
+    for (;;)
+    {
+        if (periodic_.empty())
+        {
+            cond_.wait(lock, ready);
+        }
+        else
+        {
+            auto next = std::min_element(periodic_.begin(), periodic_.end(), [](const Periodic& a, const Periodic& b)
+            {
+                return a.next_ < b.next_;
+            })->next_;
+            cond_.wait_until(lock, next, ready);
+        }
+        RunPeriodic(lock);
+        if (jobs_.empty())
+        {
+            // pending segments are still renamed into place on shutdown
+            if (!running_)
+            {
+                break;
+            }
+            continue;
+        }
+        Job job = std::move(jobs_.front());
+        jobs_.pop_front();
+        busy_ = true;
+        lock.unlock();
+        Process(job);
+        lock.lock();
+        busy_ = false;
+        if (jobs_.empty())
+        {
+            idle_cond_.notify_all();
+        }
+    }
+}
+
+void LogRotator::RunPeriodic(std::unique_lock<std::mutex>& lock)
+{
+    for (;;)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto due = std::find_if(periodic_.begin(), periodic_.end(), [now](const Periodic& periodic)
+        {
+            return periodic.next_ <= now;
+        });
+        if (due == periodic_.end())
+        {
+            return;
+        }
+        due->next_ = now + due->period_;
+        running_periodic_ = due->id_;
+        auto fn = due->fn_;
+        lock.unlock();
+        fn();
+        lock.lock();
+        running_periodic_ = 0;
+        idle_cond_.notify_all();
+    }
+}
+
+void LogRotator::Process(const Job& job)
+{
+    if (job.indexed_)
+    {
+        ProcessIndexed(job);
+        return;
+    }
+    // both spellings are shifted so that switching compression on or off keeps retention right;
+    // a missing segment just makes rename fail with ENOENT, no stat needed
+    static const char* const kSuffixes[] = {"", ".gz", kIndexSuffix};
+    auto segment = [&job](std::size_t index, const char* suffix)
+    {
+        return job.file_name_ + "." + std::to_string(index) + suffix;
+    };
+    for (auto suffix : kSuffixes)
+    {
+        ::unlink(segment(job.max_files_, suffix).c_str());
+    }
+    for (std::size_t i = job.max_files_ - 1; i >= 1; --i)
+    {
+        for (auto suffix : kSuffixes)
+        {
+            ::rename(segment(i, suffix).c_str(), segment(i + 1, suffix).c_str());
+        }
+    }
+    std::string newest = segment(1, "");
+    ::rename(job.pending_.c_str(), newest.c_str());
+    ::rename((job.pending_ + kIndexSuffix).c_str(), segment(1, kIndexSuffix).c_str());
+    if (job.compression_ == Compression::Gzip && IsSupported(job.compression_) &&
+        Compress(newest, segment(1, ".gz")))
+    {
+        ::unlink(segment(1, kIndexSuffix).c_str());
+    }
+}
+
+void LogRotator::ProcessIndexed(const Job& job)
+{
+    std::string name = job.pending_;
+    if (job.compression_ == Compression::Gzip && IsSupported(job.compression_) && Compress(name, name + ".gz"))
+    {
+        ::unlink((name + kIndexSuffix).c_str());
+        name += ".gz";
+    }
+    struct stat st;
+    uint64_t size = (::stat(name.c_str(), &st) == 0) ? static_cast<uint64_t>(st.st_size) : 0;
+    auto segments = LoadManifest(job.file_name_);
+    segments.push_back(Segment{job.index_, job.start_s_, size, name});
+
+    const Retention& retention = job.retention_;
+    uint64_t total = 0;
+    for (auto& segment : segments)
+    {
+        total += segment.size_;
+    }
+    uint64_t now = static_cast<uint64_t>(::time(nullptr));
+    std::size_t expired = 0;
+    // oldest first; the segment just added is never pruned
+    while (expired + 1 < segments.size())
+    {
+        const Segment& oldest = segments[expired];
+        bool too_many = retention.max_files_ && segments.size() - expired > retention.max_files_;
+        bool too_old = retention.max_age_s_ && oldest.start_s_ + retention.max_age_s_ < now;
+        bool too_big = retention.max_total_size_ && total > retention.max_total_size_;
+        if (!too_many && !too_old && !too_big)
+        {
+            break;
+        }
+        ::unlink(oldest.name_.c_str());
+        ::unlink((oldest.name_ + kIndexSuffix).c_str());
+        total -= oldest.size_;
+        ++expired;
+    }
+    segments.erase(segments.begin(), segments.begin() + static_cast<std::ptrdiff_t>(expired));
+    StoreManifest(job.file_name_, segments);
+}
+
+bool LogRotator::Compress(const std::string& src, const std::string& dst)
+{
+#ifdef NAZL_LOG_HAS_ZLIB
+    int in = ::open(src.c_str(), O_RDONLY | O_CLOEXEC);
+    if (in < 0)
+    {
+        return false;
+    }
+    // written under a temporary name so a crash never leaves a truncated .gz behind
+    std::string tmp = dst + ".tmp";
+    gzFile out = ::gzopen(tmp.c_str(), "wb6");
+    if (!out)
+    {
+        ::close(in);
+        return false;
+    }
+    std::vector<char> chunk(256 * 1024);
+    bool ok = true;
+    ssize_t n;
+    while ((n = ::read(in, chunk.data(), chunk.size())) > 0)
+    {
+        if (::gzwrite(out, chunk.data(), static_cast<unsigned>(n)) != n)
+        {
+            ok = false;
+            break;
+        }
+    }
+    ok = ok && n == 0;
+    ::close(in);
+    ok = (::gzclose(out) == Z_OK) && ok;
+    if (ok && ::rename(tmp.c_str(), dst.c_str()) == 0)
+    {
+        ::unlink(src.c_str());
+        return true;
+    }
+    ::unlink(tmp.c_str());
+    return false;
+#else
+    (void)src;
+    (void)dst;
+    return false;
+#endif
+}
@@ -0,0 +1,126 @@
+//
+// Created by zwz on 2024/10/16.
+//
+
+#ifndef COMMON_LOG_ROTATOR_H
+#define COMMON_LOG_ROTATOR_H
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "singleton.h"
+#include "thread_pool.h"
+
+// Keeps rotation off the logging path: the sink only renames the live file to a pending name
+// and reopens, the .1 -> .N cascade, retention and compression run on the "log-rotate" thread.
+//
+// Indexed rotation skips the cascade altogether: the live file is renamed straight to its final
+// segment name (app.log.20261017-13.0007), and <file>.manifest lists the segments, one
+// "<index> <start seconds> <size> <name>" line each, oldest first, for pruning by count, age or size.
+//
+// A segment's sparse time index (<segment>.idx, see LogIndexWriter) moves with it; compressing a
+// segment drops its index since the offsets no longer apply.
+//
+// The same thread runs the file sinks' periodic work (AddPeriodic) between jobs.
+class LogRotator
+{
+public:
+    static constexpr const char* kIndexSuffix = ".idx";
+    static constexpr const char* kPendingSuffix = ".rotating.";
+    enum class Compression
+    {
+        None,
+        Gzip
+    };
+    struct Retention
+    {
+        std::size_t max_files_{0};      // 0: unlimited
+        uint64_t max_age_s_{0};         // by segment start time, 0: unlimited
+        uint64_t max_total_size_{0};    // sum of segment sizes on disk, 0: unlimited
+    };
+    LogRotator();
+    ~LogRotator();
+    LogRotator(const LogRotator&) = delete;
+    LogRotator& operator=(const LogRotator&) = delete;
+
+    // One rename on the caller's thread; file_name must be closed and is free to reopen on return.
+    // The pending name carries the pid, so processes never reuse each other's.
+    bool Rotate(const std::string& file_name, std::size_t max_files, Compression compression);
+    // Queues the pending files an earlier process left behind (<file_name>.rotating.*), oldest
+    // first, so they still go through the cascade. Returns how many were found.
+    std::size_t Recover(const std::string& file_name, std::size_t max_files, Compression compression);
+    // One rename to the segment name for index on the caller's thread, the manifest is updated
+    // and old segments pruned in the background. start_s is when the segment was opened.
+    bool RotateIndexed(const std::string& file_name, uint64_t index, uint64_t start_s,
+                       const Retention& retention, Compression compression);
+    // Blocks until every queued rotation has been processed.
+    void WaitIdle();
+    // Runs fn on the rotator thread every period_ms (later while a job is being processed).
+    uint64_t AddPeriodic(std::function<void()> fn, uint32_t period_ms);
+    // Once it returns fn is not running and never runs again. Not to be called from fn.
+    void RemovePeriodic(uint64_t id);
+    static Compression StringToCompression(const std::string& compression);
+    static bool IsSupported(Compression compression);
+    // <file_name>.<YYYYMMDD-HH of start_s, local time>.<index, 4+ digits>
+    static std::string SegmentName(const std::string& file_name, uint64_t start_s, uint64_t index);
+    static std::string ManifestName(const std::string& file_name)
+    {
+        return file_name + ".manifest";
+    }
+    // One past the highest index in the manifest, so numbering continues across restarts.
+    static uint64_t NextIndex(const std::string& file_name);
+private:
+    struct Job
+    {
+        std::string file_name_;
+        std::string pending_;
+        std::size_t max_files_;
+        Compression compression_;
+        bool indexed_{false};
+        uint64_t index_{0};
+        uint64_t start_s_{0};
+        Retention retention_;
+    };
+    struct Periodic
+    {
+        uint64_t id_;
+        std::chrono::milliseconds period_;
+        std::chrono::steady_clock::time_point next_;
+        std::function<void()> fn_;
+    };
+    struct Segment
+    {
+        uint64_t index_;
+        uint64_t start_s_;
+        uint64_t size_;
+        std::string name_;
+    };
+    void WorkerLoop();
+    // Runs the periodic functions that are due, mutex_ is released while one runs.
+    void RunPeriodic(std::unique_lock<std::mutex>& lock);
+    void Process(const Job& job);
+    void ProcessIndexed(const Job& job);
+    static std::vector<Segment> LoadManifest(const std::string& file_name);
+    static bool StoreManifest(const std::string& file_name, const std::vector<Segment>& segments);
+    static bool Compress(const std::string& src, const std::string& dst);
+private:
+    std::deque<Job> jobs_;
+    bool busy_{false};
+    bool running_{true};
+    std::atomic<uint64_t> sequence_{0};
+    std::vector<Periodic> periodic_;
+    uint64_t next_periodic_id_{1};
+    uint64_t running_periodic_{0};
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::condition_variable idle_cond_;
+    std::unique_ptr<Nazl::Thread> worker_;
+};
+// Shared so that sinks outliving static destruction still hold a live rotator.
+typedef Nazl::SingletonPtr<LogRotator> log_rotator;
+#endif //COMMON_LOG_ROTATOR_H
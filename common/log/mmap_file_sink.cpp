@@ -0,0 +1,279 @@
+//
+// Created by zwz on 2024/10/17.
+//
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mmap_file_sink.h"
+
+namespace
+{
+// A crash leaves the preallocated remainder of the last segment as zeros; find where the data ends.
+std::size_t TrimmedSize(int fd, std::size_t file_size, std::size_t max_scan)
+{
+    char chunk[64 * 1024];
+    std::size_t end = file_size;
+    std::size_t limit = file_size > max_scan ? file_size - max_scan : 0;
+    while (end > limit)
+    {
+        std::size_t len = std::min(sizeof(chunk), end - limit);
+        if (::pread(fd, chunk, len, static_cast<off_t>(end - len)) != static_cast<ssize_t>(len))
+        {
+            return end;
+        }
+        for (std::size_t i = len; i > 0; --i)
+        {
+            if (chunk[i - 1] != '\0')
+            {
+                return end - len + i;
+            }
+        }
+        end -= len;
+    }
+    return end;
+}
+}
+
+MmapFileSink::MmapFileSink(const std::string& file_name, std::size_t max_size, std::size_t max_files,
+                           std::size_t segment_size, LogRotator::Compression compression)
+    : file_name_(file_name), max_size_(max_size), max_files_(max_files), compression_(compression),
+      rotator_(log_rotator::GetInstance())
+{
+    std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    segment_size = segment_size == 0 ? kDefaultSegmentSize : segment_size;
+    segment_size_ = (segment_size + page - 1) / page * page;
+    if (max_size == 0)
+    {
+        max_size_ = 1024 * 1024 * 1024;
+    }
+    if (max_files == 0)
+    {
+        max_files_ = 10;
+    }
+    Open();
+    std::cout << "open mmap file " << file_name_ << std::endl;
+}
+
+MmapFileSink::~MmapFileSink()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    Close();
+}
+
+bool MmapFileSink::Open()
+{
+    if (!Nazl::create_parent_dir(file_name_))
+    {
+        return false;
+    }
+    fd_ = ::open(file_name_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0)
+    {
+        perror(("Failed to open file " + file_name_).c_str());
+        return false;
+    }
+    struct stat st;
+    std::size_t file_size = (::fstat(fd_, &st) == 0) ? static_cast<std::size_t>(st.st_size) : 0;
+    size_ = file_size;
+    // the marker outlives only an unclean close, which may have left a preallocated tail
+    std::string marker = file_name_ + kMappedSuffix;
+    if (::access(marker.c_str(), F_OK) == 0)
+    {
+        size_ = TrimmedSize(fd_, file_size, segment_size_);
+        if (size_ != file_size && ::ftruncate(fd_, static_cast<off_t>(size_)) != 0)
+        {
+            perror(("Failed to trim file " + file_name_).c_str());
+        }
+    }
+    int marker_fd = ::open(marker.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (marker_fd >= 0)
+    {
+        ::close(marker_fd);
+    }
+    return true;
+}
+
+void MmapFileSink::Close()
+{
+    if (fd_ < 0)
+    {
+        return;
+    }
+    Unmap();
+    if (::ftruncate(fd_, static_cast<off_t>(size_)) != 0)
+    {
+        // the tail is still there, keep the marker so the next open trims it
+        perror(("Failed to trim file " + file_name_).c_str());
+    }
+    else
+    {
+        ::unlink((file_name_ + kMappedSuffix).c_str());
+    }
+    ::close(fd_);
+    fd_ = -1;
+}
+
+void MmapFileSink::Unmap()
+{
+    if (map_)
+    {
+        ::msync(map_, segment_size_, MS_ASYNC);
+        ::munmap(map_, segment_size_);
+        map_ = nullptr;
+    }
+}
+
+bool MmapFileSink::MapSegment(std::size_t offset)
+{
+    Unmap();
+    // reserve the blocks up front: a write fault on a sparse page of a full disk is SIGBUS.
+    // Only a file system without fallocate gets a sparse segment; any other failure (ENOSPC,
+    // EDQUOT, ...) leaves the segment unmapped and Append() falls back to write(2).
+    if (::fallocate(fd_, 0, static_cast<off_t>(offset), static_cast<off_t>(segment_size_)) != 0)
+    {
+        if (errno != EOPNOTSUPP && errno != ENOSYS)
+        {
+            if (!segment_failed_)
+            {
+                perror(("Failed to reserve a segment of " + file_name_).c_str());
+                segment_failed_ = true;
+            }
+            return false;
+        }
+        if (::ftruncate(fd_, static_cast<off_t>(offset + segment_size_)) != 0)
+        {
+            perror(("Failed to extend file " + file_name_).c_str());
+            return false;
+        }
+    }
+    segment_failed_ = false;
+    void* map = ::mmap(nullptr, segment_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, static_cast<off_t>(offset));
+    if (map == MAP_FAILED)
+    {
+        perror(("Failed to map file " + file_name_).c_str());
+        return false;
+    }
+    map_ = static_cast<char*>(map);
+    map_offset_ = offset;
+    return true;
+}
+
+void MmapFileSink::Append(const char* data, std::size_t size)
+{
+    while (size > 0)
+    {
+        if (!map_ || size_ >= map_offset_ + segment_size_)
+        {
+            if (fd_ < 0)
+            {
+                dropped_.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            if (!MapSegment(size_ / segment_size_ * segment_size_))
+            {
+                WriteDirect(data, size);
+                return;
+            }
+        }
+        std::size_t len = std::min(size, map_offset_ + segment_size_ - size_);
+        memcpy(map_ + (size_ - map_offset_), data, len);
+        size_ += len;
+        data += len;
+        size -= len;
+    }
+}
+
+void MmapFileSink::WriteDirect(const char* data, std::size_t size)
+{
+    // a failing write(2) reports ENOSPC instead of faulting, the event is dropped
+    while (size > 0)
+    {
+        ssize_t n = ::pwrite(fd_, data, size, static_cast<off_t>(size_));
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        size_ += static_cast<std::size_t>(n);
+        data += n;
+        size -= static_cast<std::size_t>(n);
+    }
+}
+
+void MmapFileSink::Rotate()
+{
+    Close();
+    if (rotator_->Rotate(file_name_, max_files_, compression_))
+    {
+        rotate_backoff_ = std::chrono::milliseconds(0);
+    }
+    else
+    {
+        // keep appending to the live file rather than retrying the rename on every event
+        if (rotate_backoff_.count() == 0)
+        {
+            perror(("Failed to rotate " + file_name_).c_str());
+        }
+        rotate_backoff_ = std::min(std::max(rotate_backoff_ * 2, FileSink::kRotateRetryMin), FileSink::kRotateRetryMax);
+        rotate_retry_at_ = std::chrono::steady_clock::now() + rotate_backoff_;
+    }
+    Open();
+}
+
+void MmapFileSink::Log(const LogEvent& event)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (event.GetLevel().GetLevel() < level_.GetLevel())
+    {
+        return;
+    }
+    buffer_.clear();
+    format_->Format(buffer_, event);
+    if (size_ > 0 && size_ + buffer_.size() > max_size_ &&
+        (rotate_backoff_.count() == 0 || std::chrono::steady_clock::now() >= rotate_retry_at_))
+    {
+        Rotate();
+    }
+    Append(buffer_.data(), buffer_.size());
+}
+
+void MmapFileSink::Flush()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (map_)
+    {
+        ::msync(map_, segment_size_, MS_ASYNC);
+    }
+}
+
+void MmapFileSink::SetFormat(std::shared_ptr<LogFormat> format)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    format_ = std::move(format);
+}
+
+void MmapFileSink::SetLevel(LogLevel log_level)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    level_ = log_level;
+}
+
+LogLevel MmapFileSink::GetLevel()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return level_;
+}
+
+std::size_t MmapFileSink::GetSize()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return size_;
+}
@@ -0,0 +1,74 @@
+//
+// Created by zwz on 2024/10/17.
+//
+
+#ifndef COMMON_MMAP_FILE_SINK_H
+#define COMMON_MMAP_FILE_SINK_H
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "log.h"
+#include "log_rotator.h"
+
+// Appends by memcpy into a shared mapping of the log file. The file grows in fallocate'd
+// segments, one segment is mapped at a time, Flush() is msync(MS_ASYNC) and the unused tail
+// is cut with ftruncate on close. Whatever was copied survives a crash of the process; the
+// zero-filled tail it leaves behind is trimmed the next time the file is opened. The trim only
+// runs when the <file>.mapped marker, created on open and removed by a clean close, is still
+// there: a cleanly closed file keeps trailing zero bytes of its last record. While no segment
+// can be reserved (disk full) events are appended with write(2), which fails instead of faulting.
+// Of FileSinkOptions only compression applies; log_init warns about the others.
+class MmapFileSink : public Sink
+{
+public:
+    static constexpr std::size_t kDefaultSegmentSize = 16 * 1024 * 1024;
+    static constexpr const char* kMappedSuffix = ".mapped";
+
+    MmapFileSink(const std::string& file_name, std::size_t max_size, std::size_t max_files,
+                 std::size_t segment_size = kDefaultSegmentSize,
+                 LogRotator::Compression compression = LogRotator::Compression::None);
+    ~MmapFileSink() override;
+    MmapFileSink(const MmapFileSink&) = delete;
+    MmapFileSink& operator=(const MmapFileSink&) = delete;
+    void Log(const LogEvent& event) override;
+    void Flush() override;
+    void SetFormat(std::shared_ptr<LogFormat> format) override;
+    void SetLevel(LogLevel log_level) override;
+    LogLevel GetLevel() override;
+    // Bytes of log data in the file, excluding the preallocated tail.
+    std::size_t GetSize();
+    // Events lost because no segment could be reserved and write(2) failed too (disk full).
+    uint64_t GetDroppedCount() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+private:
+    bool Open();
+    void Close();
+    bool MapSegment(std::size_t offset);
+    void Unmap();
+    void Append(const char* data, std::size_t size);
+    // Used while segments cannot be reserved.
+    void WriteDirect(const char* data, std::size_t size);
+    void Rotate();
+private:
+    std::string file_name_;
+    std::size_t max_size_;
+    std::size_t max_files_;
+    std::size_t segment_size_;
+    LogRotator::Compression compression_;
+    std::shared_ptr<LogRotator> rotator_;
+    std::chrono::milliseconds rotate_backoff_{0};
+    std::chrono::steady_clock::time_point rotate_retry_at_;
+    int fd_{-1};
+    char* map_{nullptr};
+    std::size_t map_offset_{0};
+    std::size_t size_{0};
+    bool segment_failed_{false};
+    std::atomic<uint64_t> dropped_{0};
+    std::mutex mutex_;
+    fmt::memory_buffer buffer_;
+};
+#endif //COMMON_MMAP_FILE_SINK_H
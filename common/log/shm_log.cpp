@@ -0,0 +1,363 @@
+//
+// Created by zwz on 2024/10/18.
+//
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_log.h"
+
+namespace
+{
+constexpr char kMagic[4] = {'N', 'Z', 'S', 'M'};
+thread_local fmt::memory_buffer t_buffer;
+
+std::string ShmPath(const std::string& name)
+{
+    return "/nazl-log-" + name;
+}
+constexpr uint64_t Align8(uint64_t size)
+{
+    return (size + 7) & ~uint64_t(7);
+}
+}
+
+ShmRing::ShmRing(std::string name, char* map, std::size_t map_size, ino_t inode)
+    : name_(std::move(name)), map_(map), map_size_(map_size), header_(reinterpret_cast<Header*>(map)),
+      data_(map + sizeof(Header)), capacity_(header_->capacity_), inode_(inode)
+{
+}
+
+ShmRing::~ShmRing()
+{
+    ::munmap(map_, map_size_);
+}
+
+std::unique_ptr<ShmRing> ShmRing::Map(const std::string& name, int fd, std::size_t map_size)
+{
+    struct stat st;
+    void* map = ::fstat(fd, &st) == 0 ? ::mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror(("Failed to map log ring " + name).c_str());
+        return nullptr;
+    }
+    return std::unique_ptr<ShmRing>(new ShmRing(name, static_cast<char*>(map), map_size, st.st_ino));
+}
+
+std::unique_ptr<ShmRing> ShmRing::Create(const std::string& name, std::size_t capacity)
+{
+    uint64_t rounded = 4096;
+    while (rounded < capacity)
+    {
+        rounded <<= 1;
+    }
+    std::size_t map_size = sizeof(Header) + rounded;
+    std::string path = ShmPath(name);
+    int fd = ::shm_open(path.c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd >= 0)
+    {
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && static_cast<std::size_t>(st.st_size) == map_size)
+        {
+            auto ring = Map(name, fd, map_size);
+            // a restarted producer picks up where the previous instance stopped
+            if (ring && memcmp(ring->header_->magic_, kMagic, sizeof(kMagic)) == 0 &&
+                ring->header_->version_ == kVersion && ring->capacity_ == rounded)
+            {
+                ring->Attach();
+                return ring;
+            }
+        }
+        else
+        {
+            ::close(fd);
+        }
+        // never shrink a ring in place, a collector that has it mapped would fault on the missing pages
+        ::shm_unlink(path.c_str());
+    }
+    fd = ::shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        perror(("Failed to create log ring " + name).c_str());
+        return nullptr;
+    }
+    if (::ftruncate(fd, static_cast<off_t>(map_size)) != 0)
+    {
+        perror(("Failed to size log ring " + name).c_str());
+        ::close(fd);
+        ::shm_unlink(path.c_str());
+        return nullptr;
+    }
+    auto* header = reinterpret_cast<Header*>(::mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    if (header == MAP_FAILED)
+    {
+        perror(("Failed to map log ring " + name).c_str());
+        ::close(fd);
+        return nullptr;
+    }
+    header->version_ = kVersion;
+    header->capacity_ = rounded;
+    header->pid_ = static_cast<uint32_t>(::getpid());
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header->magic_, kMagic, sizeof(kMagic));
+    ::munmap(header, map_size);
+    return Map(name, fd, map_size);
+}
+
+void ShmRing::Attach()
+{
+    auto previous = static_cast<pid_t>(header_->pid_);
+    pid_t self = ::getpid();
+    header_->pid_ = static_cast<uint32_t>(self);
+    if (previous == self || previous <= 0 || ::kill(previous, 0) == 0 || errno != ESRCH)
+    {
+        return;
+    }
+    // nobody writes between here and our first TryWrite, so everything reserved is the dead owner's
+    uint64_t reserved = header_->reserve_pos_.load(std::memory_order_relaxed);
+    if (reserved != header_->read_pos_.load(std::memory_order_acquire))
+    {
+        header_->abandoned_pos_.store(reserved, std::memory_order_release);
+    }
+}
+
+bool ShmRing::IsReplaced() const
+{
+    int fd = ::shm_open(ShmPath(name_).c_str(), O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return true;
+    }
+    struct stat st;
+    bool replaced = ::fstat(fd, &st) != 0 || st.st_ino != inode_;
+    ::close(fd);
+    return replaced;
+}
+
+void ShmRing::Clear(uint64_t from, uint64_t to)
+{
+    while (from < to)
+    {
+        uint64_t offset = from & (capacity_ - 1);
+        uint64_t length = std::min(to - from, capacity_ - offset);
+        memset(data_ + offset, 0, length);
+        from += length;
+    }
+}
+
+std::unique_ptr<ShmRing> ShmRing::Open(const std::string& name)
+{
+    int fd = ::shm_open(ShmPath(name).c_str(), O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return nullptr;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) <= sizeof(Header))
+    {
+        ::close(fd);
+        return nullptr;
+    }
+    auto ring = Map(name, fd, static_cast<std::size_t>(st.st_size));
+    if (!ring || memcmp(ring->header_->magic_, kMagic, sizeof(kMagic)) != 0 || ring->header_->version_ != kVersion ||
+        sizeof(Header) + ring->capacity_ != ring->map_size_)
+    {
+        return nullptr;
+    }
+    return ring;
+}
+
+bool ShmRing::Remove(const std::string& name)
+{
+    return ::shm_unlink(ShmPath(name).c_str()) == 0;
+}
+
+bool ShmRing::TryWrite(uint64_t timestamp, const char* data, std::size_t size)
+{
+    uint64_t need = Align8(sizeof(RecordHeader) + size);
+    if (need > capacity_ / 2)
+    {
+        header_->dropped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    uint64_t pos = header_->reserve_pos_.load(std::memory_order_relaxed);
+    uint64_t pad;
+    for (;;)
+    {
+        uint64_t offset = pos & (capacity_ - 1);
+        pad = offset + need > capacity_ ? capacity_ - offset : 0;
+        if (pos + pad + need - header_->read_pos_.load(std::memory_order_acquire) > capacity_)
+        {
+            header_->dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (header_->reserve_pos_.compare_exchange_weak(pos, pos + pad + need, std::memory_order_relaxed))
+        {
+            break;
+        }
+    }
+    if (pad >= sizeof(RecordHeader))
+    {
+        RecordHeader* padding = At(pos);
+        padding->size_ = static_cast<uint32_t>(pad);
+        padding->state_.store(Padding, std::memory_order_release);
+    }
+    RecordHeader* record = At(pos + pad);
+    record->size_ = static_cast<uint32_t>(size);
+    record->timestamp_ = timestamp;
+    memcpy(reinterpret_cast<char*>(record + 1), data, size);
+    record->state_.store(Ready, std::memory_order_release);
+    return true;
+}
+
+std::size_t ShmRing::Drain(const std::function<void(uint64_t timestamp, std::string_view data)>& fn)
+{
+    uint64_t pos = header_->read_pos_.load(std::memory_order_relaxed);
+    uint64_t reserved = header_->reserve_pos_.load(std::memory_order_acquire);
+    std::size_t count = 0;
+    while (pos < reserved)
+    {
+        uint64_t left = capacity_ - (pos & (capacity_ - 1));
+        if (left < sizeof(RecordHeader))
+        {
+            // implicit padding: too small for a header, nothing was written there
+            pos += left;
+            continue;
+        }
+        RecordHeader* record = At(pos);
+        uint32_t state = record->state_.load(std::memory_order_acquire);
+        if (state == Empty)
+        {
+            uint64_t abandoned = header_->abandoned_pos_.load(std::memory_order_acquire);
+            if (pos >= abandoned)
+            {
+                // reserved but not committed yet
+                break;
+            }
+            // left behind by a producer that died: drop the rest of what it reserved
+            Clear(pos, abandoned);
+            header_->dropped_.fetch_add(1, std::memory_order_relaxed);
+            pos = abandoned;
+            continue;
+        }
+        uint64_t total = state == Padding ? record->size_ : Align8(sizeof(RecordHeader) + record->size_);
+        if (state == Ready)
+        {
+            fn(record->timestamp_, std::string_view(reinterpret_cast<const char*>(record + 1), record->size_));
+            ++count;
+        }
+        memset(static_cast<void*>(record), 0, total);
+        pos += total;
+    }
+    header_->read_pos_.store(pos, std::memory_order_release);
+    return count;
+}
+
+SharedMemorySink::SharedMemorySink(const std::string& name, std::size_t capacity)
+    : ring_(ShmRing::Create(name, capacity)), active_format_(format_.get()), active_level_(level_.GetLevel())
+{
+    formats_.push_back(format_);
+}
+
+void SharedMemorySink::Log(const LogEvent& event)
+{
+    if (!ring_ || event.GetLevel().GetLevel() < active_level_.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    t_buffer.clear();
+    active_format_.load(std::memory_order_acquire)->Format(t_buffer, event);
+    ring_->TryWrite(event.GetTimestamp(), t_buffer.data(), t_buffer.size());
+}
+
+void SharedMemorySink::Flush()
+{
+    // records are visible to the collector as soon as they are committed
+}
+
+void SharedMemorySink::SetFormat(std::shared_ptr<LogFormat> format)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    format_ = format;
+    formats_.push_back(format);
+    active_format_.store(format.get(), std::memory_order_release);
+}
+
+void SharedMemorySink::SetLevel(LogLevel log_level)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    level_ = log_level;
+    active_level_.store(log_level.GetLevel(), std::memory_order_relaxed);
+}
+
+LogLevel SharedMemorySink::GetLevel()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return level_;
+}
+
+void LogCollector::AddRing(const std::string& name)
+{
+    names_.push_back(name);
+    rings_.push_back(ShmRing::Open(name));
+}
+
+std::size_t LogCollector::Collect(const std::function<void(std::string_view data)>& out, bool final)
+{
+    for (std::size_t i = 0; i < rings_.size(); ++i)
+    {
+        if (!rings_[i])
+        {
+            rings_[i] = ShmRing::Open(names_[i]);
+            if (!rings_[i])
+            {
+                continue;
+            }
+        }
+        auto add = [this](uint64_t timestamp, std::string_view data)
+        {
+            pending_.push_back(Pending{timestamp, seq_++, std::string(data)});
+        };
+        if (rings_[i]->Drain(add) == 0 && rings_[i]->IsReplaced())
+        {
+            // the producer recreated the ring (other size) or it was removed: finish the old one, switch
+            rings_[i]->Drain(add);
+            replaced_dropped_ += rings_[i]->GetDroppedCount();
+            rings_[i] = ShmRing::Open(names_[i]);
+            if (rings_[i])
+            {
+                rings_[i]->Drain(add);
+            }
+        }
+    }
+    std::sort(pending_.begin(), pending_.end(), [](const Pending& a, const Pending& b)
+    {
+        return a.timestamp_ != b.timestamp_ ? a.timestamp_ < b.timestamp_ : a.seq_ < b.seq_;
+    });
+    uint64_t horizon = final ? UINT64_MAX : LogEvent::Now() - hold_ns_;
+    std::size_t ready = 0;
+    while (ready < pending_.size() && pending_[ready].timestamp_ <= horizon)
+    {
+        out(pending_[ready].data_);
+        ++ready;
+    }
+    pending_.erase(pending_.begin(), pending_.begin() + static_cast<std::ptrdiff_t>(ready));
+    return ready;
+}
+
+uint64_t LogCollector::GetDroppedCount() const
+{
+    uint64_t dropped = replaced_dropped_;
+    for (auto& ring : rings_)
+    {
+        dropped += ring ? ring->GetDroppedCount() : 0;
+    }
+    return dropped;
+}
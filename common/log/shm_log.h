@@ -0,0 +1,161 @@
+//
+// Created by zwz on 2024/10/18.
+//
+
+#ifndef COMMON_SHM_LOG_H
+#define COMMON_SHM_LOG_H
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <sys/types.h>
+#include "log.h"
+
+// Multi-producer ring of timestamped records in POSIX shared memory (/dev/shm/nazl-log-<name>),
+// written by the threads of one process and drained by a collector process. Writing is a CAS on
+// the reserve position, a memcpy and a release store: no syscall, no lock. A full ring drops.
+//
+// Records are 8-byte aligned: RecordHeader + payload. A record that would cross the end of the
+// ring is preceded by a padding record (or by nothing when less than a header is left). The
+// collector zeroes what it consumed so that a header reads as Empty until it is committed.
+//
+// A producer that dies between reserving and committing leaves an Empty record the collector would
+// wait on forever. When a restarted producer finds the previous owner dead it publishes the reserve
+// position in abandoned_pos_; the collector skips an Empty record below it, together with whatever
+// the dead producer committed after it.
+class ShmRing
+{
+public:
+    static constexpr std::size_t kDefaultCapacity = 4 * 1024 * 1024;
+    static constexpr uint32_t kVersion = 2;
+
+    struct alignas(64) Header
+    {
+        char magic_[4];
+        uint32_t version_;
+        uint64_t capacity_;
+        uint32_t pid_;
+        std::atomic<uint64_t> dropped_;
+        std::atomic<uint64_t> abandoned_pos_;
+        alignas(64) std::atomic<uint64_t> reserve_pos_;
+        alignas(64) std::atomic<uint64_t> read_pos_;
+    };
+    enum RecordState : uint32_t
+    {
+        Empty = 0,
+        Ready = 1,
+        Padding = 2
+    };
+    struct RecordHeader
+    {
+        std::atomic<uint32_t> state_;
+        uint32_t size_;  // payload bytes, or whole padding size
+        uint64_t timestamp_;
+    };
+
+    // Producer side: attaches to the ring if it exists with the same capacity, creates it otherwise.
+    // A ring of another size or version is unlinked and created anew, a collector that mapped it
+    // keeps reading the old one until it notices (IsReplaced). capacity is rounded up to a power of two.
+    static std::unique_ptr<ShmRing> Create(const std::string& name, std::size_t capacity = kDefaultCapacity);
+    // Collector side: attaches to an existing ring, nullptr if there is none (yet).
+    static std::unique_ptr<ShmRing> Open(const std::string& name);
+    static bool Remove(const std::string& name);
+    // True when the name no longer refers to the ring mapped here (removed or recreated).
+    bool IsReplaced() const;
+    ~ShmRing();
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    bool TryWrite(uint64_t timestamp, const char* data, std::size_t size);
+    // Collector side, single consumer: hands every committed record to fn in ring order.
+    std::size_t Drain(const std::function<void(uint64_t timestamp, std::string_view data)>& fn);
+    uint64_t GetDroppedCount() const
+    {
+        return header_->dropped_.load(std::memory_order_relaxed);
+    }
+    const std::string& GetName() const
+    {
+        return name_;
+    }
+private:
+    ShmRing(std::string name, char* map, std::size_t map_size, ino_t inode);
+    static std::unique_ptr<ShmRing> Map(const std::string& name, int fd, std::size_t map_size);
+    // Producer side: recovers the ring from a previous owner that died, see abandoned_pos_.
+    void Attach();
+    // Collector side: zeroes [from, to).
+    void Clear(uint64_t from, uint64_t to);
+    RecordHeader* At(uint64_t pos)
+    {
+        return reinterpret_cast<RecordHeader*>(data_ + (pos & (capacity_ - 1)));
+    }
+private:
+    std::string name_;
+    char* map_;
+    std::size_t map_size_;
+    Header* header_;
+    char* data_;
+    uint64_t capacity_;
+    ino_t inode_;
+};
+
+// Publishes formatted events into this process' ShmRing. Like FlightRecorderSink, Log() takes no
+// lock; the format may be "binary" or "json" for a collector feeding an indexer.
+class SharedMemorySink : public Sink
+{
+public:
+    explicit SharedMemorySink(const std::string& name, std::size_t capacity = ShmRing::kDefaultCapacity);
+    ~SharedMemorySink() override = default;
+    SharedMemorySink(const SharedMemorySink&) = delete;
+    SharedMemorySink& operator=(const SharedMemorySink&) = delete;
+    bool IsOpen() const
+    {
+        return ring_ != nullptr;
+    }
+    void Log(const LogEvent& event) override;
+    void Flush() override;
+    void SetFormat(std::shared_ptr<LogFormat> format) override;
+    void SetLevel(LogLevel log_level) override;
+    LogLevel GetLevel() override;
+    uint64_t GetDroppedCount() const
+    {
+        return ring_ ? ring_->GetDroppedCount() : 0;
+    }
+private:
+    std::unique_ptr<ShmRing> ring_;
+    std::atomic<LogFormat*> active_format_;
+    std::atomic<LogLevel::LevelEnum> active_level_;
+    std::vector<std::shared_ptr<LogFormat>> formats_;
+    std::mutex mutex_;
+};
+
+// Merges several rings into one stream ordered by event time. Records are held back for the
+// hold window so that late records from a slower producer can still be sorted in.
+class LogCollector
+{
+public:
+    explicit LogCollector(std::chrono::milliseconds hold = std::chrono::milliseconds(100))
+        : hold_ns_(static_cast<uint64_t>(hold.count()) * 1000000ull) {}
+    // Rings that do not exist yet are retried on every Collect().
+    void AddRing(const std::string& name);
+    // Passes records older than the hold window (all of them if final) to out, oldest first.
+    std::size_t Collect(const std::function<void(std::string_view data)>& out, bool final = false);
+    uint64_t GetDroppedCount() const;
+private:
+    struct Pending
+    {
+        uint64_t timestamp_;
+        uint64_t seq_;
+        std::string data_;
+    };
+    uint64_t hold_ns_;
+    uint64_t seq_{0};
+    std::vector<std::string> names_;
+    std::vector<std::unique_ptr<ShmRing>> rings_;
+    std::vector<Pending> pending_;
+    // drops counted by rings that were replaced since
+    uint64_t replaced_dropped_{0};
+};
+#endif //COMMON_SHM_LOG_H
@@ -0,0 +1,414 @@
+//
+// Created by zwz on 2024/10/18.
+//
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "socket_sink.h"
+
+namespace
+{
+int SocketType(SocketSink::Type type)
+{
+    return type == SocketSink::Type::SeqPacket ? SOCK_SEQPACKET : SOCK_DGRAM;
+}
+bool MakeAddress(const std::string& path, sockaddr_un& addr)
+{
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+    {
+        return false;
+    }
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    return true;
+}
+}
+
+SocketSink::SocketSink(const std::string& path, Type type, std::size_t max_pending)
+    : path_(path), type_(type), max_pending_(max_pending)
+{
+    sockaddr_un addr;
+    if (!MakeAddress(path_, addr))
+    {
+        std::cerr << "log socket path too long: " << path_ << std::endl;
+    }
+    sender_ = std::make_unique<Nazl::Thread>([this] { SenderLoop(); }, "log-socket");
+}
+SocketSink::~SocketSink()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        running_ = false;
+    }
+    sender_cond_.notify_one();
+    sender_->join();
+}
+
+SocketSink::Type SocketSink::StringToType(const std::string& type)
+{
+    return type == "seqpacket" ? Type::SeqPacket : Type::Datagram;
+}
+
+bool SocketSink::Connect()
+{
+    sockaddr_un addr;
+    if (!MakeAddress(path_, addr))
+    {
+        return false;
+    }
+    int fd = ::socket(AF_UNIX, SocketType(type_) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return false;
+    }
+    // no receiver yet is the common case at startup, retried quietly
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+    fd_ = fd;
+    return true;
+}
+void SocketSink::Disconnect()
+{
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        fd_ = -1;
+    }
+}
+
+bool SocketSink::SendRetry()
+{
+    mmsghdr messages[kMaxBatch];
+    iovec iov[kMaxBatch];
+    while (retry_head_ < retry_.sizes_.size())
+    {
+        std::size_t count = std::min(kMaxBatch, retry_.sizes_.size() - retry_head_);
+        std::size_t offset = retry_offset_;
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            iov[i].iov_base = retry_.data_.data() + offset;
+            iov[i].iov_len = retry_.sizes_[retry_head_ + i];
+            memset(&messages[i], 0, sizeof(messages[i]));
+            messages[i].msg_hdr.msg_iov = &iov[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+            offset += iov[i].iov_len;
+        }
+        int sent = ::sendmmsg(fd_, messages, static_cast<unsigned int>(count), MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent > 0)
+        {
+            for (int i = 0; i < sent; ++i)
+            {
+                retry_offset_ += retry_.sizes_[retry_head_++];
+            }
+            sent_.fetch_add(static_cast<uint64_t>(sent), std::memory_order_relaxed);
+            continue;
+        }
+        if (errno == EINTR)
+        {
+            continue;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+        {
+            return false;
+        }
+        if (errno == EMSGSIZE)
+        {
+            // never fits, skip it
+            retry_offset_ += retry_.sizes_[retry_head_++];
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        // receiver gone or restarted (ECONNREFUSED, ENOTCONN, EPIPE, ...): reconnect on the next round
+        Disconnect();
+        return false;
+    }
+    return true;
+}
+bool SocketSink::SendDroppedSummary()
+{
+    uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped == reported_dropped_)
+    {
+        return true;
+    }
+    fmt::memory_buffer summary;
+    fmt::format_to(std::back_inserter(summary), "SocketSink dropped {} events, receiver too slow or absent\n",
+                   dropped - reported_dropped_);
+    if (::send(fd_, summary.data(), summary.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            Disconnect();
+        }
+        return false;
+    }
+    reported_dropped_ = dropped;
+    return true;
+}
+
+void SocketSink::SenderLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;)
+    {
+        bool retrying = retry_head_ < retry_.sizes_.size();
+        // a summary still to send keeps the loop going like a message to retry
+        if (!retrying && dropped_.load(std::memory_order_relaxed) == reported_dropped_)
+        {
+            sender_cond_.wait(lock, [this] { return !pending_.sizes_.empty() || !running_; });
+            if (pending_.sizes_.empty())
+            {
+                break;
+            }
+        }
+        bool stopping = !running_;
+        if (!retrying)
+        {
+            retry_.data_.clear();
+            retry_.sizes_.clear();
+            retry_head_ = 0;
+            retry_offset_ = 0;
+            std::swap(retry_, pending_);
+        }
+        else if (!pending_.sizes_.empty())
+        {
+            retry_.data_.append(pending_.data_.data(), pending_.data_.data() + pending_.data_.size());
+            retry_.sizes_.insert(retry_.sizes_.end(), pending_.sizes_.begin(), pending_.sizes_.end());
+            pending_.data_.clear();
+            pending_.sizes_.clear();
+        }
+        retry_bytes_.store(retry_.data_.size() - retry_offset_, std::memory_order_relaxed);
+        lock.unlock();
+
+        bool drained = (fd_ >= 0 || Connect()) && SendRetry() && SendDroppedSummary();
+        if (retry_offset_ > retry_.data_.size() / 2)
+        {
+            // drop the sent prefix before the buffer grows further
+            std::size_t left = retry_.data_.size() - retry_offset_;
+            memmove(retry_.data_.data(), retry_.data_.data() + retry_offset_, left);
+            retry_.data_.resize(left);
+            retry_.sizes_.erase(retry_.sizes_.begin(), retry_.sizes_.begin() + static_cast<std::ptrdiff_t>(retry_head_));
+            retry_head_ = 0;
+            retry_offset_ = 0;
+        }
+        retry_bytes_.store(retry_.data_.size() - retry_offset_, std::memory_order_relaxed);
+
+        lock.lock();
+        std::size_t left = retry_.sizes_.size() - retry_head_;
+        done_ = appended_ - pending_.sizes_.size() - left;
+        flushed_cond_.notify_all();
+        if (drained)
+        {
+            continue;
+        }
+        if (stopping)
+        {
+            dropped_.fetch_add(left + pending_.sizes_.size(), std::memory_order_relaxed);
+            break;
+        }
+        if (fd_ >= 0)
+        {
+            // receiver queue full: wait until it takes messages again
+            lock.unlock();
+            pollfd writable{fd_, POLLOUT, 0};
+            ::poll(&writable, 1, kRetryIntervalMs);
+            lock.lock();
+        }
+        else
+        {
+            sender_cond_.wait_for(lock, std::chrono::milliseconds(kRetryIntervalMs), [this] { return !running_; });
+        }
+    }
+    Disconnect();
+}
+
+void SocketSink::Log(const LogEvent& event)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (event.GetLevel().GetLevel() < level_.GetLevel())
+    {
+        return;
+    }
+    if (pending_.data_.size() + retry_bytes_.load(std::memory_order_relaxed) >= max_pending_)
+    {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    bool wake = pending_.sizes_.empty();
+    std::size_t before = pending_.data_.size();
+    format_->Format(pending_.data_, event);
+    pending_.sizes_.push_back(static_cast<uint32_t>(pending_.data_.size() - before));
+    ++appended_;
+    lock.unlock();
+    if (wake)
+    {
+        sender_cond_.notify_one();
+    }
+}
+void SocketSink::Flush()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t target = appended_;
+    flushed_cond_.wait_for(lock, std::chrono::milliseconds(kFlushTimeoutMs), [this, target] { return done_ >= target; });
+}
+void SocketSink::SetFormat(std::shared_ptr<LogFormat> format)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    format_ = std::move(format);
+}
+void SocketSink::SetLevel(LogLevel log_level)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    level_ = log_level;
+}
+LogLevel SocketSink::GetLevel()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return level_;
+}
+
+SocketLogReceiver::SocketLogReceiver(const std::string& path, SocketSink::Type type)
+    : path_(path), type_(type), buffers_(kBatch * kMaxMessageSize)
+{
+    sockaddr_un addr;
+    if (!MakeAddress(path_, addr))
+    {
+        std::cerr << "log socket path too long: " << path_ << std::endl;
+        return;
+    }
+    ::unlink(path_.c_str());
+    fd_ = ::socket(AF_UNIX, SocketType(type_) | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd_ < 0 || ::bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        (type_ == SocketSink::Type::SeqPacket && ::listen(fd_, 16) != 0))
+    {
+        perror(("Failed to bind log socket " + path_).c_str());
+        if (fd_ >= 0)
+        {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+}
+SocketLogReceiver::~SocketLogReceiver()
+{
+    for (int peer : peers_)
+    {
+        ::close(peer);
+    }
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+        ::unlink(path_.c_str());
+    }
+}
+
+std::size_t SocketLogReceiver::ReceiveFrom(int fd, const std::function<void(std::string_view message)>& fn, bool& closed)
+{
+    mmsghdr messages[kBatch];
+    iovec iov[kBatch];
+    std::size_t received = 0;
+    for (;;)
+    {
+        for (std::size_t i = 0; i < kBatch; ++i)
+        {
+            iov[i].iov_base = buffers_.data() + i * kMaxMessageSize;
+            iov[i].iov_len = kMaxMessageSize;
+            memset(&messages[i], 0, sizeof(messages[i]));
+            messages[i].msg_hdr.msg_iov = &iov[i];
+            messages[i].msg_hdr.msg_iovlen = 1;
+        }
+        int count = ::recvmmsg(fd, messages, kBatch, MSG_DONTWAIT, nullptr);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            closed = errno != EAGAIN && errno != EWOULDBLOCK;
+            return received;
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            // an empty SeqPacket read is the sender hanging up
+            if (type_ == SocketSink::Type::SeqPacket && messages[i].msg_len == 0)
+            {
+                closed = true;
+                return received;
+            }
+            fn(std::string_view(static_cast<const char*>(iov[i].iov_base), messages[i].msg_len));
+            ++received;
+        }
+        if (count == 0)
+        {
+            closed = type_ == SocketSink::Type::SeqPacket;
+            return received;
+        }
+    }
+}
+std::size_t SocketLogReceiver::Receive(const std::function<void(std::string_view message)>& fn, int timeout_ms)
+{
+    if (fd_ < 0)
+    {
+        return 0;
+    }
+    std::vector<pollfd> fds;
+    fds.push_back({fd_, POLLIN, 0});
+    for (int peer : peers_)
+    {
+        fds.push_back({peer, POLLIN, 0});
+    }
+    if (::poll(fds.data(), fds.size(), timeout_ms) <= 0)
+    {
+        return 0;
+    }
+    std::size_t received = 0;
+    bool closed = false;
+    if (fds[0].revents & POLLIN)
+    {
+        if (type_ == SocketSink::Type::SeqPacket)
+        {
+            int peer;
+            while ((peer = ::accept4(fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+            {
+                peers_.push_back(peer);
+                received += ReceiveFrom(peer, fn, closed);
+                if (closed)
+                {
+                    ::close(peer);
+                    peers_.pop_back();
+                    closed = false;
+                }
+            }
+        }
+        else
+        {
+            received += ReceiveFrom(fd_, fn, closed);
+        }
+    }
+    for (std::size_t i = 1; i < fds.size(); ++i)
+    {
+        if (fds[i].revents == 0)
+        {
+            continue;
+        }
+        closed = false;
+        received += ReceiveFrom(fds[i].fd, fn, closed);
+        if (closed || (fds[i].revents & (POLLHUP | POLLERR)))
+        {
+            ::close(fds[i].fd);
+            peers_.erase(std::find(peers_.begin(), peers_.end(), fds[i].fd));
+        }
+    }
+    return received;
+}
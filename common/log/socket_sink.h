@@ -0,0 +1,124 @@
+//
+// Created by zwz on 2024/10/18.
+//
+
+#ifndef COMMON_SOCKET_SINK_H
+#define COMMON_SOCKET_SINK_H
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "log.h"
+
+// Ships events to a local log daemon over a Unix socket, one message per event, without touching
+// the disk in-process. Log() only appends the formatted event to a pending buffer; a "log-socket"
+// thread hands everything pending to the kernel with sendmmsg(MSG_DONTWAIT), kMaxBatch messages per
+// call. Messages the socket does not take (receiver queue full, no receiver yet, receiver gone)
+// stay in the retry buffer and are retried on POLLOUT or every kRetryIntervalMs with a reconnect.
+// While max_pending bytes are pending or waiting for a retry, new events are dropped, counted and
+// summarized in a message of their own once the socket takes messages again.
+class SocketSink : public Sink
+{
+public:
+    enum class Type
+    {
+        Datagram,   // SOCK_DGRAM: no connection state, the receiver may restart at will
+        SeqPacket   // SOCK_SEQPACKET: the receiver sees the sender come and go
+    };
+    static constexpr std::size_t kDefaultMaxPending = 1024 * 1024;
+    static constexpr std::size_t kMaxBatch = 64;
+    static constexpr uint32_t kRetryIntervalMs = 100;
+    // Flush() gives up after this long, the rest stays in the retry buffer
+    static constexpr uint32_t kFlushTimeoutMs = 1000;
+
+    explicit SocketSink(const std::string& path, Type type = Type::Datagram, std::size_t max_pending = kDefaultMaxPending);
+    ~SocketSink() override;
+    SocketSink(const SocketSink&) = delete;
+    SocketSink& operator=(const SocketSink&) = delete;
+    void Log(const LogEvent& event) override;
+    // Blocks until everything logged before the call was sent, or for kFlushTimeoutMs at most.
+    void Flush() override;
+    void SetFormat(std::shared_ptr<LogFormat> format) override;
+    void SetLevel(LogLevel log_level) override;
+    LogLevel GetLevel() override;
+    uint64_t GetDroppedCount() const
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+    uint64_t GetSentCount() const
+    {
+        return sent_.load(std::memory_order_relaxed);
+    }
+    // "seqpacket"; anything else ("datagram") is Datagram.
+    static Type StringToType(const std::string& type);
+private:
+    // Messages waiting to be sent, back to back, and their sizes.
+    struct Batch
+    {
+        fmt::memory_buffer data_;
+        std::vector<uint32_t> sizes_;
+    };
+    void SenderLoop();
+    bool Connect();
+    void Disconnect();
+    // Sends the retry buffer from its head; false when the socket stopped taking messages.
+    bool SendRetry();
+    bool SendDroppedSummary();
+private:
+    std::string path_;
+    Type type_;
+    std::size_t max_pending_;
+    int fd_{-1};
+    std::mutex mutex_;
+    Batch pending_;
+    bool running_{true};
+    uint64_t appended_{0};
+    uint64_t done_{0};          // messages sent or discarded (too large for the socket)
+    std::atomic<std::size_t> retry_bytes_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> sent_{0};
+    std::condition_variable sender_cond_;
+    std::condition_variable flushed_cond_;
+    // sender thread only
+    Batch retry_;
+    std::size_t retry_head_{0};
+    std::size_t retry_offset_{0};
+    uint64_t reported_dropped_{0};
+    std::unique_ptr<Nazl::Thread> sender_;
+};
+
+// Stand-in for the log daemon, for tests and for a quick look at what a process sends
+// (see nazl_log_receiver): binds the socket, replacing a stale one, and hands each message to fn.
+// SeqPacket accepts any number of senders.
+class SocketLogReceiver
+{
+public:
+    static constexpr std::size_t kMaxMessageSize = 64 * 1024;
+    static constexpr std::size_t kBatch = 16;
+
+    explicit SocketLogReceiver(const std::string& path, SocketSink::Type type = SocketSink::Type::Datagram);
+    ~SocketLogReceiver();
+    SocketLogReceiver(const SocketLogReceiver&) = delete;
+    SocketLogReceiver& operator=(const SocketLogReceiver&) = delete;
+    bool IsOpen() const
+    {
+        return fd_ >= 0;
+    }
+    // Waits up to timeout_ms (-1: forever) for messages, returns how many were handed to fn.
+    std::size_t Receive(const std::function<void(std::string_view message)>& fn, int timeout_ms);
+private:
+    // Reads what is queued on fd; closed is set when a SeqPacket sender went away.
+    std::size_t ReceiveFrom(int fd, const std::function<void(std::string_view message)>& fn, bool& closed);
+private:
+    std::string path_;
+    SocketSink::Type type_;
+    int fd_{-1};
+    std::vector<int> peers_;
+    std::vector<char> buffers_;
+};
+
+#endif //COMMON_SOCKET_SINK_H
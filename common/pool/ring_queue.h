@@ -0,0 +1,125 @@
+//
+// Created by zwz on 2024/10/14.
+//
+
+#ifndef COMMON_RING_QUEUE_H
+#define COMMON_RING_QUEUE_H
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include "noncopyable.h"
+namespace Nazl
+{
+// Bounded lock-free queue (Vyukov). Safe for any number of producers and consumers,
+// so a producer may also pop to make room for an overwrite-oldest policy.
+template<typename T>
+class RingQueue : public Noncopyable
+{
+public:
+    explicit RingQueue(std::size_t capacity)
+    {
+        std::size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        mask_ = size - 1;
+        cells_.reset(new Cell[size]);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            cells_[i].sequence_.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    template<typename U>
+    bool tryPush(U&& value)
+    {
+        Cell* cell;
+        std::size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            std::size_t seq = cell->sequence_.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->data_ = std::forward<U>(value);
+        cell->sequence_.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool tryPop(T& value)
+    {
+        Cell* cell;
+        std::size_t pos = dequeuePos_.load(std::memory_order_relaxed);
+        for (;;)
+        {
+            cell = &cells_[pos & mask_];
+            std::size_t seq = cell->sequence_.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeuePos_.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->data_);
+        cell->sequence_.store(pos + mask_ + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::size_t capacity() const noexcept
+    {
+        return mask_ + 1;
+    }
+    // approximate under concurrent use
+    std::size_t size() const noexcept
+    {
+        std::size_t tail = enqueuePos_.load(std::memory_order_relaxed);
+        std::size_t head = dequeuePos_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+    bool empty() const noexcept
+    {
+        return size() == 0;
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence_;
+        T data_;
+    };
+    std::unique_ptr<Cell[]> cells_;
+    std::size_t mask_;
+    alignas(64) std::atomic<std::size_t> enqueuePos_{0};
+    alignas(64) std::atomic<std::size_t> dequeuePos_{0};
+};
+}
+#endif //COMMON_RING_QUEUE_H
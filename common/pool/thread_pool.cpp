@@ -1,10 +1,37 @@
 //
 // Created by zwz on 2024/9/17.
 //
+#include <cstring>
 #include <iostream>
 #include "thread_pool.h"
 namespace Nazl
 {
+namespace
+{
+constexpr std::size_t kNameSize = 16;
+thread_local pid_t t_tid = 0;
+thread_local char t_name[kNameSize] = {0};
+
+// the forking thread lives on in the child under a new tid
+void UpdateTidAfterFork()
+{
+    if (t_tid != 0)
+    {
+        t_tid = static_cast<pid_t>(syscall(SYS_gettid));
+    }
+}
+const int kAtForkRegistered = pthread_atfork(nullptr, nullptr, &UpdateTidAfterFork);
+}
+
+pid_t Thread::CurrentTid()
+{
+    return t_tid;
+}
+
+const char* Thread::CurrentName()
+{
+    return t_tid != 0 ? t_name : nullptr;
+}
 
 Thread::Thread(const Thread::ThreadFunc& func, const std::string &name)
     : name_(name), func_(std::move(func)), thread_id_(0), tid_(0)
@@ -53,6 +80,8 @@ void* Thread::run(void* arg)
     Thread *p = static_cast<Thread*>(arg);
     p->tid_ = syscall(SYS_gettid);
     pthread_setname_np(p->thread_id_, p->name_.c_str());
+    t_tid = p->tid_;
+    strncpy(t_name, p->name_.c_str(), kNameSize - 1);
     sem_post(&p->sem_);
     ThreadFunc cb;
     cb.swap(p->func_);
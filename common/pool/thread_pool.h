@@ -26,14 +26,20 @@ public:
 public:
     explicit Thread(const ThreadFunc& func, const std::string& name = "");
     ~Thread();
+    // Kernel thread id, set before the constructor returns.
     pid_t Tid() const
     {
-        return static_cast<pid_t>(::syscall(SYS_gettid));
+        return tid_;
     };
     const std::string& GetName() const
     {
         return name_;
     }
+    // Identity of the calling thread when it was started through Thread, copied at start so that it
+    // stays valid after the Thread object is gone: kernel tid (0 otherwise, kept right in a forked
+    // child) and name (nullptr otherwise).
+    static pid_t CurrentTid();
+    static const char* CurrentName();
     void join();
 private:
     static void* run(void* arg);
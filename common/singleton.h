@@ -25,6 +25,7 @@ private:
 template<typename T>
 class SingletonPtr
 {
+public:
     static std::shared_ptr<T> GetInstance()
     {
         static std::shared_ptr<T> instance(new T());
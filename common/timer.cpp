@@ -1,5 +1,6 @@
 #include "timer.h"
 #include <chrono>
+#include "log_modules.h"
 
 namespace Nazl
 {
@@ -24,6 +25,10 @@ TimerMgr::TimerMgr()
 
 TimerMgr::~TimerMgr()
 {
+    if (statsTimer_)
+    {
+        stop(*statsTimer_);
+    }
     mainThreadAlive = false;
     cond_.notify_all();
     if (timerHandlerThread_.joinable())
@@ -35,7 +40,6 @@ TimerMgr::~TimerMgr()
 Timer TimerMgr::createTimer(long long timeoutMicros, TimerCallback callback, bool periodic)
 {
     int id = timerId_.fetch_add(1);
-    std::cout << "Create: Timer id " << id << " created with timeout " << timeoutMicros << " microseconds and periodic " << periodic << std::endl;
     return Timer(id, timeoutMicros, std::move(callback), periodic);
 }
 
@@ -44,7 +48,6 @@ void TimerMgr::enqueueNode(const TimerNodeRefPtr& node)
     std::lock_guard<std::mutex> lock(mutex_);
     queue_.push(node);
     nodeMap_[node->id_] = node;
-    std::cout << "Enqueue: Timer id " << node->id_ << " enqueued with timeout " << node->timeout_ << std::endl;
     cond_.notify_one();
 }
 
@@ -83,7 +86,6 @@ void TimerMgr::removeTimer(int id)
 
 void TimerMgr::processTimerHandler()
 {
-    std::cout << "processTimerHandler: Thread started." << std::endl;
     while (mainThreadAlive)
     {
         auto node = next();
@@ -95,12 +97,15 @@ void TimerMgr::processTimerHandler()
         auto now = currentTimeMicros();
         if (node->when_ <= now)
         {
-            std::cout << "Handler: Executing callback for timer id " << node->id_ << std::endl;
+            lateness_.record(now - node->when_);
             node->callback_();
+            callbackDuration_.record(currentTimeMicros() - now);
+            firedCount_.fetch_add(1, std::memory_order_relaxed);
 
             if (node->periodic_ && node->valid_)
             {
                 node->when_ = now + node->timeout_;
+                rearmedCount_.fetch_add(1, std::memory_order_relaxed);
                 enqueueNode(node);
             }
             else
@@ -111,11 +116,20 @@ void TimerMgr::processTimerHandler()
         }
         else
         {
-            std::this_thread::sleep_for(std::chrono::microseconds(node->when_ - now));
-            enqueueNode(node);
+            {
+                // wakes early on start/stop/shutdown so an earlier timer or the destructor is not held up
+                std::unique_lock<std::mutex> lock(mutex_);
+                cond_.wait_for(lock, std::chrono::microseconds(node->when_ - now), [this, &node]
+                {
+                    return !mainThreadAlive || !node->valid_ || (!queue_.empty() && queue_.top()->when_ < node->when_);
+                });
+            }
+            if (node->valid_)
+            {
+                enqueueNode(node);
+            }
         }
     }
-    std::cout << "processTimerHandler: Thread ended." << std::endl;
 }
 
 long long TimerMgr::currentTimeMicros()
@@ -132,7 +146,7 @@ bool TimerMgr::start(Timer& timer)
     auto timerNode = timer.getTimerNode();
     long long currentTime = currentTimeMicros();
     timer.start(currentTime);
-    std::cout << "Start: Timer id " << timerNode->id_ << " started at " << timerNode->when_ << std::endl;
+    startedCount_.fetch_add(1, std::memory_order_relaxed);
     enqueueNode(timerNode);
     return true;
 }
@@ -142,9 +156,12 @@ void TimerMgr::stop(Timer& timer)
     auto timerNode = timer.getTimerNode();
     if (timerNode)
     {
+        if (timerNode->valid_)
+        {
+            cancelledCount_.fetch_add(1, std::memory_order_relaxed);
+        }
         timerNode->valid_ = false;
         removeTimer(timerNode->id_);
-        std::cout << "Stop: Timer id " << timerNode->id_ << " stopped" << std::endl;
         cond_.notify_one();
     }
 }
@@ -155,4 +172,57 @@ size_t TimerMgr::getActiveTimerCount() const
     return nodeMap_.size();
 }
 
+TimerStats TimerMgr::getStats() const
+{
+    TimerStats stats;
+    stats.started_ = startedCount_.load(std::memory_order_relaxed);
+    stats.fired_ = firedCount_.load(std::memory_order_relaxed);
+    stats.cancelled_ = cancelledCount_.load(std::memory_order_relaxed);
+    stats.rearmed_ = rearmedCount_.load(std::memory_order_relaxed);
+    stats.lateness_ = lateness_.snapshot();
+    stats.callback_ = callbackDuration_.snapshot();
+    return stats;
+}
+
+void TimerMgr::resetStats()
+{
+    startedCount_.store(0, std::memory_order_relaxed);
+    firedCount_.store(0, std::memory_order_relaxed);
+    cancelledCount_.store(0, std::memory_order_relaxed);
+    rearmedCount_.store(0, std::memory_order_relaxed);
+    lateness_.reset();
+    callbackDuration_.reset();
+}
+
+void TimerMgr::dumpStats() const
+{
+    auto stats = getStats();
+    LOG_MODULE_INFO(TimerLog, "TimerMgr: active %zu started %llu fired %llu cancelled %llu rearmed %llu",
+                    getActiveTimerCount(), (unsigned long long)stats.started_, (unsigned long long)stats.fired_,
+                    (unsigned long long)stats.cancelled_, (unsigned long long)stats.rearmed_);
+    LOG_MODULE_INFO(TimerLog, "TimerMgr: lateness us mean %llu p50 %llu p99 %llu p999 %llu max %llu",
+                    (unsigned long long)stats.lateness_.mean(), (unsigned long long)stats.lateness_.percentile(50),
+                    (unsigned long long)stats.lateness_.percentile(99), (unsigned long long)stats.lateness_.percentile(99.9),
+                    (unsigned long long)stats.lateness_.max_);
+    LOG_MODULE_INFO(TimerLog, "TimerMgr: callback us mean %llu p50 %llu p99 %llu p999 %llu max %llu",
+                    (unsigned long long)stats.callback_.mean(), (unsigned long long)stats.callback_.percentile(50),
+                    (unsigned long long)stats.callback_.percentile(99), (unsigned long long)stats.callback_.percentile(99.9),
+                    (unsigned long long)stats.callback_.max_);
+}
+
+void TimerMgr::setStatsDumpInterval(long long intervalMicros)
+{
+    if (statsTimer_)
+    {
+        stop(*statsTimer_);
+        statsTimer_.reset();
+    }
+    if (intervalMicros <= 0)
+    {
+        return;
+    }
+    statsTimer_ = std::make_unique<Timer>(createTimer(intervalMicros, [this] { dumpStats(); }, true));
+    start(*statsTimer_);
+}
+
 } // namespace Nazl
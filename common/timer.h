@@ -10,6 +10,7 @@
 #include <condition_variable>
 #include <iostream>
 #include <memory>
+#include "histogram.h"
 
 namespace Nazl
 {
@@ -49,6 +50,18 @@ private:
     std::shared_ptr<TimerNode> timerNode_;
 };
 
+struct TimerStats
+{
+    uint64_t started_{0};
+    uint64_t fired_{0};
+    uint64_t cancelled_{0};
+    uint64_t rearmed_{0};
+    // actual fire time minus when_, in microseconds
+    Histogram::Snapshot lateness_;
+    // callback execution time, in microseconds
+    Histogram::Snapshot callback_;
+};
+
 class TimerMgr
 {
 public:
@@ -69,6 +82,11 @@ public:
     void stop(Timer& timer);
     void removeTimer(int id);
     size_t getActiveTimerCount() const;
+    TimerStats getStats() const;
+    void resetStats();
+    void dumpStats() const;
+    // Dump stats through the logger every intervalMicros, 0 disables the periodic dump.
+    void setStatsDumpInterval(long long intervalMicros);
 
 private:
     struct CompareTimerNode
@@ -91,6 +109,14 @@ private:
     std::atomic<size_t> timerId_{0};
     mutable std::mutex mutex_;
     std::condition_variable cond_;
+
+    std::atomic<uint64_t> startedCount_{0};
+    std::atomic<uint64_t> firedCount_{0};
+    std::atomic<uint64_t> cancelledCount_{0};
+    std::atomic<uint64_t> rearmedCount_{0};
+    Histogram lateness_;
+    Histogram callbackDuration_;
+    std::unique_ptr<Timer> statsTimer_;
 };
 
 } // namespace Nazl
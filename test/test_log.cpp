@@ -4,17 +4,1424 @@
 //
 // Created by zwz on 2024/9/10.
 //
+#include <algorithm>
 #include <iostream>
+#include <cassert>
+#include <atomic>
+#include <new>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include "log.h"
-int main()
+#include "async_logger.h"
+#include "binary_log.h"
+#include "mmap_file_sink.h"
+#include "flight_recorder.h"
+#include "shm_log.h"
+#include "socket_sink.h"
+#include "log_config_watcher.h"
+#include "log_index.h"
+#include "log_modules.h"
+
+// Counts heap allocations made by the whole process, see testZeroAllocation.
+static std::atomic<uint64_t> g_allocations{0};
+
+void* operator new(std::size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* ptr = std::malloc(size))
+    {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept
+{
+    std::free(ptr);
+}
+void operator delete(void* ptr, std::size_t) noexcept
+{
+    std::free(ptr);
+}
+
+class CountingSink : public Sink
+{
+public:
+    void Log(const LogEvent& /*event*/) override
+    {
+        if (delay_.count() > 0)
+        {
+            std::this_thread::sleep_for(delay_);
+        }
+        count_++;
+    }
+    void Flush() override {}
+    void SetFormat(std::shared_ptr<LogFormat> /*format*/) override {}
+    void SetLevel(LogLevel log_level) override
+    {
+        level_ = log_level;
+    }
+    LogLevel GetLevel() override
+    {
+        return level_;
+    }
+    std::atomic<int> count_{0};
+    std::chrono::microseconds delay_{0};
+};
+
+class CapturingSink : public CountingSink
+{
+public:
+    void Log(const LogEvent& event) override
+    {
+        CountingSink::Log(event);
+        last_ = std::string(event.GetMessage());
+    }
+    std::string last_;
+};
+
+// Keeps every event rendered with its own pattern.
+class PatternSink : public CountingSink
+{
+public:
+    explicit PatternSink(const std::string& pattern) : pattern_(pattern) {}
+    void Log(const LogEvent& event) override
+    {
+        CountingSink::Log(event);
+        std::lock_guard<std::mutex> lock(mutex_);
+        lines_.push_back(pattern_.Format(event));
+    }
+    LogFormat pattern_;
+    std::mutex mutex_;
+    std::vector<std::string> lines_;
+};
+
+static LogEvent makeEvent(const std::string& message)
+{
+    return LogEvent(__FILE__, __FUNCTION__, "test", __LINE__, 0, LogEvent::Now(),
+                    LogLevel(LogLevel::LevelEnum::Info), message);
+}
+
+void testAsyncStdoutSink()
+{
+    // a pipe nobody reads stands in for a stalled console
+    int fds[2];
+    assert(::pipe(fds) == 0);
+    const int calls = 20000;
+    std::string received;
+    uint64_t dropped = 0;
+    {
+        StdoutSink sink(true, 4096, fds[1]);
+        assert(sink.IsAsync());
+        sink.SetFormat(std::make_shared<LogFormat>("%m%E"));
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < calls; ++i)
+        {
+            sink.Log(makeEvent("stdout line " + std::to_string(i)));
+        }
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        dropped = sink.GetDroppedCount();
+        assert(dropped > 0);
+        std::thread reader([&]
+        {
+            char chunk[4096];
+            ssize_t n;
+            while ((n = ::read(fds[0], chunk, sizeof(chunk))) > 0)
+            {
+                received.append(chunk, static_cast<std::size_t>(n));
+            }
+        });
+        sink.Flush();
+        std::cout << "async stdout " << std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / calls
+                  << " ns/call with a stalled reader, dropped " << dropped << std::endl;
+        ::close(fds[1]);
+        reader.join();
+    }
+    ::close(fds[0]);
+    std::istringstream lines(received);
+    std::string line;
+    uint64_t events = 0;
+    uint64_t summarized = 0;
+    while (std::getline(lines, line))
+    {
+        if (line.find("StdoutSink dropped ") == 0)
+        {
+            summarized += std::stoull(line.substr(strlen("StdoutSink dropped ")));
+            continue;
+        }
+        assert(line.find("stdout line ") == 0);
+        ++events;
+    }
+    assert(events + dropped == calls);
+    assert(summarized == dropped);
+}
+
+void testAsyncLogger(AsyncLogger::OverflowPolicy policy)
+{
+    auto sink = std::make_shared<CountingSink>();
+    sink->delay_ = std::chrono::microseconds(100);
+    std::vector<std::shared_ptr<Sink>> sinks{sink};
+    const int total = 1000;
+    int dropped = 0;
+    {
+        AsyncLogger logger("async_test", sinks.begin(), sinks.end(), 64, policy);
+        for (int i = 0; i < total; ++i)
+        {
+            logger.SinkIt(makeEvent("event " + std::to_string(i)));
+        }
+        logger.Flush();
+        dropped = static_cast<int>(logger.GetDroppedCount());
+    }
+    if (policy == AsyncLogger::OverflowPolicy::Block)
+    {
+        assert(dropped == 0);
+        assert(sink->count_ == total);
+    }
+    else
+    {
+        assert(dropped > 0);
+        // every accepted event is written, plus the dropped-count summary lines
+        assert(sink->count_ >= total - dropped);
+    }
+    std::cout << "async logger policy " << static_cast<int>(policy) << " written " << sink->count_
+              << " dropped " << dropped << std::endl;
+}
+
+void testTimeFormat()
+{
+    // 2024-10-15 00:00:07.123456789 UTC
+    uint64_t nanos = 1728950407ull * 1000000000ull + 123456789ull;
+    LogEvent event(__FILE__, __FUNCTION__, "test", __LINE__, 0, nanos, LogLevel(LogLevel::LevelEnum::Info), "msg");
+    std::string millis = LogFormat("%e %m").Format(event);
+    std::string micros = LogFormat("%u %m").Format(event);
+    assert(millis.find(":07.123 msg") != std::string::npos);
+    assert(micros.find(":07.123456 msg") != std::string::npos);
+    // the cached prefix is per formatter and follows the event time, not the wall clock
+    LogEvent later(__FILE__, __FUNCTION__, "test", __LINE__, 0, nanos + 1000000000ull,
+                   LogLevel(LogLevel::LevelEnum::Info), "msg");
+    LogFormat format("%e %m");
+    assert(format.Format(event).find(":07.123 msg") != std::string::npos);
+    assert(format.Format(later).find(":08.123 msg") != std::string::npos);
+    std::cout << "time format: " << micros << std::endl;
+}
+
+void testCompiledPattern()
+{
+    static constexpr auto kPattern = CompilePattern("%L [%f:%l] %m %% done%E");
+    // Level, "[", Func, ":", Line, "] ", Message, " ", "% done", EndOfLine
+    static_assert(kPattern.count_ == 10, "literals are merged at compile time");
+    static_assert(kPattern.instrs_[0].op_ == PatternOp::Level, "first instruction is the level");
+    LogEvent event(__FILE__, "func", "test", 42, 0, LogEvent::Now(), LogLevel(LogLevel::LevelEnum::Warn), "msg");
+    LogFormat compiled(kPattern);
+    LogFormat runtime("%L [%f:%l] %m %% done%E");
+    assert(compiled.Format(event) == "WARNING [func:42] msg % done\n");
+    assert(runtime.Format(event) == compiled.Format(event));
+}
+
+void testZeroAllocation()
+{
+    auto sink = std::make_shared<CountingSink>();
+    std::vector<std::shared_ptr<Sink>> sinks{sink};
+    Logger logger("alloc_test", sinks.begin(), sinks.end());
+    std::string name = "dma0";
+    LOG_COMMON(LogLevel(LogLevel::LevelEnum::Info), &logger, __FILE__, __FUNCTION__, __LINE__,
+               "warm up %s %d", name, 0);
+    uint64_t before = g_allocations.load();
+    for (int i = 0; i < 1000; ++i)
+    {
+        LOG_COMMON(LogLevel(LogLevel::LevelEnum::Info), &logger, __FILE__, __FUNCTION__, __LINE__,
+                   "channel %s transferred %d bytes in %.3f ms", name, i, i * 0.5);
+    }
+    for (int i = 0; i < 1000; ++i)
+    {
+        LOGF_COMMON(LogLevel(LogLevel::LevelEnum::Info), &logger, __FILE__, __FUNCTION__, __LINE__,
+                    FMT_COMPILE("channel {} transferred {} bytes in {:.3f} ms"), name, i, i * 0.5);
+    }
+    for (int i = 0; i < 1000; ++i)
+    {
+        LOG_COMMON_KV(LogLevel(LogLevel::LevelEnum::Info), &logger, __FILE__, __FUNCTION__, __LINE__,
+                      "dma done", "chn", i, "dev", name, "us", i * 0.5);
+    }
+    assert(g_allocations.load() == before);
+    // longer messages spill to the heap but are still captured whole
+    std::string big(1000, 'x');
+    LogEvent event(__FILE__, __FUNCTION__, "test", __LINE__, 0, LogEvent::Now(), LogLevel(LogLevel::LevelEnum::Info));
+    fmt::format_to(std::back_inserter(event.GetMessageBuffer()), "{}", big);
+    assert(event.GetMessage() == big);
+    assert(sink->count_ == 3001);
+}
+
+static void logToHandleTest(int i)
+{
+    LOG_INFO_TO("handle_test", "named logger %d", i);
+}
+
+void testLoggerHandle()
+{
+    auto first = std::make_shared<CountingSink>();
+    std::vector<std::shared_ptr<Sink>> firstSinks{first};
+    logger_manager::GetInstance().RegisterLogger(std::make_shared<Logger>("handle_test", firstSinks.begin(), firstSinks.end()));
+    for (int i = 0; i < 10; ++i)
+    {
+        logToHandleTest(i);
+    }
+    assert(first->count_ == 10);
+    // re-registering resets the cached call site, it picks up the new logger
+    auto second = std::make_shared<CountingSink>();
+    std::vector<std::shared_ptr<Sink>> secondSinks{second};
+    logger_manager::GetInstance().RegisterLogger(std::make_shared<Logger>("handle_test", secondSinks.begin(), secondSinks.end()));
+    logToHandleTest(10);
+    assert(first->count_ == 10);
+    assert(second->count_ == 1);
+    // lookups racing with registrations: once the last registration returned, every call site
+    // logs to the last logger, never to one it replaced
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&stop]
+        {
+            int i = 0;
+            while (!stop)
+            {
+                logToHandleTest(i++);
+            }
+        });
+    }
+    std::vector<std::shared_ptr<CountingSink>> counters;
+    for (int round = 0; round < 200; ++round)
+    {
+        counters.push_back(std::make_shared<CountingSink>());
+        std::vector<std::shared_ptr<Sink>> sinks{counters.back()};
+        logger_manager::GetInstance().RegisterLogger(std::make_shared<Logger>("handle_test", sinks.begin(), sinks.end()));
+    }
+    stop = true;
+    for (auto& thread : threads)
+    {
+        thread.join();
+    }
+    std::vector<int> before;
+    for (auto& counter : counters)
+    {
+        before.push_back(counter->count_);
+    }
+    for (int i = 0; i < 10; ++i)
+    {
+        logToHandleTest(i);
+    }
+    for (std::size_t i = 0; i + 1 < counters.size(); ++i)
+    {
+        assert(counters[i]->count_ == before[i]);
+    }
+    assert(counters.back()->count_ == before.back() + 10);
+}
+
+void testThreadContext()
+{
+    auto sink = std::make_shared<PatternSink>("%N %t %m");
+    std::vector<std::shared_ptr<Sink>> sinks{sink};
+    // formatted on the writer thread, after the logging threads are gone
+    auto logger = std::make_shared<AsyncLogger>("thread_test", sinks.begin(), sinks.end());
+    logger_manager::GetInstance().RegisterLogger(logger);
+    pid_t main_tid = static_cast<pid_t>(::syscall(SYS_gettid));
+    LOG_INFO_TO("thread_test", "main");
+    pid_t worker_tid = 0;
+    {
+        Nazl::Thread worker([] { LOGF_INFO_TO("thread_test", "worker"); }, "ctx-worker");
+        worker_tid = worker.Tid();
+        worker.join();
+    }
+    std::thread foreign([]
+    {
+        pthread_setname_np(pthread_self(), "foreign");
+        LOG_INFO_KV_TO("thread_test", "foreign", "n", 1);
+    });
+    foreign.join();
+    // the Thread object may be gone (its thread detached) before the thread logs
+    std::atomic<bool> go{false};
+    std::atomic<bool> done{false};
+    {
+        Nazl::Thread detached([&]
+        {
+            while (!go)
+            {
+                std::this_thread::yield();
+            }
+            LOG_INFO_TO("thread_test", "detached");
+            done = true;
+        }, "ctx-detached");
+    }
+    go = true;
+    while (!done)
+    {
+        std::this_thread::yield();
+    }
+    logger->Flush();
+    assert(sink->lines_.size() == 4);
+    assert(sink->lines_[0].find(std::to_string(main_tid) + " ") == 0);
+    assert(sink->lines_[1] == std::to_string(worker_tid) + " ctx-worker worker");
+    assert(sink->lines_[2].find(" foreign foreign n=1") != std::string::npos);
+    assert(sink->lines_[3].find(" ctx-detached detached") != std::string::npos);
+    assert(LogThreadContext::Current() == LogThreadContext::Current());
+    assert(static_cast<pid_t>(LogThreadContext::Current()->tid_) == main_tid);
+    // a forked child captures its own tid
+    pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        ::_exit(LogThreadContext::Current()->tid_ == static_cast<uint32_t>(::syscall(SYS_gettid)) ? 0 : 1);
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+static void writeConfig(const std::string& path, const std::string& text)
+{
+    // save through a rename, the way editors do
+    std::ofstream(path + ".tmp") << text;
+    ::rename((path + ".tmp").c_str(), path.c_str());
+}
+
+void testRuntimeLevel()
+{
+    auto sink = std::make_shared<CountingSink>();
+    sink->SetName("stdout_sink");
+    std::vector<std::shared_ptr<Sink>> sinks{sink};
+    auto& manager = logger_manager::GetInstance();
+    manager.RegisterLogger(std::make_shared<Logger>("level_test", sinks.begin(), sinks.end()));
+    LOG_DEBUG_TO("level_test", "hidden");
+    assert(sink->count_ == 0);
+
+    // runtime API
+    assert(manager.SetLevel("level_test", LogLevel(LogLevel::LevelEnum::Debug)));
+    LOG_DEBUG_TO("level_test", "shown");
+    assert(sink->count_ == 1);
+    assert(manager.SetSinkLevel("level_test", "stdout_sink", LogLevel(LogLevel::LevelEnum::Error)));
+    LOG_WARN_TO("level_test", "hidden");
+    assert(sink->count_ == 1);
+    assert(!manager.SetSinkLevel("level_test", "file_sink", LogLevel(LogLevel::LevelEnum::Debug)));
+    assert(!manager.SetLevel("no_such_logger", LogLevel(LogLevel::LevelEnum::Debug)));
+
+    // hot reload
+    const std::string path = "./logs/test_reload.yml";
+    writeConfig(path, "logger:\n  reload:\n    stdout_sink:\n      level: ERROR\n");
+    LogConfigWatcher watcher;
+    watcher.Bind("reload", "level_test");
+    assert(watcher.Start(path));
+    auto waitReload = [&](uint64_t count)
+    {
+        for (int i = 0; i < 300 && watcher.GetReloadCount() < count; ++i)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        return watcher.GetReloadCount() >= count;
+    };
+    writeConfig(path, "logger:\n  reload:\n    stdout_sink:\n      level: DEBUG\n");
+    assert(waitReload(1));
+    LOG_DEBUG_TO("level_test", "shown");
+    assert(sink->count_ == 2);
+    // a logger-wide level wins over the sink levels
+    writeConfig(path, "logger:\n  reload:\n    level: WARN\n    stdout_sink:\n      level: DEBUG\n");
+    assert(waitReload(2));
+    LOG_INFO_TO("level_test", "hidden");
+    assert(sink->count_ == 2);
+    // a broken file keeps the current levels
+    std::ofstream(path) << "logger: [\n";
+    assert(!watcher.Reload());
+    LOG_WARN_TO("level_test", "shown");
+    assert(sink->count_ == 3);
+    watcher.Stop();
+    ::unlink(path.c_str());
+}
+
+// Counts how often the LOG_* arguments below are evaluated and formatted.
+static int g_evaluated = 0;
+static int g_formatted = 0;
+
+static int evaluated(int value)
+{
+    ++g_evaluated;
+    return value;
+}
+
+struct Traced
+{
+    int value_;
+};
+
+template<>
+struct fmt::formatter<Traced> : fmt::formatter<int>
+{
+    template<typename FormatContext>
+    auto format(const Traced& traced, FormatContext& ctx) const
+    {
+        ++g_formatted;
+        return fmt::formatter<int>::format(traced.value_, ctx);
+    }
+};
+
+void testArgumentEvaluation()
+{
+    auto sink = std::make_shared<CapturingSink>();
+    sink->SetLevel(LogLevel(LogLevel::LevelEnum::Info));
+    std::vector<std::shared_ptr<Sink>> sinks{sink};
+    auto logger = std::make_shared<Logger>("eval_test", sinks.begin(), sinks.end());
+    logger_manager::GetInstance().RegisterLogger(logger);
+    // below the level nothing is evaluated or formatted
+    LOG_DEBUG_TO("eval_test", "%d", evaluated(1));
+    LOGF_DEBUG_TO("eval_test", "{} {}", evaluated(2), Traced{3});
+    assert(g_evaluated == 0 && g_formatted == 0);
+    assert(sink->count_ == 0);
+    // at the level once each
+    LOG_INFO_TO("eval_test", "%d", evaluated(4));
+    assert(sink->last_ == "4");
+    LOGF_INFO_TO("eval_test", "{} {}", evaluated(5), Traced{6});
+    assert(sink->last_ == "5 6");
+    assert(g_evaluated == 2 && g_formatted == 1);
+
+    // Sink::SetLevel called directly leaves the loggers' cached level alone until they refresh
+    sink->SetLevel(LogLevel(LogLevel::LevelEnum::Debug));
+    LOG_DEBUG_TO("eval_test", "%d", evaluated(7));
+    assert(g_evaluated == 2);
+    logger->RefreshLevel();
+    LOG_DEBUG_TO("eval_test", "%d", evaluated(8));
+    assert(g_evaluated == 3 && sink->last_ == "8");
+}
+
+NAZL_LOG_MODULE(TestModuleLog, 40, "module_test");
+
+void testModuleLogger()
+{
+    auto& manager = logger_manager::GetInstance();
+    // no logger of that name yet: the default logger
+    assert(manager.GetModuleLogger(TestModuleLog::kId, TestModuleLog::kName) == manager.GetDefaultLogger().get());
+
+    auto sink = std::make_shared<CountingSink>();
+    sink->SetLevel(LogLevel(LogLevel::LevelEnum::Debug));
+    std::vector<std::shared_ptr<Sink>> sinks{sink};
+    auto logger = std::make_shared<Logger>("module_test", sinks.begin(), sinks.end());
+    manager.RegisterLogger(logger);
+    assert(manager.GetModuleLogger(TestModuleLog::kId, TestModuleLog::kName) == logger.get());
+    LOG_MODULE_DEBUG(TestModuleLog, "chn %d", 1);
+    LOGF_MODULE_INFO(TestModuleLog, "chn {}", 2);
+    assert(sink->count_ == 2);
+    // its level is its own
+    assert(manager.SetLevel("module_test", LogLevel(LogLevel::LevelEnum::Warn)));
+    LOG_MODULE_INFO(TestModuleLog, "hidden");
+    assert(sink->count_ == 2);
+    LOG_MODULE_ERROR(TestModuleLog, "shown");
+    assert(sink->count_ == 3);
+
+    // a child of another logger: the level is a threshold and the parent's sinks keep theirs
+    auto owner = std::make_shared<Logger>("module_owner", sinks.begin(), sinks.end());
+    auto shared = std::make_shared<Logger>("module_test");
+    shared->SetParent(owner);
+    manager.RegisterLogger(owner);
+    manager.RegisterLogger(shared);
+    assert(manager.SetLevel("module_owner", LogLevel(LogLevel::LevelEnum::Debug)));
+    assert(manager.SetLevel("module_test", LogLevel(LogLevel::LevelEnum::Info)));
+    assert(sink->GetLevel().GetLevel() == LogLevel::LevelEnum::Debug);
+    LOG_MODULE_DEBUG(TestModuleLog, "hidden");
+    LOG_MODULE_INFO(TestModuleLog, "shown");
+    assert(sink->count_ == 4);
+    // and it cannot be louder than the sinks
+    sink->SetLevel(LogLevel(LogLevel::LevelEnum::Error));
+    manager.RefreshLevels();
+    LOG_MODULE_WARN(TestModuleLog, "hidden");
+    assert(sink->count_ == 4);
+
+    // a child of an AsyncLogger goes through its queue, the sinks run on the writer thread
+    class ThreadSink : public CountingSink
+    {
+    public:
+        void Log(const LogEvent& event) override
+        {
+            CountingSink::Log(event);
+            thread_ = std::this_thread::get_id();
+        }
+        std::thread::id thread_;
+    };
+    auto threadSink = std::make_shared<ThreadSink>();
+    std::vector<std::shared_ptr<Sink>> asyncSinks{threadSink};
+    auto asyncOwner = std::make_shared<AsyncLogger>("module_owner", asyncSinks.begin(), asyncSinks.end());
+    auto child = std::make_shared<Logger>("module_test");
+    child->SetParent(asyncOwner);
+    manager.RegisterLogger(asyncOwner);
+    manager.RegisterLogger(child);
+    LOG_MODULE_INFO(TestModuleLog, "queued");
+    asyncOwner->Flush();
+    assert(threadSink->count_ == 1);
+    assert(threadSink->thread_ != std::this_thread::get_id());
+
+    // modules configured in log_config.yml
+    Logger* pcie = manager.GetModuleLogger(PcieLog::kId, PcieLog::kName);
+    assert(pcie && pcie->GetName() == "pcie");
+    assert(!pcie->ShouldLog(LogLevel::LevelEnum::Info));
+    LOG_MODULE_WARN(PcieLog, "pcie module logger");
+}
+
+void testFmtStyle()
+{
+    auto sink = std::make_shared<CapturingSink>();
+    std::vector<std::shared_ptr<Sink>> sinks{sink};
+    logger_manager::GetInstance().RegisterLogger(std::make_shared<Logger>("fmt_test", sinks.begin(), sinks.end()));
+    std::string name = "dma0";
+    LOGF_INFO_TO("fmt_test", "x={} y={:.2f} name={} hex={:#x}", 1, 2.5, name, 255);
+    assert(sink->last_ == "x=1 y=2.50 name=dma0 hex=0xff");
+    // LOGF_INFO_TO("fmt_test", "{} {}", 1); and "{:d}" with a string do not compile
+    LOGF_WARN_TO("fmt_test", "no args");
+    assert(sink->last_ == "no args");
+}
+
+static size_t fileSize(const std::string& path)
+{
+    struct stat st;
+    return ::stat(path.c_str(), &st) == 0 ? static_cast<size_t>(st.st_size) : 0;
+}
+
+static std::vector<std::string> readLines(const std::string& path)
+{
+    std::vector<std::string> lines;
+    std::ifstream in(path);
+    std::string line;
+    while (std::getline(in, line))
+    {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+void testFileSinkFlushPolicy()
+{
+    const std::string path = "./logs/test_file_sink.log";
+    ::unlink(path.c_str());
+    FileSinkOptions options;
+    options.flush_policy_ = FileSinkOptions::FlushOnLevel;
+    {
+        FileSink sink(path, 0, 1, options);
+        sink.SetFormat(std::make_shared<LogFormat>("%m%E"));
+        sink.Log(makeEvent("buffered"));
+        assert(fileSize(path) == 0);
+        sink.Log(LogEvent(__FILE__, __FUNCTION__, "test", __LINE__, 0, LogEvent::Now(),
+                          LogLevel(LogLevel::LevelEnum::Error), "error"));
+        assert(fileSize(path) == strlen("buffered\nerror\n"));
+        sink.Log(makeEvent("at exit"));
+    }
+    assert(fileSize(path) == strlen("buffered\nerror\nat exit\n"));
+
+    // an interval flush is due even when no next event comes along to check it
+    ::unlink(path.c_str());
+    options.flush_policy_ = FileSinkOptions::FlushOnInterval;
+    options.flush_interval_ms_ = 50;
+    {
+        FileSink sink(path, 0, 1, options);
+        sink.SetFormat(std::make_shared<LogFormat>("%m%E"));
+        sink.Log(makeEvent("idle"));
+        assert(fileSize(path) == 0);
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+        while (fileSize(path) == 0 && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+        assert(fileSize(path) == strlen("idle\n"));
+    }
+
+    // sustained throughput with the default 1 MiB buffer, explicit flush only
+    ::unlink(path.c_str());
+    options.flush_policy_ = FileSinkOptions::FlushExplicit;
+    FileSink sink(path, 0, 1, options);
+    sink.SetFormat(std::make_shared<LogFormat>(LogFormat::kDefaultPattern));
+    auto event = makeEvent(std::string(100, 'x'));
+    const int events = 200000;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < events; ++i)
+    {
+        sink.Log(event);
+    }
+    sink.Flush();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << "file sink " << static_cast<int>(fileSize(path) / elapsed / (1024 * 1024)) << " MB/s" << std::endl;
+    ::unlink(path.c_str());
+}
+
+void testBackgroundRotation()
+{
+    const std::string path = "./logs/test_rotate.log";
+    FileSinkOptions options;
+    options.flush_policy_ = FileSinkOptions::FlushExplicit;
+    options.compression_ = LogRotator::Compression::Gzip;
+    const std::string suffix = LogRotator::IsSupported(options.compression_) ? ".gz" : "";
+    {
+        FileSink sink(path, 1024, 3, options);
+        sink.SetFormat(std::make_shared<LogFormat>("%m%E"));
+        for (int i = 0; i < 200; ++i)
+        {
+            sink.Log(makeEvent("rotation test line " + std::to_string(i)));
+        }
+    }
+    log_rotator::GetInstance()->WaitIdle();
+    for (int i = 1; i <= 3; ++i)
+    {
+        assert(fileSize(path + "." + std::to_string(i) + suffix) > 0);
+    }
+    assert(fileSize(path + ".4" + suffix) == 0);
+    for (int i = 0; i <= 4; ++i)
+    {
+        ::unlink((path + "." + std::to_string(i) + suffix).c_str());
+    }
+    ::unlink(path.c_str());
+
+    // a pending file left by an earlier process (another pid) still goes through the cascade
+    const std::string leftover = path + LogRotator::kPendingSuffix + "1.0";
+    {
+        std::ofstream(leftover) << "left behind\n";
+    }
+    options.compression_ = LogRotator::Compression::None;
+    {
+        FileSink sink(path, 1024, 3, options);
+    }
+    log_rotator::GetInstance()->WaitIdle();
+    assert(fileSize(leftover) == 0);
+    assert(readLines(path + ".1") == std::vector<std::string>{"left behind"});
+    ::unlink((path + ".1").c_str());
+    ::unlink(path.c_str());
+}
+
+void testRotationBackoff()
+{
+    // the segment name is taken by a non-empty directory: the rename fails, events keep going to
+    // the live file and the rotation is retried only after the backoff
+    const std::string path = "./logs/test_backoff.log";
+    FileSinkOptions options;
+    options.rotation_ = FileSinkOptions::Rotation::Indexed;
+    options.flush_policy_ = FileSinkOptions::FlushExplicit;
+    uint64_t start = 1728950407ull * 1000000000ull;
+    const std::string segment = LogRotator::SegmentName(path, start / 1000000000ull, 1);
+    const std::string blocker = segment + "/blocker";
+    ::mkdir(segment.c_str(), 0755);
+    {
+        std::ofstream(blocker) << "x";
+    }
+    auto event = [start](int i)
+    {
+        return LogEvent(__FILE__, __FUNCTION__, "test", __LINE__, 0, start + i, LogLevel(LogLevel::LevelEnum::Info),
+                        fmt::format("event {:03}", i));
+    };
+    FileSink sink(path, 100, 0, options);
+    sink.SetFormat(std::make_shared<LogFormat>("%m%E"));
+    for (int i = 0; i < 50; ++i)
+    {
+        sink.Log(event(i));
+    }
+    sink.Flush();
+    assert(fileSize(path) == 50 * strlen("event 000\n"));
+    ::unlink(blocker.c_str());
+    ::rmdir(segment.c_str());
+    sink.Log(event(50));
+    sink.Flush();
+    assert(fileSize(path) == 51 * strlen("event 000\n"));
+    std::this_thread::sleep_for(FileSink::kRotateRetryMin + std::chrono::milliseconds(100));
+    sink.Log(event(51));
+    sink.Flush();
+    log_rotator::GetInstance()->WaitIdle();
+    assert(fileSize(segment) == 51 * strlen("event 000\n"));
+    assert(fileSize(path) == strlen("event 000\n"));
+    ::unlink(segment.c_str());
+    ::unlink(LogRotator::ManifestName(path).c_str());
+    ::unlink(path.c_str());
+}
+
+void testIndexedRotation()
+{
+    const std::string path = "./logs/test_indexed.log";
+    FileSinkOptions options;
+    options.rotation_ = FileSinkOptions::Rotation::Indexed;
+    options.rotate_interval_s_ = 3600;
+    // 2024-10-15 00:00:07 UTC, one event every 20 minutes for 10 hours
+    uint64_t start = 1728950407ull * 1000000000ull;
+    uint64_t step = 1200ull * 1000000000ull;
+    {
+        FileSink sink(path, 0, 4, options);
+        sink.SetFormat(std::make_shared<LogFormat>("%m%E"));
+        for (int i = 0; i < 30; ++i)
+        {
+            sink.Log(LogEvent(__FILE__, __FUNCTION__, "test", __LINE__, 0, start + i * step,
+                              LogLevel(LogLevel::LevelEnum::Info), "hourly"));
+        }
+    }
+    log_rotator::GetInstance()->WaitIdle();
+    // 9 hour boundaries crossed: segments 1..9 written, only the newest 4 kept
+    std::ifstream manifest(LogRotator::ManifestName(path));
+    std::vector<std::string> names;
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        names.push_back(line.substr(line.rfind(' ') + 1));
+    }
+    assert(names.size() == 4);
+    assert(names.back().size() > 5 && names.back().compare(names.back().size() - 5, 5, ".0009") == 0);
+    for (auto& name : names)
+    {
+        assert(fileSize(name) == strlen("hourly\n") * 3);
+    }
+    assert(fileSize(LogRotator::SegmentName(path, 1728950407ull, 1)) == 0);
+    assert(LogRotator::NextIndex(path) == 10);
+    for (auto& name : names)
+    {
+        ::unlink(name.c_str());
+    }
+    ::unlink(LogRotator::ManifestName(path).c_str());
+    ::unlink(path.c_str());
+
+    // a reopened oversized file is rotated at once, named and aged by its last write;
+    // max_files 0 keeps every segment
+    {
+        std::ofstream(path) << std::string(200, 'x');
+    }
+    uint64_t written_s = static_cast<uint64_t>(::time(nullptr)) - 3600;
+    struct timespec times[2] = {{static_cast<time_t>(written_s), 0}, {static_cast<time_t>(written_s), 0}};
+    assert(::utimensat(AT_FDCWD, path.c_str(), times, 0) == 0);
+    FileSinkOptions aged;
+    aged.rotation_ = FileSinkOptions::Rotation::Indexed;
+    aged.max_age_s_ = 86400;
+    {
+        FileSink sink(path, 100, 0, aged);
+        sink.SetFormat(std::make_shared<LogFormat>("%m%E"));
+        for (int i = 0; i < 30; ++i)
+        {
+            sink.Log(makeEvent(std::string(19, 'y')));
+        }
+    }
+    log_rotator::GetInstance()->WaitIdle();
+    names.clear();
+    std::ifstream agedManifest(LogRotator::ManifestName(path));
+    while (std::getline(agedManifest, line))
+    {
+        names.push_back(line.substr(line.rfind(' ') + 1));
+    }
+    assert(names.size() == 6);
+    assert(names.front() == LogRotator::SegmentName(path, written_s, 1));
+    assert(fileSize(names.front()) == 200);
+    for (auto& name : names)
+    {
+        ::unlink(name.c_str());
+    }
+    ::unlink(LogRotator::ManifestName(path).c_str());
+    ::unlink(path.c_str());
+}
+
+void testTimeIndex()
+{
+    const std::string path = "./logs/test_time_index.log";
+    FileSinkOptions options;
+    options.index_lines_ = 10;
+    options.index_bytes_ = 256;
+    uint64_t start = 1728950407ull * 1000000000ull;
+    auto level = [](int i)
+    {
+        return i % 50 == 0 ? LogLevel::LevelEnum::Error : LogLevel::LevelEnum::Info;
+    };
+    {
+        // "event NNN\n" is 10 bytes: blocks close at 10 events, files rotate every 100
+        FileSink sink(path, 1000, 3, options);
+        sink.SetFormat(std::make_shared<LogFormat>("%m%E"));
+        for (int i = 0; i < 250; ++i)
+        {
+            sink.Log(LogEvent(__FILE__, __FUNCTION__, "test", __LINE__, 0, start + i * 1000000000ull,
+                              LogLevel(level(i)), fmt::format("event {:03}", i)));
+        }
+    }
+    log_rotator::GetInstance()->WaitIdle();
+    // the index follows its segment through the cascade
+    auto rotated = LogIndexWriter::Load(path + ".2");
+    assert(rotated.size() == 10);
+    assert(rotated.front().offset_ == 0 && rotated.front().first_ns_ == start);
+    auto live = LogIndexWriter::Load(path);
+    assert(live.size() == 5);
+    uint64_t offset = 0;
+    for (std::size_t i = 0; i < live.size(); ++i)
+    {
+        const LogIndexEntry& entry = live[i];
+        assert(entry.offset_ == offset && entry.size_ == 100 && entry.lines_ == 10);
+        assert(entry.first_ns_ == start + (200 + i * 10) * 1000000000ull);
+        assert(entry.last_ns_ == entry.first_ns_ + 9 * 1000000000ull);
+        // event 200 is the only error in the live file
+        assert(entry.HasLevelAtLeast(LogLevel::LevelEnum::Error) == (i == 0));
+        offset += entry.size_;
+    }
+    assert(offset == fileSize(path));
+    for (auto name : {path, path + ".1", path + ".2", path + ".3"})
+    {
+        ::unlink(name.c_str());
+        ::unlink(LogIndexWriter::IndexName(name).c_str());
+    }
+}
+
+void testMmapFileSink()
+{
+    const std::string path = "./logs/test_mmap.log";
+    ::unlink(path.c_str());
+    std::string line = std::string(100, 'm') + "\n";
+    const int events = 1000;
+    {
+        // 8 KiB segments: records straddle segment boundaries
+        MmapFileSink sink(path, 0, 1, 8192);
+        sink.SetFormat(std::make_shared<LogFormat>("%m%E"));
+        for (int i = 0; i < events; ++i)
+        {
+            sink.Log(makeEvent(std::string(100, 'm')));
+        }
+        sink.Flush();
+        assert(sink.GetSize() == line.size() * events);
+        // preallocated but not trimmed yet
+        assert(fileSize(path) % 8192 == 0 && fileSize(path) >= line.size() * events);
+    }
+    assert(fileSize(path) == line.size() * events);
+    assert(fileSize(path + MmapFileSink::kMappedSuffix) == 0);
+    // a crash leaves zeros after the data; reopening cuts them off and appends after the last record
+    pid_t pid = ::fork();
+    if (pid == 0)
+    {
+        MmapFileSink* sink = new MmapFileSink(path, 0, 1, 8192);
+        sink->SetFormat(std::make_shared<LogFormat>("%m%E"));
+        sink->Log(makeEvent(std::string(100, 'm')));
+        sink->Flush();
+        ::_exit(0);
+    }
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    assert(fileSize(path) % 8192 == 0 && fileSize(path) > line.size() * (events + 1));
+    {
+        MmapFileSink sink(path, 0, 1, 8192);
+        sink.SetFormat(std::make_shared<LogFormat>("%m%E"));
+        assert(sink.GetSize() == line.size() * (events + 1));
+        sink.Log(makeEvent(std::string(100, 'm')));
+    }
+    std::ifstream in(path);
+    std::string read;
+    int lines = 0;
+    while (std::getline(in, read))
+    {
+        assert(read + "\n" == line);
+        ++lines;
+    }
+    assert(lines == events + 2);
+    ::unlink(path.c_str());
+
+    // after a clean close the trailing zero bytes of the last record are data, not a tail
+    const std::string record("rec\0\0\0\0", 7);
+    for (int i = 0; i < 2; ++i)
+    {
+        MmapFileSink sink(path, 0, 1, 8192);
+        sink.SetFormat(std::make_shared<LogFormat>("%m"));
+        assert(sink.GetSize() == record.size() * i);
+        sink.Log(makeEvent(record));
+    }
+    assert(fileSize(path) == record.size() * 2);
+    ::unlink(path.c_str());
+}
+
+void testFlightRecorder()
+{
+    const std::string path = "./logs/test_flight_recorder.bin";
+    const std::string dump = "./logs/test_flight_recorder.txt";
+    const uint32_t records = 16;
+    {
+        FlightRecorderSink sink(path, 4, records);
+        assert(sink.IsOpen());
+        sink.SetFormat(std::make_shared<LogFormat>("%m"));
+        sink.SetLevel(LogLevel(LogLevel::LevelEnum::Debug));
+        std::atomic<uint64_t> clock{1};
+        auto work = [&](const std::string& who)
+        {
+            for (int i = 0; i < 50; ++i)
+            {
+                sink.Log(LogEvent(__FILE__, __FUNCTION__, "test", __LINE__, 0, clock.fetch_add(1),
+                                  LogLevel(LogLevel::LevelEnum::Debug), who + " " + std::to_string(i)));
+            }
+        };
+        std::thread first(work, "first");
+        std::thread second(work, "second");
+        first.join();
+        second.join();
+        work("main");
+        // the file holds the rings while the process is still alive
+        int fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st;
+        ::fstat(fd, &st);
+        void* map = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        int out = ::open(dump.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        assert(FlightRecorderSink::Dump(static_cast<const char*>(map), st.st_size, out) == 3 * records);
+        ::close(out);
+        ::munmap(map, st.st_size);
+        ::close(fd);
+        auto lines = readLines(dump);
+        assert(lines.size() == 3 * records);
+        // the last 16 events of each thread, merged oldest first
+        assert(lines.back() == "main 49");
+        assert(std::count(lines.begin(), lines.end(), "first 34") == 1);
+        assert(std::count(lines.begin(), lines.end(), "first 33") == 0);
+
+        // a crashing child prints its recorder from the signal handler
+        pid_t pid = ::fork();
+        if (pid == 0)
+        {
+            int crash_out = ::open(dump.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            sink.InstallCrashHandler(crash_out);
+            sink.Log(makeEvent("last words"));
+            ::abort();
+        }
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT);
+        lines = readLines(dump);
+        assert(lines.front().find("flight recorder dump on signal") != std::string::npos);
+        assert(lines.back() == "last words");
+
+        // exited threads free their slots: more threads over time than slots, nothing dropped
+        for (int i = 0; i < 8; ++i)
+        {
+            std::thread([&] { sink.Log(makeEvent("short-lived")); }).join();
+        }
+        assert(sink.GetDroppedCount() == 0);
+        // one slot per recorder for a thread that alternates between two of them
+        FlightRecorderSink other(path + ".other", 1, records);
+        std::thread alternate([&]
+        {
+            for (int i = 0; i < 10; ++i)
+            {
+                sink.Log(makeEvent("alternate"));
+                other.Log(makeEvent("alternate"));
+            }
+        });
+        alternate.join();
+        assert(sink.GetDroppedCount() == 0 && other.GetDroppedCount() == 0);
+    }
+    ::unlink(path.c_str());
+    ::unlink((path + ".other").c_str());
+    ::unlink((path + ".other.prev").c_str());
+    ::unlink((path + ".prev").c_str());
+    ::unlink(dump.c_str());
+}
+
+static void logEveryN(int i)
+{
+    LOG_EVERY_N_TO("limit_test", Info, 10, "every n %d", i);
+}
+static void logFirstN(int i)
+{
+    LOG_FIRST_N_TO("limit_test", Info, 5, "first n %d", i);
+}
+static void logFirstNDebug(int i)
+{
+    LOG_FIRST_N_TO("limit_test", Debug, 2, "first n debug %d", i);
+}
+static void logEveryMs(int i)
+{
+    LOG_EVERY_MS_TO("limit_test", Info, 50, "every ms %d", i);
+}
+static void logRateLimited(int i)
+{
+    LOG_RATE_LIMITED_TO("limit_test", Info, 10.0, 5, "bucket %d", i);
+}
+
+void testRateLimit()
+{
+    auto sink = std::make_shared<CapturingSink>();
+    std::vector<std::shared_ptr<Sink>> sinks{sink};
+    auto logger = std::make_shared<Logger>("limit_test", sinks.begin(), sinks.end());
+    logger_manager::GetInstance().RegisterLogger(logger);
+    // 100 calls: messages 0, 10, .., 90 plus a summary after each but the first
+    for (int i = 0; i < 100; ++i)
+    {
+        logEveryN(i);
+    }
+    assert(sink->count_ == 10 + 9);
+    assert(sink->last_.find("suppressed 9 messages") == 0);
+
+    sink->count_ = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        logFirstN(i);
+    }
+    assert(sink->count_ == 5);
+    assert(sink->last_ == "first n 4");
+
+    // calls at a disabled level leave the budget untouched for when the level is enabled
+    sink->count_ = 0;
+    logger->SetLevel(LogLevel(LogLevel::LevelEnum::Info));
+    for (int i = 0; i < 10; ++i)
+    {
+        logFirstNDebug(i);
+    }
+    assert(sink->count_ == 0);
+    logger->SetLevel(LogLevel(LogLevel::LevelEnum::Debug));
+    for (int i = 10; i < 20; ++i)
+    {
+        logFirstNDebug(i);
+    }
+    assert(sink->count_ == 2);
+    assert(sink->last_ == "first n debug 11");
+
+    // tight loop well inside one interval: only the first call gets through
+    sink->count_ = 0;
+    for (int i = 0; i < 1000; ++i)
+    {
+        logEveryMs(i);
+    }
+    assert(sink->count_ == 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(60));
+    logEveryMs(1000);
+    assert(sink->count_ == 3);
+    assert(sink->last_.find("suppressed 999 messages") == 0);
+
+    // burst of 5 with a 10/s refill
+    sink->count_ = 0;
+    for (int i = 0; i < 1000; ++i)
+    {
+        logRateLimited(i);
+    }
+    assert(sink->count_ == 5);
+
+    // throttled fast path cost
+    const int calls = 1000000;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < calls; ++i)
+    {
+        logFirstN(i);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+    std::cout << "throttled LOG_FIRST_N " << static_cast<double>(elapsed.count()) / calls << " ns/call" << std::endl;
+}
+
+void testStructuredFields()
+{
+    std::string dev = "pcie\"0";
+    LogEvent event(__FILE__, "func", "worker", 42, 0, 1728950407ull * 1000000000ull, LogLevel(LogLevel::LevelEnum::Info), "dma done");
+    event.BeginFields();
+    AppendLogFields(event.GetMessageBuffer(), "chn", 3, "bytes", 4096u, "us", 1.5, "ok", true, "dev", dev);
+    assert(event.GetMessage() == "dma done");
+    assert(LogFormat("%m").Format(event) == "dma done chn=3 bytes=4096 us=1.5 ok=true dev=\"pcie\\\"0\"");
+    std::string json = LogFormat("json").Format(event);
+    assert(json.find("\"level\":\"INFO\",") != std::string::npos);
+    assert(json.find("\"func\":\"func\",\"thread\":\"worker\",\"msg\":\"dma done\","
+                     "\"chn\":3,\"bytes\":4096,\"us\":1.5,\"ok\":true,\"dev\":\"pcie\\\"0\"}\n") != std::string::npos);
+    std::string binary = LogFormat("binary").Format(event);
+    uint32_t size;
+    memcpy(&size, binary.data(), sizeof(size));
+    assert(size == binary.size());
+    // the encoded fields close the record
+    assert(binary.compare(binary.size() - event.GetFields().size(), std::string::npos, event.GetFields()) == 0);
+    std::cout << "json: " << json;
+
+    // text values that would not read back as one logfmt token are quoted, JSON has no NaN or Inf
+    LogEvent odd(__FILE__, "func", "worker", 42, 0, 1728950407ull * 1000000000ull, LogLevel(LogLevel::LevelEnum::Info), "odd");
+    odd.BeginFields();
+    AppendLogFields(odd.GetMessageBuffer(), "path", "/dev/dma0", "msg", "two words", "expr", "a=b", "empty", "",
+                    "nan", std::nan(""), "inf", -HUGE_VAL);
+    assert(LogFormat("%m").Format(odd) == "odd path=/dev/dma0 msg=\"two words\" expr=\"a=b\" empty=\"\" nan=nan inf=-inf");
+    json = LogFormat("json").Format(odd);
+    assert(json.find("\"empty\":\"\",\"nan\":null,\"inf\":null}") != std::string::npos);
+}
+
+// Producer side of testSharedMemory, run in a process of its own (see spawnShmProducer).
+static uint64_t produceShm(const std::string& name, uint64_t start)
+{
+    SharedMemorySink sink(name, 4096);
+    assert(sink.IsOpen());
+    sink.SetFormat(std::make_shared<LogFormat>("%m%E"));
+    // 200 records of ~40 bytes overflow the 4 KiB ring while the collector is away
+    for (uint64_t i = 0; i < 200; ++i)
+    {
+        sink.Log(LogEvent(__FILE__, __FUNCTION__, "test", __LINE__, 0, start + 2 * i,
+                          LogLevel(LogLevel::LevelEnum::Info), name + " " + std::to_string(start + 2 * i)));
+    }
+    return sink.GetDroppedCount();
+}
+
+// Starts this binary again with --shm-producer instead of forking a process that has threads running.
+static pid_t spawnShmProducer(const std::string& name, uint64_t start)
+{
+    std::string startArg = std::to_string(start);
+    char* argv[] = {const_cast<char*>("test_log"), const_cast<char*>("--shm-producer"),
+                    const_cast<char*>(name.c_str()), const_cast<char*>(startArg.c_str()), nullptr};
+    pid_t pid = 0;
+    int rc = ::posix_spawn(&pid, "/proc/self/exe", nullptr, nullptr, argv, environ);
+    assert(rc == 0);
+    return pid;
+}
+
+static void waitShmProducer(pid_t pid)
+{
+    int status = 0;
+    ::waitpid(pid, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+void testSharedMemory()
+{
+    const std::string first = "test-first-" + std::to_string(::getpid());
+    const std::string second = "test-second-" + std::to_string(::getpid());
+    LogCollector collector(std::chrono::milliseconds(0));
+    collector.AddRing(first);
+    collector.AddRing(second);
+    std::vector<std::string> lines;
+    auto out = [&](std::string_view data)
+    {
+        lines.emplace_back(data);
+    };
+    // nothing to collect before the producers exist
+    assert(collector.Collect(out, true) == 0);
+
+    // the second producer is another process, the rings interleave by timestamp
+    pid_t pid = spawnShmProducer(second, 2);
+    uint64_t dropped = produceShm(first, 1);
+    waitShmProducer(pid);
+    assert(dropped > 0);
+    std::size_t collected = collector.Collect(out, true);
+    assert(collected == lines.size());
+    assert(collected + collector.GetDroppedCount() == 400);
+    assert(std::is_sorted(lines.begin(), lines.end(), [](const std::string& a, const std::string& b)
+    {
+        return std::stoull(a.substr(a.rfind(' ') + 1)) < std::stoull(b.substr(b.rfind(' ') + 1));
+    }));
+    assert(lines[0] == first + " 1\n");
+    assert(lines[1] == second + " 2\n");
+
+    // drained rings accept new records again, late records are held back for the window
+    produceShm(first, 1000);
+    LogCollector holding(std::chrono::milliseconds(100));
+    holding.AddRing(first);
+    std::vector<std::string> held;
+    auto keep = [&](std::string_view data)
+    {
+        held.emplace_back(data);
+    };
+    assert(holding.Collect(keep) > 0);
+    {
+        SharedMemorySink sink(first, 4096);
+        sink.SetFormat(std::make_shared<LogFormat>("%m"));
+        sink.Log(makeEvent("fresh"));
+        assert(holding.Collect(keep) == 0);
+        holding.Collect(keep, true);
+        assert(held.back() == "fresh");
+    }
+
+    // a producer that died between reserving and committing: the collector waits on the Empty
+    // record until a restarted producer marks the reservation abandoned
+    pid = spawnShmProducer(first, 3000);
+    waitShmProducer(pid);
+    assert(holding.Collect(keep, true) > 0);
+    int fd = ::shm_open(("/nazl-log-" + first).c_str(), O_RDWR, 0);
+    assert(fd >= 0);
+    auto* header = static_cast<ShmRing::Header*>(::mmap(nullptr, sizeof(ShmRing::Header), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0));
+    ::close(fd);
+    assert(header != MAP_FAILED);
+    header->reserve_pos_.fetch_add(64);
+    uint64_t droppedBefore = holding.GetDroppedCount();
+    {
+        SharedMemorySink sink(first, 4096);
+        sink.SetFormat(std::make_shared<LogFormat>("%m"));
+        sink.Log(makeEvent("after restart"));
+        assert(holding.Collect(keep, true) == 1);
+        assert(held.back() == "after restart");
+        assert(holding.GetDroppedCount() == droppedBefore + 1);
+    }
+    ::munmap(header, sizeof(ShmRing::Header));
+
+    // another capacity recreates the ring under the same name, the collector follows
+    {
+        SharedMemorySink sink(first, 8192);
+        assert(sink.IsOpen());
+        sink.SetFormat(std::make_shared<LogFormat>("%m"));
+        sink.Log(makeEvent("resized"));
+        assert(holding.Collect(keep, true) == 1);
+        assert(held.back() == "resized");
+        assert(holding.GetDroppedCount() == droppedBefore + 1);
+    }
+    assert(ShmRing::Remove(first));
+    assert(ShmRing::Remove(second));
+    assert(!ShmRing::Open(first));
+}
+
+void testSocketSink()
+{
+    const std::string path = "./logs/test_socket.sock";
+    ::unlink(path.c_str());
+    std::vector<std::string> lines;
+    auto out = [&](std::string_view message)
+    {
+        lines.emplace_back(message);
+    };
+    auto receiveAll = [&](SocketLogReceiver& receiver)
+    {
+        while (receiver.Receive(out, 200) > 0)
+        {
+        }
+    };
+
+    // events logged before the receiver exists wait in the retry buffer
+    {
+        SocketSink sink(path);
+        sink.SetFormat(std::make_shared<LogFormat>("%m"));
+        sink.SetLevel(LogLevel(LogLevel::LevelEnum::Debug));
+        for (int i = 0; i < 10; ++i)
+        {
+            sink.Log(makeEvent("early " + std::to_string(i)));
+        }
+        SocketLogReceiver receiver(path);
+        assert(receiver.IsOpen());
+        sink.Flush();
+        assert(sink.GetSentCount() == 10);
+        receiveAll(receiver);
+        assert(lines.size() == 10);
+        assert(lines[0] == "early 0" && lines[9] == "early 9");
+        assert(sink.GetDroppedCount() == 0);
+    }
+
+    // a receiver that does not keep up: Log() never blocks, the overflow is dropped and summarized
+    for (auto type : {SocketSink::Type::Datagram, SocketSink::Type::SeqPacket})
+    {
+        lines.clear();
+        SocketLogReceiver receiver(path, type);
+        SocketSink sink(path, type, 4096);
+        sink.SetFormat(std::make_shared<LogFormat>("%m"));
+        sink.SetLevel(LogLevel(LogLevel::LevelEnum::Debug));
+        const int events = 20000;
+        for (int i = 0; i < events; ++i)
+        {
+            sink.Log(makeEvent("event " + std::to_string(i)));
+        }
+        uint64_t dropped = sink.GetDroppedCount();
+        assert(dropped > 0);
+        for (int i = 0; i < 20 && (lines.size() < events - dropped || sink.GetSentCount() < events - dropped); ++i)
+        {
+            receiver.Receive(out, 50);
+            sink.Flush();
+        }
+        receiveAll(receiver);
+        std::size_t received = std::count_if(lines.begin(), lines.end(), [](const std::string& line)
+        {
+            return line.compare(0, 6, "event ") == 0;
+        });
+        assert(received + sink.GetDroppedCount() == events);
+        assert(lines[0] == "event 0");
+        assert(lines.back().find("SocketSink dropped") == 0);
+    }
+    ::unlink(path.c_str());
+}
+
+void testBinaryLog()
+{
+    auto& manager = BinaryLog::binary_log_manager::GetInstance();
+    assert(!manager.IsRunning());
+    manager.Start(logger_manager::GetInstance().GetDefaultLogger());
+    assert(manager.IsRunning());
+    int value = 7;
+    LOG_BIN_INFO("binary int %d uint %u str %s dbl %.2f ptr %p", -1, 2u, "three", 4.5, static_cast<void*>(&value));
+    std::string name = "dma0";
+    LOG_BIN_WARN("binary %s chn %d bytes %llu", name, 3, 1ull << 40);
+
+    const int calls = 10000;
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < calls; ++i)
+    {
+        LOG_BIN_INFO("binary hot path %d", i);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+    manager.Flush();
+    std::cout << "binary log " << elapsed.count() / calls << " ns/call, dropped " << manager.GetDroppedCount() << std::endl;
+
+    // written to a file, the records decode back to what was logged
+    const std::string path = "./logs/test_binary.bin";
+    manager.Stop();
+    manager.Start(path, LogLevel(LogLevel::LevelEnum::Info));
+    uint64_t dropped = manager.GetDroppedCount();
+    LOG_BIN_INFO("binary int %d uint %u str %s dbl %.2f ptr %p", -1, 2u, "three", 4.5, static_cast<void*>(&value));
+    LOG_BIN_WARN("binary %s chn %d bytes %llu", name, 3, 1ull << 40);
+    LOG_BIN_DEBUG("binary below the level %d", 0);
+    begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < calls; ++i)
+    {
+        LOG_BIN_INFO("binary hot path %d", i);
+    }
+    elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+    manager.Flush();
+    manager.Stop();
+    std::cout << "binary log to file " << elapsed.count() / calls << " ns/call" << std::endl;
+    assert(manager.GetDroppedCount() == dropped);
+
+    BinaryLog::FileReader reader(path);
+    assert(reader.IsOpen());
+    std::vector<LogEvent> events;
+    LogEvent event;
+    while (reader.Next(event))
+    {
+        events.push_back(std::move(event));
+    }
+    assert(events.size() == 2 + calls);
+    char pointer[32];
+    snprintf(pointer, sizeof(pointer), "%p", static_cast<void*>(&value));
+    assert(events[0].GetMessage() == std::string("binary int -1 uint 2 str three dbl 4.50 ptr ") + pointer);
+    assert(events[0].GetLevel().GetLevel() == LogLevel::LevelEnum::Info);
+    assert(events[0].GetFunc() == "testBinaryLog");
+    assert(events[0].GetThreadId() == static_cast<uint32_t>(::syscall(SYS_gettid)));
+    assert(events[1].GetMessage() == "binary dma0 chn 3 bytes 1099511627776");
+    assert(events[1].GetLevel().GetLevel() == LogLevel::LevelEnum::Warn);
+    for (int i = 0; i < calls; ++i)
+    {
+        assert(events[2 + i].GetMessage() == "binary hot path " + std::to_string(i));
+        assert(events[2 + i].GetTimestamp() >= events[1 + i].GetTimestamp());
+    }
+    ::unlink(path.c_str());
+    manager.Start(logger_manager::GetInstance().GetDefaultLogger());
+}
+
+int main(int argc, char* argv[])
 {
+    if (argc == 4 && strcmp(argv[1], "--shm-producer") == 0)
+    {
+        return produceShm(argv[2], std::stoull(argv[3])) > 0 ? 0 : 1;
+    }
     std::cout << "hello world" << std::endl;
     log_init("process1");
 
     LOG_INFO("aaaa");
     LOG_DEBUG("bbbb");
     LOG_ERROR("cccc");
+    LOG_INFO_KV("dma done", "chn", 3, "bytes", 4096);
 
+    testAsyncLogger(AsyncLogger::OverflowPolicy::Block);
+    testAsyncLogger(AsyncLogger::OverflowPolicy::Drop);
+    testAsyncLogger(AsyncLogger::OverflowPolicy::OverwriteOldest);
+    testAsyncStdoutSink();
+    testTimeFormat();
+    testCompiledPattern();
+    testZeroAllocation();
+    testLoggerHandle();
+    testFmtStyle();
+    testThreadContext();
+    testRuntimeLevel();
+    testArgumentEvaluation();
+    testModuleLogger();
+    testFileSinkFlushPolicy();
+    testBackgroundRotation();
+    testRotationBackoff();
+    testIndexedRotation();
+    testTimeIndex();
+    testMmapFileSink();
+    testFlightRecorder();
+    testRateLimit();
+    testStructuredFields();
+    testSharedMemory();
+    testSocketSink();
+    testBinaryLog();
 
     return 0;
-}
\ No newline at end of file
+}
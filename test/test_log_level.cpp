@@ -0,0 +1,79 @@
+//
+// Created by zwz on 2024/10/18.
+//
+// Built with NAZL_LOG_ACTIVE_LEVEL at WARN: the DEBUG and INFO calls below must compile to nothing.
+#undef NAZL_LOG_ACTIVE_LEVEL
+#define NAZL_LOG_ACTIVE_LEVEL NAZL_LOG_LEVEL_WARN
+#include <cassert>
+#include <iostream>
+#include "log.h"
+
+NAZL_LOG_MODULE(LevelTestLog, 41, "level_test");
+
+// Declared, never defined: a call that is compiled in fails to link.
+int notLinked();
+
+static int g_evaluated = 0;
+
+static int evaluated(int value)
+{
+    ++g_evaluated;
+    return value;
+}
+
+class CountingSink : public Sink
+{
+public:
+    void Log(const LogEvent& event) override
+    {
+        (void)event;
+        count_++;
+    }
+    void Flush() override {}
+    void SetFormat(std::shared_ptr<LogFormat> format) override
+    {
+        format_ = std::move(format);
+    }
+    void SetLevel(LogLevel log_level) override
+    {
+        level_ = log_level;
+    }
+    LogLevel GetLevel() override
+    {
+        return level_;
+    }
+    int count_{0};
+};
+
+int main()
+{
+    static_assert(NAZL_LOG_ACTIVE_LEVEL == NAZL_LOG_LEVEL_WARN, "built with the WARN threshold");
+    auto sink = std::make_shared<CountingSink>();
+    sink->SetLevel(LogLevel(LogLevel::LevelEnum::Debug));
+    std::vector<std::shared_ptr<Sink>> sinks{sink};
+    logger_manager::GetInstance().RegisterLogger(std::make_shared<Logger>("default", sinks.begin(), sinks.end()));
+    logger_manager::GetInstance().RegisterLogger(std::make_shared<Logger>("level_test", sinks.begin(), sinks.end()));
+
+    // the runtime level would let these through, the compile-time threshold does not
+    LOG_DEBUG("%d", notLinked());
+    LOG_INFO("%d", notLinked());
+    LOG_DEBUG_TO("level_test", "%d", notLinked());
+    LOG_INFO_TO("level_test", "%d", notLinked());
+    LOGF_DEBUG("{}", notLinked());
+    LOGF_INFO_TO("level_test", "{}", notLinked());
+    LOG_DEBUG_KV("kv", "n", notLinked());
+    LOG_INFO_KV("kv", "n", notLinked());
+    LOG_DEBUG_KV_TO("level_test", "kv", "n", notLinked());
+    LOG_EVERY_N_TO("level_test", Info, 10, "%d", notLinked());
+    LOG_MODULE_DEBUG(LevelTestLog, "%d", notLinked());
+    LOGF_MODULE_INFO(LevelTestLog, "{}", notLinked());
+    assert(sink->count_ == 0);
+
+    LOG_WARN("%d", evaluated(1));
+    LOGF_ERROR_TO("level_test", "{}", evaluated(2));
+    LOG_MODULE_WARN(LevelTestLog, "%d", evaluated(3));
+    assert(g_evaluated == 3);
+    assert(sink->count_ == 3);
+    std::cout << "compile-time level: DEBUG and INFO compiled out" << std::endl;
+    return 0;
+}
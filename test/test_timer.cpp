@@ -77,6 +77,37 @@ void testMultipleTimers()
     std::cout << "Multiple timers test passed." << std::endl;
 }
 
+void testTimerStats()
+{
+    std::cout << "Testing timer stats..." << std::endl;
+    Nazl::TimerMgr timerMgr;
+    std::atomic<int> callCount(0);
+
+    auto periodic = timerMgr.createTimer(std::chrono::milliseconds(100), [&callCount]()
+    {
+        callCount++;
+    }, true);
+    auto oneShot = timerMgr.createTimer(std::chrono::seconds(5), []() {});
+
+    timerMgr.start(periodic);
+    timerMgr.start(oneShot);
+    std::this_thread::sleep_for(std::chrono::milliseconds(550));
+    timerMgr.stop(periodic);
+    timerMgr.stop(oneShot);
+
+    auto stats = timerMgr.getStats();
+    assert(stats.started_ == 2);
+    assert(stats.fired_ == static_cast<uint64_t>(callCount));
+    assert(stats.rearmed_ == stats.fired_);
+    assert(stats.cancelled_ == 2);
+    assert(stats.lateness_.count_ == stats.fired_);
+    assert(stats.callback_.count_ == stats.fired_);
+    timerMgr.dumpStats();
+
+    timerMgr.resetStats();
+    assert(timerMgr.getStats().fired_ == 0);
+    std::cout << "Timer stats test passed." << std::endl;
+}
 
 int main()
 {
@@ -86,6 +117,8 @@ int main()
     std::cout << std::endl;
     testMultipleTimers();
     std::cout << std::endl;
+    testTimerStats();
+    std::cout << std::endl;
     std::cout << "All tests passed successfully!" << std::endl;
     return 0;
 }
@@ -0,0 +1,44 @@
+//
+// Created by zwz on 2024/10/17.
+//
+// Prints the events kept in a flight recorder file, oldest first, e.g. after a crash.
+// usage: nazl_flight_recorder <recorder file>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "flight_recorder.h"
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " <recorder file>" << std::endl;
+        return 1;
+    }
+    int fd = ::open(argv[1], O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        std::cerr << "cannot open " << argv[1] << std::endl;
+        return 1;
+    }
+    auto size = static_cast<std::size_t>(st.st_size);
+    void* map = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+    {
+        std::cerr << "cannot map " << argv[1] << std::endl;
+        return 1;
+    }
+    int64_t records = FlightRecorderSink::Dump(static_cast<const char*>(map), size, STDOUT_FILENO);
+    ::munmap(map, size);
+    if (records < 0)
+    {
+        std::cerr << "not a flight recorder file: " << argv[1] << std::endl;
+        return 1;
+    }
+    std::cerr << records << " records" << std::endl;
+    return 0;
+}
@@ -0,0 +1,94 @@
+//
+// Created by zwz on 2024/10/18.
+//
+// Merges the shared-memory log rings of several processes into one ordered, rotated file.
+// usage: nazl_log_collector [-s max_size] [-n max_files] [-z] <output file> <ring name>...
+#include <atomic>
+#include <csignal>
+#include <iostream>
+#include <thread>
+#include <unistd.h>
+#include "file_writer.h"
+#include "log_rotator.h"
+#include "shm_log.h"
+
+namespace
+{
+std::atomic<bool> g_running{true};
+
+void OnSignal(int)
+{
+    g_running = false;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    std::size_t max_size = 64 * 1024 * 1024;
+    std::size_t max_files = 10;
+    auto compression = LogRotator::Compression::None;
+    int opt;
+    while ((opt = ::getopt(argc, argv, "s:n:z")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            max_size = std::stoull(optarg);
+            break;
+        case 'n':
+            max_files = std::stoull(optarg);
+            break;
+        case 'z':
+            compression = LogRotator::Compression::Gzip;
+            break;
+        default:
+            std::cerr << "usage: " << argv[0] << " [-s max_size] [-n max_files] [-z] <output file> <ring name>..." << std::endl;
+            return 1;
+        }
+    }
+    if (argc - optind < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " [-s max_size] [-n max_files] [-z] <output file> <ring name>..." << std::endl;
+        return 1;
+    }
+    std::string path = argv[optind];
+    LogCollector collector;
+    for (int i = optind + 1; i < argc; ++i)
+    {
+        collector.AddRing(argv[i]);
+    }
+    Nazl::FileWriter writer;
+    if (!writer.open(path))
+    {
+        return 1;
+    }
+    auto rotator = log_rotator::GetInstance();
+    ::signal(SIGINT, OnSignal);
+    ::signal(SIGTERM, OnSignal);
+    auto write = [&](std::string_view data)
+    {
+        if (writer.size() > 0 && writer.size() + data.size() > max_size)
+        {
+            writer.close();
+            rotator->Rotate(path, max_files, compression);
+            writer.open(path);
+        }
+        writer.write(data.data(), data.size());
+    };
+    while (g_running)
+    {
+        if (collector.Collect(write) > 0)
+        {
+            writer.flush();
+        }
+        else
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        }
+    }
+    collector.Collect(write, true);
+    writer.close();
+    rotator->WaitIdle();
+    std::cerr << "collector stopped, producers dropped " << collector.GetDroppedCount() << " records" << std::endl;
+    return 0;
+}
@@ -0,0 +1,29 @@
+//
+// Created by zwz on 2024/10/15.
+//
+// Offline decoder for files written by the binary (deferred) logger.
+// usage: nazl_log_decode <binary log file> [pattern]
+#include <iostream>
+#include "binary_log.h"
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "usage: " << argv[0] << " <binary log file> [pattern]" << std::endl;
+        return 1;
+    }
+    BinaryLog::FileReader reader(argv[1]);
+    if (!reader.IsOpen())
+    {
+        std::cerr << "not a binary log file: " << argv[1] << std::endl;
+        return 1;
+    }
+    LogFormat format(argc > 2 ? argv[2] : "");
+    LogEvent event;
+    while (reader.Next(event))
+    {
+        format.Format(std::cout, event);
+    }
+    return 0;
+}
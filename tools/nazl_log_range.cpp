@@ -0,0 +1,247 @@
+//
+// Created by zwz on 2024/10/18.
+//
+// Prints the lines of a time range across all segments of a log, oldest first, using the sparse
+// .idx index written by FileSink to map only the blocks in range.
+// usage: nazl_log_range <log file> <from> <to> [min level]
+//   from/to: "YYYY-MM-DD HH:MM:SS" (local time, as %T prints it) or seconds since the epoch
+// Lines inside partially covered blocks are filtered by a leading %T timestamp and by the level
+// name as a whole word; lines without them are kept. Compressed segments are skipped.
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "log_index.h"
+
+namespace
+{
+constexpr uint64_t kNanos = 1000000000ull;
+
+bool ParseTime(const std::string& text, uint64_t& nanos)
+{
+    std::tm tm{};
+    const char* end = ::strptime(text.c_str(), "%Y-%m-%d %H:%M:%S", &tm);
+    if (end && *end == '\0')
+    {
+        tm.tm_isdst = -1;
+        nanos = static_cast<uint64_t>(::mktime(&tm)) * kNanos;
+        return true;
+    }
+    char* number_end = nullptr;
+    double seconds = ::strtod(text.c_str(), &number_end);
+    if (number_end && *number_end == '\0' && seconds >= 0)
+    {
+        nanos = static_cast<uint64_t>(seconds * kNanos);
+        return true;
+    }
+    return false;
+}
+
+// Oldest first: the manifest for indexed rotation, else .N .. .1, then the live file.
+std::vector<std::string> ListSegments(const std::string& file_name)
+{
+    std::vector<std::string> segments;
+    std::ifstream manifest(LogRotator::ManifestName(file_name));
+    std::string line;
+    while (std::getline(manifest, line))
+    {
+        std::istringstream fields(line);
+        uint64_t index, start, size;
+        std::string name;
+        if (fields >> index >> start >> size >> name)
+        {
+            segments.push_back(name);
+        }
+    }
+    if (segments.empty())
+    {
+        struct stat st;
+        std::size_t count = 0;
+        while (::stat((file_name + "." + std::to_string(count + 1)).c_str(), &st) == 0 ||
+               ::stat((file_name + "." + std::to_string(count + 1) + ".gz").c_str(), &st) == 0)
+        {
+            ++count;
+        }
+        for (std::size_t i = count; i >= 1; --i)
+        {
+            segments.push_back(file_name + "." + std::to_string(i));
+        }
+    }
+    segments.push_back(file_name);
+    return segments;
+}
+
+class RangePrinter
+{
+public:
+    RangePrinter(uint64_t from, uint64_t to, LogLevel::LevelEnum level) : from_(from), to_(to), level_(level) {}
+
+    void PrintSegment(const std::string& segment)
+    {
+        int fd = ::open(segment.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            std::cerr << "skipping " << segment << " (missing or compressed)" << std::endl;
+            return;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0)
+        {
+            ::close(fd);
+            return;
+        }
+        uint64_t size = static_cast<uint64_t>(st.st_size);
+        void* map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (map == MAP_FAILED)
+        {
+            perror(("Failed to map " + segment).c_str());
+            return;
+        }
+        // random: only the blocks we pick are read, no readahead around the index lookups
+        ::madvise(map, size, MADV_RANDOM);
+        const char* data = static_cast<const char*>(map);
+        total_ += size;
+        uint64_t covered = 0;
+        for (auto& entry : LogIndexWriter::Load(segment))
+        {
+            if (entry.offset_ >= size)
+            {
+                break;
+            }
+            if (entry.offset_ > covered)
+            {
+                PrintUnindexed(data, covered, entry.offset_);
+            }
+            uint64_t end = std::min<uint64_t>(entry.offset_ + entry.size_, size);
+            covered = std::max(covered, end);
+            if (entry.last_ns_ < from_ || entry.first_ns_ > to_ || !entry.HasLevelAtLeast(level_))
+            {
+                continue;
+            }
+            bool whole = entry.first_ns_ >= from_ && entry.last_ns_ <= to_ &&
+                         (entry.levels_ & ((1u << static_cast<int>(level_)) - 1)) == 0;
+            PrintBlock(data + entry.offset_, end - entry.offset_, whole);
+        }
+        if (covered < size)
+        {
+            PrintUnindexed(data, covered, size);
+        }
+        ::munmap(map, size);
+    }
+    void PrintStats() const
+    {
+        std::cerr << "read " << read_ << " of " << total_ << " bytes" << std::endl;
+    }
+private:
+    void PrintUnindexed(const char* data, uint64_t begin, uint64_t end)
+    {
+        PrintBlock(data + begin, end - begin, false);
+    }
+    void PrintBlock(const char* data, uint64_t size, bool whole)
+    {
+        read_ += size;
+        uintptr_t page = reinterpret_cast<uintptr_t>(data) & ~(static_cast<uintptr_t>(::getpagesize()) - 1);
+        ::madvise(reinterpret_cast<void*>(page), reinterpret_cast<uintptr_t>(data) + size - page, MADV_WILLNEED);
+        if (whole)
+        {
+            fwrite(data, 1, size, stdout);
+            return;
+        }
+        const char* end = data + size;
+        while (data < end)
+        {
+            const char* eol = static_cast<const char*>(memchr(data, '\n', static_cast<std::size_t>(end - data)));
+            const char* next = eol ? eol + 1 : end;
+            std::string_view line(data, static_cast<std::size_t>(next - data));
+            if (InRange(line) && LevelOk(line))
+            {
+                fwrite(line.data(), 1, line.size(), stdout);
+            }
+            data = next;
+        }
+    }
+    bool InRange(std::string_view line)
+    {
+        // "YYYY-MM-DD HH:MM:SS" at the start of the line, one mktime per distinct second
+        constexpr std::size_t kStampSize = 19;
+        if (line.size() < kStampSize || line[4] != '-' || line[10] != ' ' || line[13] != ':')
+        {
+            return true;
+        }
+        if (line.compare(0, kStampSize, last_stamp_) != 0)
+        {
+            last_stamp_.assign(line.data(), kStampSize);
+            if (!ParseTime(last_stamp_, last_ns_))
+            {
+                last_ns_ = from_;
+            }
+        }
+        // the line's second overlaps the range
+        return last_ns_ + kNanos > from_ && last_ns_ <= to_;
+    }
+    // The first level name in the line is taken as its %L; lines without one are kept.
+    bool LevelOk(std::string_view line) const
+    {
+        if (level_ == LogLevel::LevelEnum::Debug)
+        {
+            return true;
+        }
+        std::size_t first = std::string_view::npos;
+        int first_level = static_cast<int>(level_);
+        for (int level = 0; level <= static_cast<int>(LogLevel::LevelEnum::Fatal); ++level)
+        {
+            auto name = LogLevel::ToString(static_cast<LogLevel::LevelEnum>(level));
+            for (std::size_t pos = line.find(name); pos < first; pos = line.find(name, pos + 1))
+            {
+                bool before = pos == 0 || !isalpha(static_cast<unsigned char>(line[pos - 1]));
+                bool after = pos + name.size() >= line.size() || !isalpha(static_cast<unsigned char>(line[pos + name.size()]));
+                if (before && after)
+                {
+                    first = pos;
+                    first_level = level;
+                    break;
+                }
+            }
+        }
+        return first_level >= static_cast<int>(level_);
+    }
+private:
+    uint64_t from_;
+    uint64_t to_;
+    LogLevel::LevelEnum level_;
+    std::string last_stamp_;
+    uint64_t last_ns_{0};
+    uint64_t read_{0};
+    uint64_t total_{0};
+};
+}
+
+int main(int argc, char* argv[])
+{
+    uint64_t from, to;
+    if (argc < 4 || !ParseTime(argv[2], from) || !ParseTime(argv[3], to))
+    {
+        std::cerr << "usage: " << argv[0] << " <log file> <from> <to> [min level]" << std::endl;
+        std::cerr << "  from/to: \"YYYY-MM-DD HH:MM:SS\" or seconds since the epoch" << std::endl;
+        return 1;
+    }
+    // "to" names a second, include all of it
+    to += kNanos - 1;
+    RangePrinter printer(from, to, argc > 4 ? LogLevel::FromString(argv[4]) : LogLevel::LevelEnum::Debug);
+    for (auto& segment : ListSegments(argv[1]))
+    {
+        printer.PrintSegment(segment);
+    }
+    fflush(stdout);
+    printer.PrintStats();
+    return 0;
+}
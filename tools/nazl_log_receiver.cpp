@@ -0,0 +1,60 @@
+//
+// Created by zwz on 2024/10/18.
+//
+// Stand-in log daemon: prints what the socket sinks of local processes send, until SIGINT/SIGTERM.
+// usage: nazl_log_receiver [-p] <socket path>
+//   -p: SOCK_SEQPACKET instead of SOCK_DGRAM, must match socket_sink.type
+#include <atomic>
+#include <csignal>
+#include <cstdio>
+#include <iostream>
+#include <unistd.h>
+#include "socket_sink.h"
+
+namespace
+{
+std::atomic<bool> g_running{true};
+
+void OnSignal(int)
+{
+    g_running = false;
+}
+}
+
+int main(int argc, char* argv[])
+{
+    auto type = SocketSink::Type::Datagram;
+    int opt;
+    while ((opt = ::getopt(argc, argv, "p")) != -1)
+    {
+        if (opt != 'p')
+        {
+            std::cerr << "usage: " << argv[0] << " [-p] <socket path>" << std::endl;
+            return 1;
+        }
+        type = SocketSink::Type::SeqPacket;
+    }
+    if (argc - optind != 1)
+    {
+        std::cerr << "usage: " << argv[0] << " [-p] <socket path>" << std::endl;
+        return 1;
+    }
+    SocketLogReceiver receiver(argv[optind], type);
+    if (!receiver.IsOpen())
+    {
+        return 1;
+    }
+    ::signal(SIGINT, OnSignal);
+    ::signal(SIGTERM, OnSignal);
+    uint64_t messages = 0;
+    while (g_running)
+    {
+        messages += receiver.Receive([](std::string_view message)
+        {
+            fwrite(message.data(), 1, message.size(), stdout);
+        }, 100);
+        fflush(stdout);
+    }
+    std::cerr << "receiver stopped, " << messages << " messages" << std::endl;
+    return 0;
+}